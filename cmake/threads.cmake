@@ -0,0 +1,6 @@
+include_guard(DIRECTORY)
+
+set(THREADS_PREFER_PTHREAD_FLAG ON)
+find_package(Threads REQUIRED)
+
+set(STF_LINK_LIBS ${STF_LINK_LIBS} Threads::Threads)
@@ -0,0 +1,310 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <ios>
+#include <iostream>
+#include <iterator>
+#include <locale>
+#include <streambuf>
+#include <type_traits>
+#include <vector>
+
+#include <unistd.h>
+
+#include "stf_exception.hpp"
+
+namespace trace_tools {
+    /**
+     * \class FastNumPut
+     *
+     * num_put facet that formats decimal and hexadecimal integers with a hand-rolled conversion instead of
+     * going through printf-style formatting. Width, fill, adjustment and uppercase flags are honored, so the
+     * output is identical to std::num_put. Anything else (octal, showbase, showpos, locales with digit
+     * grouping, floating point, bools and pointers) is passed through to std::num_put. Whether a stream's
+     * locale uses grouping is cached in the stream and rechecked only when the stream is imbued.
+     */
+    class FastNumPut : public std::num_put<char> {
+        private:
+            static constexpr size_t MAX_DIGITS_ = 20; // Enough for a 64-bit value in decimal
+
+            /**
+             * Per-stream state stored in iword(groupingIndex_()), so that the locale is only inspected when
+             * it changes
+             */
+            enum GroupingState_ : long {
+                GROUPING_UNKNOWN_ = 0, // Not checked yet and no imbue callback registered
+                GROUPING_DISABLED_ = 1,
+                GROUPING_ENABLED_ = 2,
+                GROUPING_STALE_ = 3 // Imbue callback registered, but the locale changed since the last check
+            };
+
+            static inline int groupingIndex_() {
+                static const int index = std::ios_base::xalloc();
+                return index;
+            }
+
+            static void imbueCallback_(const std::ios_base::event event, std::ios_base& str, const int index) {
+                if(event == std::ios_base::imbue_event) {
+                    str.iword(index) = GROUPING_STALE_;
+                }
+            }
+
+            static bool usesGrouping_(std::ios_base& str) {
+                const int index = groupingIndex_();
+                long& state = str.iword(index);
+
+                if(STF_EXPECT_FALSE(state != GROUPING_DISABLED_ && state != GROUPING_ENABLED_)) {
+                    if(state == GROUPING_UNKNOWN_) {
+                        str.register_callback(imbueCallback_, index);
+                    }
+                    state = std::use_facet<std::numpunct<char>>(str.getloc()).grouping().empty() ? GROUPING_DISABLED_ :
+                                                                                                  GROUPING_ENABLED_;
+                }
+
+                return state == GROUPING_ENABLED_;
+            }
+
+            static inline bool useFastPath_(std::ios_base& str) {
+                const auto flags = str.flags();
+                const auto basefield = flags & std::ios_base::basefield;
+                return (basefield == std::ios_base::dec || basefield == std::ios_base::hex) &&
+                       !(flags & (std::ios_base::showbase | std::ios_base::showpos)) &&
+                       !usesGrouping_(str);
+            }
+
+            template<typename T>
+            static iter_type put_(iter_type out, std::ios_base& str, const char_type fill, const T val) {
+                using UnsignedType = std::make_unsigned_t<T>;
+
+                std::array<char, MAX_DIGITS_> buf;
+                const auto end = buf.end();
+                auto it = end;
+
+                const auto flags = str.flags();
+                auto uval = static_cast<UnsignedType>(val);
+                bool negative = false;
+
+                if((flags & std::ios_base::basefield) == std::ios_base::hex) {
+                    // Negative values are printed as their two's complement representation, just like std::num_put
+                    const char* const digits = (flags & std::ios_base::uppercase) ? "0123456789ABCDEF" : "0123456789abcdef";
+                    do {
+                        *--it = digits[uval & 0xf];
+                        uval >>= 4;
+                    }
+                    while(uval);
+                }
+                else {
+                    if constexpr(std::is_signed_v<T>) {
+                        if(val < 0) {
+                            negative = true;
+                            uval = static_cast<UnsignedType>(UnsignedType(0) - uval);
+                        }
+                    }
+
+                    do {
+                        *--it = static_cast<char>('0' + (uval % 10));
+                        uval /= 10;
+                    }
+                    while(uval);
+                }
+
+                const auto len = static_cast<std::streamsize>(std::distance(it, end)) + negative;
+                const auto width = str.width();
+                str.width(0);
+                const auto padding = width > len ? width - len : 0;
+                const auto adjust = flags & std::ios_base::adjustfield;
+
+                if(adjust != std::ios_base::left && adjust != std::ios_base::internal) {
+                    out = std::fill_n(out, padding, fill);
+                }
+                if(negative) {
+                    *out++ = '-';
+                }
+                if(adjust == std::ios_base::internal) {
+                    out = std::fill_n(out, padding, fill);
+                }
+                out = std::copy(it, end, out);
+                if(adjust == std::ios_base::left) {
+                    out = std::fill_n(out, padding, fill);
+                }
+
+                return out;
+            }
+
+            template<typename T>
+            inline iter_type dispatch_(iter_type out, std::ios_base& str, const char_type fill, const T val) const {
+                if(STF_EXPECT_TRUE(useFastPath_(str))) {
+                    return put_(out, str, fill, val);
+                }
+
+                return std::num_put<char>::do_put(out, str, fill, val);
+            }
+
+        protected:
+            iter_type do_put(iter_type out, std::ios_base& str, char_type fill, long val) const override {
+                return dispatch_(out, str, fill, val);
+            }
+
+            iter_type do_put(iter_type out, std::ios_base& str, char_type fill, unsigned long val) const override {
+                return dispatch_(out, str, fill, val);
+            }
+
+            iter_type do_put(iter_type out, std::ios_base& str, char_type fill, long long val) const override {
+                return dispatch_(out, str, fill, val);
+            }
+
+            iter_type do_put(iter_type out, std::ios_base& str, char_type fill, unsigned long long val) const override {
+                return dispatch_(out, str, fill, val);
+            }
+
+        public:
+            using std::num_put<char>::num_put;
+    };
+
+    /**
+     * \class BufferedOutputStreambuf
+     *
+     * Stream buffer that collects output in a large buffer and writes it to a file descriptor with a single
+     * write() call whenever the buffer fills up. Flush requests (e.g. std::endl) are ignored unless the file
+     * descriptor is a terminal, so that interactive output still appears line by line.
+     */
+    class BufferedOutputStreambuf : public std::streambuf {
+        public:
+            static constexpr size_t DEFAULT_BUFFER_SIZE = 4 * 1024 * 1024; /**< Default buffer size in bytes */
+
+        private:
+            const int fd_;
+            const bool flush_on_sync_;
+            std::vector<char> buffer_;
+
+            bool write_(const char* data, size_t size) const {
+                while(size) {
+                    const auto bytes_written = ::write(fd_, data, size);
+                    if(STF_EXPECT_FALSE(bytes_written < 0)) {
+                        if(errno == EINTR) {
+                            continue;
+                        }
+                        return false;
+                    }
+
+                    data += bytes_written;
+                    size -= static_cast<size_t>(bytes_written);
+                }
+
+                return true;
+            }
+
+        protected:
+            int_type overflow(const int_type ch) override {
+                if(!flush()) {
+                    return traits_type::eof();
+                }
+
+                if(!traits_type::eq_int_type(ch, traits_type::eof())) {
+                    *pptr() = traits_type::to_char_type(ch);
+                    pbump(1);
+                }
+
+                return traits_type::not_eof(ch);
+            }
+
+            std::streamsize xsputn(const char_type* s, const std::streamsize count) override {
+                const auto size = static_cast<size_t>(count);
+
+                if(STF_EXPECT_TRUE(size <= static_cast<size_t>(epptr() - pptr()))) {
+                    std::memcpy(pptr(), s, size);
+                    pbump(static_cast<int>(count));
+                    return count;
+                }
+
+                if(!flush()) {
+                    return 0;
+                }
+
+                // Anything that won't fit in an empty buffer goes straight to the file descriptor
+                if(size >= buffer_.size()) {
+                    return write_(s, size) ? count : 0;
+                }
+
+                std::memcpy(pptr(), s, size);
+                pbump(static_cast<int>(count));
+                return count;
+            }
+
+            int sync() override {
+                if(flush_on_sync_) {
+                    return flush() ? 0 : -1;
+                }
+
+                return 0;
+            }
+
+        public:
+            /**
+             * Constructs a BufferedOutputStreambuf
+             * \param fd File descriptor to write to
+             * \param buffer_size Size of the output buffer in bytes
+             */
+            explicit BufferedOutputStreambuf(const int fd, const size_t buffer_size = DEFAULT_BUFFER_SIZE) :
+                fd_(fd),
+                flush_on_sync_(isatty(fd)),
+                buffer_(buffer_size)
+            {
+                setp(buffer_.data(), buffer_.data() + buffer_.size());
+            }
+
+            BufferedOutputStreambuf(const BufferedOutputStreambuf&) = delete;
+            BufferedOutputStreambuf& operator=(const BufferedOutputStreambuf&) = delete;
+
+            ~BufferedOutputStreambuf() override {
+                flush();
+            }
+
+            /**
+             * Writes out everything in the buffer. Returns false if the write failed.
+             */
+            bool flush() {
+                const bool success = write_(pbase(), static_cast<size_t>(pptr() - pbase()));
+                setp(buffer_.data(), buffer_.data() + buffer_.size());
+                return success;
+            }
+    };
+
+    /**
+     * \class BufferedStdout
+     *
+     * Redirects std::cout through a BufferedOutputStreambuf and a FastNumPut facet for the lifetime of the
+     * object. Anything written to std::cout, including through stf::print_utils and record stream operators,
+     * produces exactly the same bytes, just much faster.
+     */
+    class BufferedStdout {
+        private:
+            BufferedOutputStreambuf buf_;
+            std::streambuf* const orig_buf_;
+            const std::locale orig_locale_;
+
+        public:
+            /**
+             * Constructs a BufferedStdout
+             * \param buffer_size Size of the output buffer in bytes
+             */
+            explicit BufferedStdout(const size_t buffer_size = BufferedOutputStreambuf::DEFAULT_BUFFER_SIZE) :
+                buf_(STDOUT_FILENO, buffer_size),
+                orig_buf_(std::cout.flush().rdbuf(&buf_)),
+                orig_locale_(std::cout.imbue(std::locale(std::cout.getloc(), new FastNumPut)))
+            {
+            }
+
+            BufferedStdout(const BufferedStdout&) = delete;
+            BufferedStdout& operator=(const BufferedStdout&) = delete;
+
+            ~BufferedStdout() {
+                buf_.flush();
+                std::cout.imbue(orig_locale_);
+                std::cout.rdbuf(orig_buf_);
+            }
+    };
+} // end namespace trace_tools
@@ -5,71 +5,249 @@
 #include <limits>
 #include <map>
 #include <set>
-#include <unordered_map>
+#include <type_traits>
 #include <vector>
-#include "boost_wrappers/small_vector.hpp"
 
+#include "stf_enum_utils.hpp"
 #include "stf_inst.hpp"
 
-template<typename DerivedT, typename DependencyT>
-class DependencyTracker {
-    protected:
-        class Consumer {
-            private:
-                uint64_t index_;
-
-            public:
-                explicit Consumer(const uint64_t index) :
-                    index_(index)
-                {
-                }
+/**
+ * \class RegisterProducerTable
+ *
+ * Maps each register to the index of the last instruction that wrote it. Lookups index directly into a flat
+ * array, so they never allocate or throw.
+ */
+class RegisterProducerTable {
+    public:
+        static constexpr uint64_t NO_PRODUCER = std::numeric_limits<uint64_t>::max(); /**< Returned by find() if the register has no producer */
 
-                inline uint64_t getIndex() const {
-                    return index_;
-                }
+    private:
+        using RegInt = stf::enums::int_t<stf::Registers::STF_REG>;
+        static_assert(sizeof(RegInt) <= sizeof(uint16_t), "STF_REG is too wide to index a flat producer table");
+        static constexpr size_t NUM_REGS_ = static_cast<size_t>(std::numeric_limits<RegInt>::max()) + 1;
+
+        std::vector<uint64_t> indices_;
+
+        static inline size_t getRegIndex_(const stf::Registers::STF_REG reg) {
+            return static_cast<size_t>(stf::enums::to_int(reg));
+        }
+
+    public:
+        explicit RegisterProducerTable(const uint64_t max_distance) :
+            indices_(NUM_REGS_, NO_PRODUCER)
+        {
+            (void)max_distance;
+        }
+
+        /**
+         * Gets the index of the last producer of reg, or NO_PRODUCER if there isn't one
+         */
+        inline uint64_t find(const stf::Registers::STF_REG reg) const {
+            return indices_[getRegIndex_(reg)];
+        }
+
+        /**
+         * Sets the producer of reg, replacing any previous producer
+         */
+        inline void insert(const stf::Registers::STF_REG reg, const uint64_t index) {
+            indices_[getRegIndex_(reg)] = index;
+        }
+
+        /**
+         * Removes the producer of reg
+         */
+        inline void erase(const stf::Registers::STF_REG reg) {
+            indices_[getRegIndex_(reg)] = NO_PRODUCER;
+        }
+};
+
+/**
+ * \class AddressProducerTable
+ *
+ * Maps each address to the index of the last instruction that wrote it, using a linear-probing open-addressing
+ * hash table. Lookups never allocate or throw.
+ *
+ * Producers that are more than max_distance instructions older than the instruction being inserted can no longer
+ * be reported by the tracker. Every insertion is also recorded in a ring buffer ordered by instruction index, so
+ * producers are retired from the table in amortized O(1) as soon as they fall out of the window. The memory used
+ * is therefore proportional to the number of stores within the window rather than the length of the trace.
+ */
+class AddressProducerTable {
+    public:
+        static constexpr uint64_t NO_PRODUCER = std::numeric_limits<uint64_t>::max(); /**< Returned by find() if the address has no producer */
+
+    private:
+        struct Entry {
+            uint64_t address = 0;
+            uint64_t index = NO_PRODUCER;
+
+            inline bool empty() const {
+                return index == NO_PRODUCER;
+            }
         };
 
-        using ConsumerMap = std::unordered_multimap<DependencyT, Consumer>;
+        static constexpr size_t INITIAL_CAPACITY_ = 1024;
+
+        const uint64_t max_distance_;
+        const bool windowed_; // Producers can only fall out of the window if max_distance_ is finite
+        std::vector<Entry> entries_;
+        size_t mask_ = INITIAL_CAPACITY_ - 1;
+        size_t num_occupied_ = 0;
+
+        // Ring buffer of every insertion, oldest first
+        std::vector<Entry> window_;
+        size_t window_head_ = 0;
+        size_t window_size_ = 0;
+
+        static inline size_t hash_(uint64_t address) {
+            // Addresses are usually aligned, so mix the upper bits into the lower ones
+            address ^= address >> 33;
+            address *= 0xff51afd7ed558ccdULL;
+            address ^= address >> 33;
+            return static_cast<size_t>(address);
+        }
 
-        class Producer {
-            private:
-                std::vector<typename ConsumerMap::iterator> consumers_;
-                uint64_t index_;
+        inline bool isStale_(const Entry& entry, const uint64_t cur_index) const {
+            return cur_index - entry.index > max_distance_;
+        }
 
-            public:
-                explicit Producer(const uint64_t index) :
-                    index_(index)
-                {
+        inline size_t getWindowSlot_(const size_t offset) const {
+            return (window_head_ + offset) & (window_.size() - 1);
+        }
+
+        void growWindow_() {
+            std::vector<Entry> new_window(window_.size() * 2);
+            for(size_t i = 0; i < window_size_; ++i) {
+                new_window[i] = window_[getWindowSlot_(i)];
+            }
+            window_.swap(new_window);
+            window_head_ = 0;
+        }
+
+        /**
+         * Removes the entry in slot, shifting any entries later in its probe sequence back to fill the hole
+         */
+        void eraseSlot_(size_t slot) {
+            for(size_t next = (slot + 1) & mask_; !entries_[next].empty(); next = (next + 1) & mask_) {
+                const size_t home = hash_(entries_[next].address) & mask_;
+                // The entry can move into the hole if the hole lies between its home slot and its current slot
+                if(((next - home) & mask_) >= ((next - slot) & mask_)) {
+                    entries_[slot] = entries_[next];
+                    slot = next;
                 }
+            }
+
+            entries_[slot] = Entry();
+            --num_occupied_;
+        }
 
-                inline void addConsumer(const typename ConsumerMap::iterator& consumer) {
-                    consumers_.emplace_back(consumer);
+        /**
+         * Removes address from the table if index is still its most recent producer
+         */
+        void eraseProducer_(const uint64_t address, const uint64_t index) {
+            for(size_t slot = hash_(address) & mask_; !entries_[slot].empty(); slot = (slot + 1) & mask_) {
+                if(entries_[slot].address == address) {
+                    if(entries_[slot].index == index) {
+                        eraseSlot_(slot);
+                    }
+                    return;
                 }
+            }
+        }
+
+        /**
+         * Retires every producer that is too old to be reported for cur_index or any later instruction
+         */
+        void retire_(const uint64_t cur_index) {
+            while(window_size_ && isStale_(window_[window_head_], cur_index)) {
+                const auto& entry = window_[window_head_];
+                eraseProducer_(entry.address, entry.index);
+                window_head_ = getWindowSlot_(1);
+                --window_size_;
+            }
+        }
 
-                inline const auto& getConsumers() const {
-                    return consumers_;
+        void grow_() {
+            std::vector<Entry> old_entries(entries_.size() * 2);
+            old_entries.swap(entries_);
+            mask_ = entries_.size() - 1;
+
+            for(const auto& entry: old_entries) {
+                if(!entry.empty()) {
+                    size_t slot = hash_(entry.address) & mask_;
+                    while(!entries_[slot].empty()) {
+                        slot = (slot + 1) & mask_;
+                    }
+                    entries_[slot] = entry;
                 }
+            }
+        }
+
+    public:
+        explicit AddressProducerTable(const uint64_t max_distance) :
+            max_distance_(max_distance),
+            windowed_(max_distance != std::numeric_limits<uint64_t>::max()),
+            entries_(INITIAL_CAPACITY_),
+            window_(windowed_ ? INITIAL_CAPACITY_ : 0)
+        {
+        }
 
-                inline uint64_t getIndex() const {
-                    return index_;
+        /**
+         * Gets the index of the last producer of address, or NO_PRODUCER if there isn't one
+         */
+        inline uint64_t find(const uint64_t address) const {
+            for(size_t slot = hash_(address) & mask_; !entries_[slot].empty(); slot = (slot + 1) & mask_) {
+                if(entries_[slot].address == address) {
+                    return entries_[slot].index;
                 }
-        };
+            }
 
-        using ProducerMap = std::unordered_map<DependencyT, Producer>;
+            return NO_PRODUCER;
+        }
 
-        const uint64_t max_distance_ = 0;
-        ProducerMap producers_;
-        ConsumerMap consumers_;
+        /**
+         * Sets the producer of address, replacing any previous producer
+         */
+        inline void insert(const uint64_t address, const uint64_t index) {
+            if(windowed_) {
+                retire_(index);
 
-    private:
-        inline auto removeProducer_(const typename ProducerMap::iterator producer_it) {
-            for(const auto& it: producer_it->second.getConsumers()) {
-                consumers_.erase(it);
+                if(STF_EXPECT_FALSE(window_size_ == window_.size())) {
+                    growWindow_();
+                }
+                window_[getWindowSlot_(window_size_)] = Entry{address, index};
+                ++window_size_;
+            }
+
+            size_t slot = hash_(address) & mask_;
+            for(; !entries_[slot].empty(); slot = (slot + 1) & mask_) {
+                auto& entry = entries_[slot];
+                if(entry.address == address) {
+                    entry.index = index;
+                    return;
+                }
+            }
+
+            entries_[slot].address = address;
+            entries_[slot].index = index;
+
+            // Keep the load factor at or below 1/2
+            if(STF_EXPECT_FALSE(++num_occupied_ * 2 > entries_.size())) {
+                grow_();
             }
-            return producers_.erase(producer_it);
         }
+};
 
+template<typename DerivedT, typename DependencyT>
+class DependencyTracker {
     protected:
+        using ProducerTable = std::conditional_t<std::is_same_v<DependencyT, stf::Registers::STF_REG>,
+                                                 RegisterProducerTable,
+                                                 AddressProducerTable>;
+
+        const uint64_t max_distance_ = 0;
+        ProducerTable producers_;
+
         template<typename U = DependencyT>
         static inline typename std::enable_if<!std::is_same<U, stf::Registers::STF_REG>::value, bool>::type
         ignoreValue_(const U dep_value) {
@@ -83,46 +261,44 @@ class DependencyTracker {
             return dep_value == stf::Registers::STF_REG::STF_REG_X0;
         }
 
-        inline void addConsumer_(const DependencyT dep_value, const stf::STFInst& inst) {
+        inline void addProducer_(const DependencyT dep_value, const stf::STFInst& inst) {
             if(STF_EXPECT_FALSE(ignoreValue_(dep_value))) {
                 return;
             }
-            const auto consumer_it = consumers_.emplace(dep_value, inst.index());
-            const auto producer_it = producers_.find(dep_value);
-            //stf_assert(producer_it != producers_.end(), "Couldn't find producer for new consumer");
-            if(producer_it != producers_.end() &&
-               ((consumer_it->second.getIndex() - producer_it->second.getIndex()) <= max_distance_)) {
-                producer_it->second.addConsumer(consumer_it);
-            }
+            producers_.insert(dep_value, inst.index());
         }
 
-        inline void addProducer_(const DependencyT dep_value, const stf::STFInst& inst) {
+        template<typename U = DependencyT>
+        inline typename std::enable_if<std::is_same<U, stf::Registers::STF_REG>::value>::type
+        removeProducer_(const U dep_value) {
             if(STF_EXPECT_FALSE(ignoreValue_(dep_value))) {
                 return;
             }
-            auto result = producers_.try_emplace(dep_value, inst.index());
-            if(!result.second) {
-                const auto next_it = removeProducer_(result.first);
-                const auto new_it = producers_.try_emplace(next_it, dep_value, inst.index());
-                stf_assert(new_it != next_it, "Failed to insert producer");
-            }
+            producers_.erase(dep_value);
         }
 
-        inline void removeProducer_(const DependencyT dep_value) {
-            if(STF_EXPECT_FALSE(ignoreValue_(dep_value))) {
-                return;
-            }
-            const auto it = producers_.find(dep_value);
-            if(it != producers_.end()) {
-                removeProducer_(it);
+        /**
+         * Looks up the producer of dep_value
+         * \param dep_value Value to look up
+         * \param idx Index of the consuming instruction
+         * \param distance Set to the distance from the producer to the consumer
+         * \returns true if a producer was found within max_distance_ instructions
+         */
+        inline bool getProducerDistance_(const DependencyT dep_value, const uint64_t idx, uint64_t& distance) const {
+            const uint64_t producer_idx = producers_.find(dep_value);
+            if(producer_idx == ProducerTable::NO_PRODUCER) {
+                return false;
             }
+            distance = idx - producer_idx;
+            return distance <= max_distance_;
         }
 
     public:
         using DistanceMap = std::map<uint64_t, DependencyT>;
 
         explicit DependencyTracker(const uint64_t max_distance) :
-            max_distance_(max_distance)
+            max_distance_(max_distance),
+            producers_(max_distance)
         {
         }
 
@@ -147,9 +323,6 @@ class RegisterDependencyTracker : public DependencyTracker<RegisterDependencyTra
         }
 
         inline void track_impl(const stf::STFInst& inst) {
-            for(const auto& op: inst.getSourceOperands()) {
-                addConsumer_(op.getReg(), inst);
-            }
             for(const auto& op: inst.getDestOperands()) {
                 addProducer_(op.getReg(), inst);
             }
@@ -159,14 +332,10 @@ class RegisterDependencyTracker : public DependencyTracker<RegisterDependencyTra
             DistanceMap distances;
             const uint64_t idx = inst.index();
             for(const auto& op: inst.getSourceOperands()) {
-                try {
-                    const auto reg = op.getReg();
-                    const auto distance = idx - producers_.at(reg).getIndex();
-                    if(distance <= max_distance_) {
-                        distances.emplace(distance, reg);
-                    }
-                }
-                catch(const std::out_of_range&) {
+                const auto reg = op.getReg();
+                uint64_t distance;
+                if(getProducerDistance_(reg, idx, distance)) {
+                    distances.emplace(distance, reg);
                 }
             }
             return distances;
@@ -175,13 +344,9 @@ class RegisterDependencyTracker : public DependencyTracker<RegisterDependencyTra
         inline bool hasProducer_impl(const stf::STFInst& inst) const {
             const uint64_t idx = inst.index();
             for(const auto& op: inst.getSourceOperands()) {
-                try {
-                    const auto distance = idx - producers_.at(op.getReg()).getIndex();
-                    if(distance <= max_distance_) {
-                        return true;
-                    }
-                }
-                catch(const std::out_of_range&) {
+                uint64_t distance;
+                if(getProducerDistance_(op.getReg(), idx, distance)) {
+                    return true;
                 }
             }
             return false;
@@ -198,10 +363,6 @@ class StLdDependencyTracker : public DependencyTracker<StLdDependencyTracker, ui
 
     public:
         inline void track_impl(const stf::STFInst& inst) {
-            for(const auto& m: inst.getMemoryReads()) {
-                addConsumer_(maskedAddress_(m.getAddress()), inst);
-            }
-
             for(const auto& m: inst.getMemoryWrites()) {
                 addProducer_(maskedAddress_(m.getAddress()), inst);
             }
@@ -211,14 +372,10 @@ class StLdDependencyTracker : public DependencyTracker<StLdDependencyTracker, ui
             DistanceMap distances;
             const uint64_t idx = inst.index();
             for(const auto& m: inst.getMemoryReads()) {
-                try {
-                    const auto masked_address = maskedAddress_(m.getAddress());
-                    const auto distance = idx - producers_.at(masked_address).getIndex();
-                    if(distance <= max_distance_) {
-                        distances.emplace(distance, masked_address);
-                    }
-                }
-                catch(const std::out_of_range&) {
+                const auto masked_address = maskedAddress_(m.getAddress());
+                uint64_t distance;
+                if(getProducerDistance_(masked_address, idx, distance)) {
+                    distances.emplace(distance, masked_address);
                 }
             }
 
@@ -228,14 +385,9 @@ class StLdDependencyTracker : public DependencyTracker<StLdDependencyTracker, ui
         inline bool hasProducer_impl(const stf::STFInst& inst) const {
             const uint64_t idx = inst.index();
             for(const auto& m: inst.getMemoryReads()) {
-                try {
-                    const auto masked_address = maskedAddress_(m.getAddress());
-                    const auto distance = idx - producers_.at(masked_address).getIndex();
-                    if(distance <= max_distance_) {
-                        return true;
-                    }
-                }
-                catch(const std::out_of_range&) {
+                uint64_t distance;
+                if(getProducerDistance_(maskedAddress_(m.getAddress()), idx, distance)) {
+                    return true;
                 }
             }
             return false;
@@ -258,12 +410,6 @@ class LdLdDependencyTracker : public DependencyTracker<LdLdDependencyTracker, st
 
         inline void track_impl(const stf::STFInst& inst) {
             if(STF_EXPECT_FALSE(inst.isLoad())) {
-                boost::container::small_vector<stf::Registers::STF_REG, 1> producers;
-
-                for(const auto& op: inst.getSourceOperands()) {
-                    addConsumer_(op.getReg(), inst);
-                }
-
                 for(const auto& op: inst.getDestOperands()) {
                     addProducer_(op.getReg(), inst);
                 }
@@ -280,17 +426,10 @@ class LdLdDependencyTracker : public DependencyTracker<LdLdDependencyTracker, st
             if(inst.isLoad()) {
                 const uint64_t idx = inst.index();
                 for(const auto& op: inst.getSourceOperands()) {
-                    try {
-                        const auto reg = op.getReg();
-                        if(STF_EXPECT_FALSE(ignoreValue_(reg))) {
-                            continue;
-                        }
-                        const auto distance = idx - producers_.at(reg).getIndex();
-                        if(distance <= max_distance_) {
-                            distances.emplace(distance, reg);
-                        }
-                    }
-                    catch(const std::out_of_range&) {
+                    const auto reg = op.getReg();
+                    uint64_t distance;
+                    if(STF_EXPECT_TRUE(!ignoreValue_(reg)) && getProducerDistance_(reg, idx, distance)) {
+                        distances.emplace(distance, reg);
                     }
                 }
             }
@@ -301,17 +440,10 @@ class LdLdDependencyTracker : public DependencyTracker<LdLdDependencyTracker, st
             if(inst.isLoad()) {
                 const uint64_t idx = inst.index();
                 for(const auto& op: inst.getSourceOperands()) {
-                    try {
-                        const auto reg = op.getReg();
-                        if(STF_EXPECT_FALSE(ignoreValue_(reg))) {
-                            continue;
-                        }
-                        const auto distance = idx - producers_.at(reg).getIndex();
-                        if(distance <= max_distance_) {
-                            return true;
-                        }
-                    }
-                    catch(const std::out_of_range&) {
+                    const auto reg = op.getReg();
+                    uint64_t distance;
+                    if(STF_EXPECT_TRUE(!ignoreValue_(reg)) && getProducerDistance_(reg, idx, distance)) {
+                        return true;
                     }
                 }
             }
@@ -50,6 +50,13 @@ namespace stf {
                 dis_->printDisassembly(os, pc, opcode);
             }
 
+            /**
+             * \brief Returns true if the selected backend carries state from one instruction to the next
+             */
+            bool isStateful_() const final {
+                return dis_->isStateful();
+            }
+
         public:
             /**
              * Constructs a Disassembler
@@ -1,17 +1,102 @@
 #pragma once
 
 #include <cstdint>
+#include <exception>
+#include <functional>
 #include <ostream>
+#include <sstream>
+#include <string>
+#include <unordered_map>
 
 #include "format_utils.hpp"
 #include "stf_enums.hpp"
+#include "stf_env_var.hpp"
+#include "stf_exception.hpp"
 
 #include "file_utils.hpp"
 
 namespace stf {
     namespace disassemblers {
+        /**
+         * \class BaseDisassembler
+         * \brief Base class for disassembler backends
+         *
+         * Backends can opt in to caching their output by overriding getCacheKeyType_. Cached strings are
+         * keyed on the opcode, and also on the PC for instructions whose disassembly depends on it. The
+         * maximum number of cached strings defaults to DEFAULT_CACHE_SIZE and can be changed with the
+         * STF_DISASM_CACHE_SIZE environment variable or setCacheSize(). A size of 0 disables the cache.
+         */
         class BaseDisassembler {
+            public:
+                static constexpr size_t DEFAULT_CACHE_SIZE = 65536; /**< Default maximum number of cached disassembly strings */
+
+            private:
+                /**
+                 * \struct CacheKey_
+                 * Key for the disassembly cache. The PC is 0 for instructions that are only keyed on the opcode.
+                 */
+                struct CacheKey_ {
+                    uint64_t pc;
+                    uint32_t opcode;
+
+                    inline bool operator==(const CacheKey_& rhs) const {
+                        return pc == rhs.pc && opcode == rhs.opcode;
+                    }
+                };
+
+                /**
+                 * \struct CacheKeyHash_
+                 * Hashes a CacheKey_
+                 */
+                struct CacheKeyHash_ {
+                    inline size_t operator()(const CacheKey_& key) const {
+                        return std::hash<uint64_t>()((key.pc * 0x9E3779B97F4A7C15ULL) ^ key.opcode);
+                    }
+                };
+
+                size_t max_cache_size_;
+                mutable std::unordered_map<CacheKey_, std::string, CacheKeyHash_> cache_;
+                mutable std::ostringstream cache_miss_stream_;
+
+                static inline size_t getDefaultCacheSize_() {
+                    const std::string cache_size_str = STFEnvVar("STF_DISASM_CACHE_SIZE", std::to_string(DEFAULT_CACHE_SIZE)).get();
+                    try {
+                        return std::stoull(cache_size_str);
+                    }
+                    catch(const std::exception&) {
+                        stf_throw("Invalid STF_DISASM_CACHE_SIZE value: " << cache_size_str);
+                    }
+                }
+
             protected:
+                /**
+                 * \enum CacheKeyType
+                 * Describes how the disassembly of an instruction can be cached
+                 */
+                enum class CacheKeyType {
+                    NONE, /**< Disassembly must not be cached */
+                    OPCODE, /**< Disassembly only depends on the opcode */
+                    PC_AND_OPCODE /**< Disassembly depends on the opcode and the PC */
+                };
+
+                /**
+                 * \brief Gets how the disassembly of an instruction can be cached. Called before every
+                 * cached lookup, so backends that track state across instructions can check it here.
+                 * \param pc PC address of the instruction
+                 * \param opcode Opcode of the instruction
+                 */
+                virtual CacheKeyType getCacheKeyType_(const uint64_t pc, const uint32_t opcode) const {
+                    return CacheKeyType::NONE;
+                }
+
+                /**
+                 * \brief Returns whether the output of the most recent printDisassembly_ call can be stored
+                 * in the cache
+                 */
+                virtual bool lastDisassemblyCacheable_() const {
+                    return true;
+                }
+
                 /**
                  * \brief Print the disassembly code of an opcode
                  * \param pc PC address of the instruction
@@ -21,8 +106,19 @@ namespace stf {
                 virtual void printDisassembly_(std::ostream& os,
                                                const uint64_t pc,
                                                const uint32_t opcode) const = 0;
+
+                /**
+                 * \brief Returns true if the disassembly of an instruction can depend on the instructions
+                 * disassembled before it
+                 */
+                virtual bool isStateful_() const {
+                    return false;
+                }
+
             public:
-                BaseDisassembler(const ISA inst_set, const INST_IEM iem, const bool use_aliases) {
+                BaseDisassembler(const ISA inst_set, const INST_IEM iem, const bool use_aliases) :
+                    max_cache_size_(getDefaultCacheSize_())
+                {
                     stf_assert(inst_set == ISA::RISCV, "Invalid instruction set: " << inst_set);
                 }
 
@@ -37,7 +133,29 @@ namespace stf {
                 inline void printDisassembly(std::ostream& os,
                                              const uint64_t pc,
                                              const uint32_t opcode) const {
-                    printDisassembly_(os, pc, opcode);
+                    const auto key_type = max_cache_size_ ? getCacheKeyType_(pc, opcode) : CacheKeyType::NONE;
+                    if(key_type == CacheKeyType::NONE) {
+                        printDisassembly_(os, pc, opcode);
+                        return;
+                    }
+
+                    const CacheKey_ key{key_type == CacheKeyType::PC_AND_OPCODE ? pc : 0, opcode};
+                    if(const auto it = cache_.find(key); STF_EXPECT_TRUE(it != cache_.end())) {
+                        os << it->second;
+                        return;
+                    }
+
+                    cache_miss_stream_.str("");
+                    printDisassembly_(cache_miss_stream_, pc, opcode);
+                    std::string disasm = cache_miss_stream_.str();
+                    os << disasm;
+
+                    if(lastDisassemblyCacheable_()) {
+                        if(STF_EXPECT_FALSE(cache_.size() >= max_cache_size_)) {
+                            cache_.clear();
+                        }
+                        cache_.emplace(key, std::move(disasm));
+                    }
                 }
 
                 /**
@@ -52,6 +170,26 @@ namespace stf {
                     printDisassembly(os.getStream(), pc, opcode);
                 }
 
+                /**
+                 * \brief Returns true if the disassembly of an instruction can depend on the instructions
+                 * disassembled before it. A stateless disassembler produces the same output no matter where in
+                 * the trace it starts.
+                 */
+                inline bool isStateful() const {
+                    return isStateful_();
+                }
+
+                /**
+                 * \brief Sets the maximum number of cached disassembly strings
+                 * \param max_cache_size Maximum number of cached strings. 0 disables the cache.
+                 */
+                inline void setCacheSize(const size_t max_cache_size) {
+                    max_cache_size_ = max_cache_size;
+                    if(cache_.size() > max_cache_size_) {
+                        cache_.clear();
+                    }
+                }
+
                 /**
                  * \brief Print the opcode
                  * \param opcode Opcode of the instruction
@@ -33,6 +33,24 @@ namespace stf {
                                        const uint64_t pc,
                                        const uint32_t opcode) const final;
 
+                /**
+                 * \brief Gets how the disassembly of an instruction can be cached
+                 * \param pc PC address of the instruction
+                 * \param opcode Opcode of the instruction
+                 */
+                CacheKeyType getCacheKeyType_(const uint64_t pc, const uint32_t opcode) const final;
+
+                /**
+                 * \brief Returns whether the output of the most recent printDisassembly_ call can be cached
+                 */
+                bool lastDisassemblyCacheable_() const final;
+
+                /**
+                 * \brief Always returns true, since binutils remembers lui/auipc immediates to annotate the
+                 * instructions that use them
+                 */
+                bool isStateful_() const final;
+
                 static unsigned long getBfdMach_(const INST_IEM iem);
 
             public:
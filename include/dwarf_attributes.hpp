@@ -139,16 +139,17 @@ namespace dwarf_wrapper {
             const Dwarf_Unsigned offset_;
 
             template<typename RangeList, typename ... Args>
-            static inline std::vector<STFAddressRange> populateRanges_(Args&&... range_list_args) {
+            static inline void populateRanges_(std::vector<STFAddressRange>& ranges, Args&&... range_list_args) {
                 try {
                     if(const auto range_list = RangeList(std::forward<Args>(range_list_args)...);
                        STF_EXPECT_TRUE(range_list.valid())) {
-                        return std::vector<STFAddressRange>(range_list.begin(), range_list.end());
+                        ranges.assign(range_list.begin(), range_list.end());
+                        return;
                     }
                 }
                 catch(const typename RangeList::InvalidRangeList&) {
                 }
-                return std::vector<STFAddressRange>();
+                ranges.clear();
             }
 
             struct RangeEntry {
@@ -573,17 +574,24 @@ namespace dwarf_wrapper {
             {
             }
 
-            inline std::vector<STFAddressRange> getRanges(const Dwarf_Die die) const {
+            inline void getRanges(const Dwarf_Die die, std::vector<STFAddressRange>& ranges) const {
                 static constexpr Dwarf_Half DWVERSION5 = 5;
 
                 if(const auto cu_version = dwarf_->getDieVersion(die); STF_EXPECT_FALSE(!cu_version)) {
-                    return std::vector<STFAddressRange>();
+                    ranges.clear();
                 }
                 else if(cu_version < DWVERSION5) {
-                    return populateRanges_<RangeListDW4>(dwarf_, die, offset_);
+                    populateRanges_<RangeListDW4>(ranges, dwarf_, die, offset_);
+                }
+                else {
+                    populateRanges_<RangeListDW5>(ranges, dwarf_, attr_, form_, offset_);
                 }
+            }
 
-                return populateRanges_<RangeListDW5>(dwarf_, attr_, form_, offset_);
+            inline std::vector<STFAddressRange> getRanges(const Dwarf_Die die) const {
+                std::vector<STFAddressRange> ranges;
+                getRanges(die, ranges);
+                return ranges;
             }
 
             inline operator bool() const {
@@ -1,22 +1,38 @@
 #pragma once
 
 #include <memory>
+#include <optional>
+#include <utility>
+#include <vector>
+
 #include "dwarf_attributes.hpp"
 
 namespace dwarf_wrapper {
+    /**
+     * \class Die
+     *
+     * Owning handle for a libdwarf DIE. A Die can either be held by a shared_ptr (see construct() and
+     * iterateSiblings()) or live on the stack (see visitSiblings()).
+     */
     class Die : public std::enable_shared_from_this<Die> {
         private:
             struct enable_make_shared;
 
             const DwarfInterface* dwarf_ = nullptr;
-            const Dwarf_Die die_ = nullptr;
-            const Dwarf_Half tag_ = 0;
+            Dwarf_Die die_ = nullptr;
+            Dwarf_Half tag_ = 0;
 
             inline std::shared_ptr<Die> makeDie_(const Dwarf_Die die) const {
                 return construct(dwarf_, die);
             }
 
-        protected:
+            inline void dealloc_() {
+                if(STF_EXPECT_TRUE(dwarf_ && die_)) {
+                    dwarf_->deallocDie(die_);
+                }
+            }
+
+        public:
             Die(const DwarfInterface* dwarf, const Dwarf_Die die) :
                 dwarf_(dwarf),
                 die_(die),
@@ -29,14 +45,27 @@ namespace dwarf_wrapper {
             {
             }
 
-        public:
             Die(const Die&) = delete;
 
-            Die(Die&& rhs) = delete;
+            Die(Die&& rhs) noexcept :
+                std::enable_shared_from_this<Die>(),
+                dwarf_(rhs.dwarf_),
+                die_(std::exchange(rhs.die_, nullptr)),
+                tag_(rhs.tag_)
+            {
+            }
 
             Die& operator=(const Die&) = delete;
 
-            Die& operator=(Die&& rhs) = delete;
+            Die& operator=(Die&& rhs) noexcept {
+                if(this != &rhs) {
+                    dealloc_();
+                    dwarf_ = rhs.dwarf_;
+                    die_ = std::exchange(rhs.die_, nullptr);
+                    tag_ = rhs.tag_;
+                }
+                return *this;
+            }
 
             template<typename ... Args>
             static inline std::shared_ptr<Die> construct(Args&&... args) {
@@ -44,9 +73,7 @@ namespace dwarf_wrapper {
             }
 
             ~Die() {
-                if(STF_EXPECT_TRUE(dwarf_ && die_)) {
-                    dwarf_->deallocDie(die_);
-                }
+                dealloc_();
             }
 
             inline bool isInlinedSubroutine() const {
@@ -57,11 +84,11 @@ namespace dwarf_wrapper {
                 return tag_ == DW_TAG_subprogram;
             }
 
-            inline std::shared_ptr<Die> getSpecificationDie() const {
+            inline std::optional<Die> getSpecificationDie() const {
                 if(const SpecificationAttribute spec_attr(dwarf_, die_); spec_attr) {
-                    return makeDie_(spec_attr.getReference());
+                    return std::make_optional<Die>(dwarf_, spec_attr.getReference());
                 }
-                return nullptr;
+                return std::nullopt;
             }
 
             template<typename AttributeType>
@@ -134,7 +161,7 @@ namespace dwarf_wrapper {
                             name = spec_die->getName();
                         }
                         else if(const auto attr = getAttribute<AbstractOriginAttribute>()) {
-                            name = makeDie_(attr.getReference())->getName();
+                            name = Die(dwarf_, attr.getReference()).getName();
                         }
                     }
                 }
@@ -150,6 +177,19 @@ namespace dwarf_wrapper {
                 return std::vector<STFAddressRange>();
             }
 
+            /**
+             * Gets the address ranges of this DIE, reusing the storage in the given vector
+             * \param ranges Vector that will hold the ranges. Any previous contents are discarded.
+             */
+            inline void getRanges(std::vector<STFAddressRange>& ranges) const {
+                if(const auto range_attr = getAttribute<RangeAttribute>()) {
+                    range_attr.getRanges(die_, ranges);
+                }
+                else {
+                    ranges.clear();
+                }
+            }
+
             inline uint64_t getOffset() const {
                 return dwarf_->dieOffset(die_);
             }
@@ -175,6 +215,38 @@ namespace dwarf_wrapper {
                 }
                 while(cur_die);
             }
+
+            /**
+             * Calls callback(const Die&) on the given DIE, its siblings and all of their descendants in
+             * the same order as iterateSiblings(). Each DIE only lives on the stack for the duration of
+             * its callback and the traversal of its children, so no heap allocations are made.
+             * \param dwarf DWARF interface that owns the DIEs
+             * \param first_die First DIE to visit
+             * \param callback Callback to invoke on each DIE
+             * \param is_info Whether the DIEs come from .debug_info
+             */
+            template<typename Callback>
+            static inline void visitSiblings(const DwarfInterface* dwarf,
+                                             const Dwarf_Die first_die,
+                                             Callback&& callback,
+                                             const Dwarf_Bool is_info) {
+                Die cur_die(dwarf, first_die);
+
+                while(true) {
+                    callback(static_cast<const Die&>(cur_die));
+
+                    if(const auto child = dwarf->child(cur_die.die_)) {
+                        visitSiblings(dwarf, child, callback, is_info);
+                    }
+
+                    const auto sib_die = dwarf->siblingOf(cur_die.die_, is_info);
+                    if(!sib_die) {
+                        break;
+                    }
+
+                    cur_die = Die(dwarf, sib_die);
+                }
+            }
     };
 
     struct Die::enable_make_shared : public Die {
@@ -0,0 +1,316 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <queue>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <unistd.h>
+
+#include "filesystem.hpp"
+#include "stf_exception.hpp"
+
+namespace trace_tools {
+    /**
+     * \class ExternalSorter
+     *
+     * Sorts an arbitrarily long sequence of fixed-size binary records while keeping memory usage
+     * bounded.
+     *
+     * Records are buffered in memory until the memory limit is reached. The buffer is then sorted and
+     * spilled to an anonymous temporary file as a sorted run. Once every record has been added, the runs
+     * are combined with a k-way merge. If all of the records fit within the limit, they are sorted in
+     * memory and no temporary files are created.
+     *
+     * To keep the number of open files bounded, every MERGE_FAN_IN runs of the same size are merged into
+     * a single larger run as soon as they have been written.
+     *
+     * Records with equal keys are returned in the order they were added.
+     */
+    template<typename RecordType, typename Compare = std::less<RecordType>>
+    class ExternalSorter {
+        static_assert(std::is_trivially_copyable_v<RecordType>, "ExternalSorter records must be trivially copyable");
+
+        public:
+            static constexpr size_t DEFAULT_MAX_MEMORY = 1024ULL * 1024ULL * 1024ULL; /**< Default memory limit in bytes */
+            static constexpr size_t MERGE_FAN_IN = 64; /**< Number of runs combined by an intermediate merge */
+
+        private:
+            static constexpr size_t MIN_MERGE_BUFFER_BYTES_ = 64 * 1024; // Smallest buffer used for each run while merging
+
+            /**
+             * \class RunFile_
+             * Temporary file holding a single sorted run. The file is unlinked as soon as it is created, so it is
+             * cleaned up automatically when it is closed, even if the tool exits abnormally.
+             */
+            class RunFile_ {
+                private:
+                    std::FILE* file_ = nullptr;
+
+                public:
+                    explicit RunFile_(const fs::path& temp_dir) {
+                        std::string temp_filename = (temp_dir / "stf_sort_XXXXXX").string();
+                        const int fd = mkstemp(temp_filename.data());
+                        stf_assert(fd >= 0, "Failed to create temporary file: " << strerror(errno));
+                        unlink(temp_filename.c_str());
+                        file_ = fdopen(fd, "w+b");
+                        stf_assert(file_, "Failed to open temporary file: " << strerror(errno));
+                    }
+
+                    RunFile_(const RunFile_&) = delete;
+                    RunFile_& operator=(const RunFile_&) = delete;
+
+                    RunFile_(RunFile_&& rhs) noexcept :
+                        file_(std::exchange(rhs.file_, nullptr))
+                    {
+                    }
+
+                    RunFile_& operator=(RunFile_&& rhs) noexcept {
+                        std::swap(file_, rhs.file_);
+                        return *this;
+                    }
+
+                    ~RunFile_() {
+                        if(file_) {
+                            std::fclose(file_);
+                        }
+                    }
+
+                    void write(const RecordType* records, const size_t num_records) {
+                        stf_assert(std::fwrite(records, sizeof(RecordType), num_records, file_) == num_records,
+                                   "Failed to write sorted run: " << strerror(errno));
+                    }
+
+                    size_t read(RecordType* records, const size_t max_records) {
+                        const size_t num_read = std::fread(records, sizeof(RecordType), max_records, file_);
+                        stf_assert(num_read == max_records || !std::ferror(file_), "Failed to read sorted run: " << strerror(errno));
+                        return num_read;
+                    }
+
+                    void rewind() {
+                        stf_assert(std::fflush(file_) == 0, "Failed to flush sorted run: " << strerror(errno));
+                        std::rewind(file_);
+                    }
+            };
+
+            /**
+             * \class RunReader_
+             * Buffered reader for a single run during the merge
+             */
+            class RunReader_ {
+                private:
+                    RunFile_ file_;
+                    std::vector<RecordType> buffer_;
+                    size_t pos_ = 0;
+                    size_t size_ = 0;
+
+                public:
+                    RunReader_(RunFile_&& file, const size_t buffer_size) :
+                        file_(std::move(file)),
+                        buffer_(buffer_size)
+                    {
+                        file_.rewind();
+                        refill();
+                    }
+
+                    bool refill() {
+                        pos_ = 0;
+                        size_ = file_.read(buffer_.data(), buffer_.size());
+                        return size_ != 0;
+                    }
+
+                    const RecordType& current() const {
+                        return buffer_[pos_];
+                    }
+
+                    /**
+                     * Advances to the next record. Returns false if the run has been exhausted.
+                     */
+                    bool next() {
+                        return ++pos_ < size_ || refill();
+                    }
+
+                    bool empty() const {
+                        return pos_ >= size_;
+                    }
+            };
+
+            const size_t max_records_;
+            const fs::path temp_dir_;
+            Compare comp_;
+            std::vector<RecordType> buffer_;
+            std::vector<RunFile_> runs_;
+            std::vector<size_t> run_levels_; // Number of intermediate merges that produced each run
+
+            void sortBuffer_() {
+                std::stable_sort(buffer_.begin(), buffer_.end(), comp_);
+            }
+
+            /**
+             * Merges runs, calling func(rec) on every record in sorted order. merge_buffer_size records
+             * of memory are split between the runs.
+             */
+            template<typename FuncType>
+            void mergeRuns_(std::vector<RunFile_>&& runs, const size_t merge_buffer_size, FuncType&& func) const {
+                const size_t run_buffer_size = std::max(merge_buffer_size / runs.size(),
+                                                        std::max(MIN_MERGE_BUFFER_BYTES_ / sizeof(RecordType), static_cast<size_t>(1)));
+                std::vector<RunReader_> readers;
+                readers.reserve(runs.size());
+                for(auto& run: runs) {
+                    readers.emplace_back(std::move(run), run_buffer_size);
+                }
+                runs.clear();
+
+                // Min-heap of run indices ordered by each run's current record. Ties go to the earlier run
+                // so that records with equal keys stay in insertion order.
+                const auto heap_comp = [this, &readers](const size_t lhs, const size_t rhs) {
+                    const auto& lhs_rec = readers[lhs].current();
+                    const auto& rhs_rec = readers[rhs].current();
+                    if(comp_(rhs_rec, lhs_rec)) {
+                        return true;
+                    }
+                    if(comp_(lhs_rec, rhs_rec)) {
+                        return false;
+                    }
+                    return lhs > rhs;
+                };
+                std::priority_queue<size_t, std::vector<size_t>, decltype(heap_comp)> heap(heap_comp);
+
+                for(size_t i = 0; i < readers.size(); ++i) {
+                    if(!readers[i].empty()) {
+                        heap.push(i);
+                    }
+                }
+
+                while(!heap.empty()) {
+                    const size_t run_idx = heap.top();
+                    heap.pop();
+                    func(readers[run_idx].current());
+                    if(readers[run_idx].next()) {
+                        heap.push(run_idx);
+                    }
+                }
+            }
+
+            /**
+             * Merges the newest MERGE_FAN_IN runs into a single run
+             */
+            void mergeNewestRuns_() {
+                const size_t first_run = runs_.size() - MERGE_FAN_IN;
+                const size_t level = run_levels_.back() + 1;
+
+                const auto first_it = std::next(runs_.begin(), static_cast<ssize_t>(first_run));
+                std::vector<RunFile_> runs(std::make_move_iterator(first_it), std::make_move_iterator(runs_.end()));
+                runs_.erase(first_it, runs_.end());
+                run_levels_.erase(std::next(run_levels_.begin(), static_cast<ssize_t>(first_run)), run_levels_.end());
+
+                // Half of the memory limit buffers the inputs, the other half buffers the output
+                RunFile_ merged(temp_dir_);
+                std::vector<RecordType> out_buffer;
+                out_buffer.reserve(std::max(max_records_ / 2, static_cast<size_t>(1)));
+                mergeRuns_(std::move(runs), max_records_ / 2, [&merged, &out_buffer](const RecordType& rec) {
+                    out_buffer.emplace_back(rec);
+                    if(STF_EXPECT_FALSE(out_buffer.size() == out_buffer.capacity())) {
+                        merged.write(out_buffer.data(), out_buffer.size());
+                        out_buffer.clear();
+                    }
+                });
+                merged.write(out_buffer.data(), out_buffer.size());
+
+                runs_.emplace_back(std::move(merged));
+                run_levels_.emplace_back(level);
+            }
+
+            void spill_() {
+                if(buffer_.empty()) {
+                    return;
+                }
+
+                sortBuffer_();
+                runs_.emplace_back(temp_dir_);
+                runs_.back().write(buffer_.data(), buffer_.size());
+                run_levels_.emplace_back(0);
+
+                // Levels never increase toward the back of runs_, so the newest MERGE_FAN_IN runs are all
+                // the same size whenever the first and last of them share a level
+                if(runs_.size() >= MERGE_FAN_IN && run_levels_[runs_.size() - MERGE_FAN_IN] == run_levels_.back()) {
+                    std::vector<RecordType>().swap(buffer_); // Give the buffer memory back to the merge
+                    do {
+                        mergeNewestRuns_();
+                    }
+                    while(runs_.size() >= MERGE_FAN_IN && run_levels_[runs_.size() - MERGE_FAN_IN] == run_levels_.back());
+                }
+                else {
+                    buffer_.clear();
+                }
+            }
+
+        public:
+            /**
+             * Constructs an ExternalSorter
+             * \param max_memory Maximum number of bytes used to buffer records
+             * \param temp_dir Directory used to hold sorted runs
+             * \param comp Comparison function used to order records
+             */
+            explicit ExternalSorter(const size_t max_memory = DEFAULT_MAX_MEMORY,
+                                    fs::path temp_dir = fs::temp_directory_path(),
+                                    Compare comp = Compare()) :
+                max_records_(std::max(max_memory / sizeof(RecordType), static_cast<size_t>(1))),
+                temp_dir_(std::move(temp_dir)),
+                comp_(std::move(comp))
+            {
+            }
+
+            /**
+             * Adds a record. If the memory limit has been reached, the buffered records are spilled to disk first.
+             * \param rec Record to add
+             */
+            void push(const RecordType& rec) {
+                if(STF_EXPECT_FALSE(buffer_.size() >= max_records_)) {
+                    spill_();
+                }
+                else if(STF_EXPECT_FALSE(buffer_.capacity() == buffer_.size())) {
+                    // Grow geometrically, but never past the memory limit
+                    buffer_.reserve(std::min(std::max(buffer_.capacity() * 2, static_cast<size_t>(1024)), max_records_));
+                }
+
+                buffer_.emplace_back(rec);
+            }
+
+            /**
+             * Calls func(rec) for every record that has been added, in sorted order. The sorter is empty afterward.
+             * \param func Callable invoked as func(const RecordType& rec)
+             */
+            template<typename FuncType>
+            void consume(FuncType&& func) {
+                if(runs_.empty()) {
+                    sortBuffer_();
+                    for(const auto& rec: buffer_) {
+                        func(rec);
+                    }
+                    buffer_.clear();
+                    return;
+                }
+
+                spill_();
+                std::vector<RecordType>().swap(buffer_); // Give the buffer memory back to the merge
+                run_levels_.clear();
+                mergeRuns_(std::move(runs_), max_records_, func);
+                runs_.clear();
+            }
+
+            /**
+             * Gets the number of runs that have been spilled to disk so far
+             */
+            size_t getNumRuns() const {
+                return runs_.size();
+            }
+    };
+} // end namespace trace_tools
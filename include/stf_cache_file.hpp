@@ -0,0 +1,259 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <system_error>
+#include <type_traits>
+#include <vector>
+
+#include <unistd.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#include "filesystem.hpp"
+
+/**
+ * \class STFCacheFile
+ *
+ * Reads and writes the on-disk cache files used by stf_tools.
+ *
+ * Cache files are a fixed header followed by a sequence of arrays, each padded to 8 bytes, so that
+ * they can be mmapped and copied out in bulk. The header and the layout of the arrays are defined by the user of the cache.
+ * Caching is best effort: any failure to read or write a cache file is ignored.
+ */
+class STFCacheFile {
+    public:
+        static constexpr size_t ALIGNMENT = 8; /**< Alignment of every array in a cache file */
+
+        /**
+         * Pads a size up to the cache alignment
+         */
+        static inline size_t padSize(const size_t size) {
+            return (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+        }
+
+        /**
+         * Gets the default directory for a cache. The directory is taken from the specified environment
+         * variable if it is set, otherwise it is $XDG_CACHE_HOME/stf_tools/<subdir> or ~/.cache/stf_tools/<subdir>.
+         * Setting the environment variable to an empty string disables the cache.
+         * \param env_var Environment variable that overrides the cache directory
+         * \param subdir Name of the cache directory under stf_tools
+         * \returns Cache directory, or an empty path if the cache is disabled
+         */
+        static inline fs::path getDefaultCacheDir(const char* env_var, const char* subdir) {
+            if(const char* cache_dir = getenv(env_var)) {
+                return cache_dir;
+            }
+
+            if(const char* xdg_cache_dir = getenv("XDG_CACHE_HOME"); xdg_cache_dir && *xdg_cache_dir) {
+                return fs::path(xdg_cache_dir) / "stf_tools" / subdir;
+            }
+
+            if(const char* home_dir = getenv("HOME"); home_dir && *home_dir) {
+                return fs::path(home_dir) / ".cache" / "stf_tools" / subdir;
+            }
+
+            return fs::path();
+        }
+
+        /**
+         * \class Reader
+         * Reads arrays from a memory-mapped cache file
+         */
+        class Reader {
+            private:
+                void* file_ptr_ = nullptr;
+                size_t file_size_ = 0;
+                size_t offset_ = 0;
+
+            public:
+                Reader() = default;
+
+                Reader(const Reader&) = delete;
+                Reader& operator=(const Reader&) = delete;
+
+                ~Reader() {
+                    if(file_ptr_) {
+                        munmap(file_ptr_, file_size_);
+                    }
+                }
+
+                /**
+                 * Maps the specified file. Returns false if the file could not be mapped.
+                 */
+                bool open(const fs::path& path) {
+                    const int fd = ::open(path.c_str(), O_RDONLY);
+                    if(fd < 0) {
+                        return false;
+                    }
+
+                    struct stat file_stat;
+                    if(fstat(fd, &file_stat) == 0 && file_stat.st_size > 0) {
+                        file_size_ = static_cast<size_t>(file_stat.st_size);
+                        file_ptr_ = mmap(nullptr, file_size_, PROT_READ, MAP_FILE | MAP_PRIVATE, fd, 0);
+                        if(file_ptr_ == MAP_FAILED) {
+                            file_ptr_ = nullptr;
+                        }
+                    }
+
+                    ::close(fd);
+                    return file_ptr_ != nullptr;
+                }
+
+                /**
+                 * Gets a pointer to the next array in the file
+                 * \param count Number of elements in the array
+                 * \returns Pointer to the array, or nullptr if the file is too short
+                 */
+                template<typename T>
+                const T* readArray(const size_t count) {
+                    static_assert(std::is_trivially_copyable_v<T> && alignof(T) <= ALIGNMENT,
+                                  "Cached types must be trivially copyable");
+
+                    if(count > (file_size_ - offset_) / sizeof(T)) {
+                        return nullptr;
+                    }
+
+                    const auto* ptr = reinterpret_cast<const T*>(static_cast<const char*>(file_ptr_) + offset_);
+                    offset_ = std::min(file_size_, offset_ + padSize(count * sizeof(T)));
+                    return ptr;
+                }
+
+                /**
+                 * Reads the next array in the file into a vector
+                 * \param vec Vector to fill
+                 * \param count Number of elements in the array
+                 * \returns false if the file is too short
+                 */
+                template<typename T>
+                bool readVector(std::vector<T>& vec, const size_t count) {
+                    const T* ptr = readArray<T>(count);
+                    if(!ptr) {
+                        return false;
+                    }
+
+                    vec.assign(ptr, ptr + count);
+                    return true;
+                }
+
+                /**
+                 * Reads a single value from the file
+                 * \param value Value to fill
+                 * \returns false if the file is too short
+                 */
+                template<typename T>
+                bool read(T& value) {
+                    const T* ptr = readArray<T>(1);
+                    if(!ptr) {
+                        return false;
+                    }
+
+                    memcpy(&value, ptr, sizeof(T));
+                    return true;
+                }
+
+                /**
+                 * Returns true if every byte of the file has been read
+                 */
+                bool atEnd() const {
+                    return offset_ == file_size_;
+                }
+        };
+
+        /**
+         * \class Writer
+         * Writes arrays to a temporary file that replaces the cache file once it is complete
+         */
+        class Writer {
+            private:
+                const fs::path cache_path_;
+                const fs::path temp_path_;
+                std::ofstream file_;
+
+            public:
+                /**
+                 * Creates a temporary file that will replace the specified cache file
+                 * \param cache_path Cache file to write
+                 */
+                explicit Writer(const fs::path& cache_path) :
+                    cache_path_(cache_path),
+                    temp_path_(cache_path.string() + ".tmp." + std::to_string(getpid()))
+                {
+                    std::error_code ec;
+                    fs::create_directories(cache_path_.parent_path(), ec);
+                    file_.open(temp_path_, std::ios::binary | std::ios::trunc);
+                }
+
+                Writer(const Writer&) = delete;
+                Writer& operator=(const Writer&) = delete;
+
+                ~Writer() {
+                    if(file_.is_open()) {
+                        file_.close();
+                        std::error_code ec;
+                        fs::remove(temp_path_, ec);
+                    }
+                }
+
+                /**
+                 * Writes an array to the file
+                 * \param ptr Array to write
+                 * \param count Number of elements in the array
+                 */
+                template<typename T>
+                void writeArray(const T* ptr, const size_t count) {
+                    static_assert(std::is_trivially_copyable_v<T> && alignof(T) <= ALIGNMENT,
+                                  "Cached types must be trivially copyable");
+                    static constexpr std::array<char, ALIGNMENT> PADDING{};
+
+                    const size_t num_bytes = count * sizeof(T);
+                    file_.write(reinterpret_cast<const char*>(ptr), static_cast<std::streamsize>(num_bytes));
+                    file_.write(PADDING.data(), static_cast<std::streamsize>(padSize(num_bytes) - num_bytes));
+                }
+
+                /**
+                 * Writes a vector to the file
+                 * \param vec Vector to write
+                 */
+                template<typename T>
+                void writeVector(const std::vector<T>& vec) {
+                    writeArray(vec.data(), vec.size());
+                }
+
+                /**
+                 * Writes a single value to the file
+                 * \param value Value to write
+                 */
+                template<typename T>
+                void write(const T& value) {
+                    writeArray(&value, 1);
+                }
+
+                /**
+                 * Atomically replaces the cache file with the temporary file.
+                 * Returns false if any part of the file could not be written.
+                 */
+                bool commit() {
+                    file_.close();
+                    std::error_code ec;
+                    if(file_.fail()) {
+                        fs::remove(temp_path_, ec);
+                        return false;
+                    }
+
+                    fs::rename(temp_path_, cache_path_, ec);
+                    if(ec) {
+                        fs::remove(temp_path_, ec);
+                        return false;
+                    }
+
+                    return true;
+                }
+        };
+};
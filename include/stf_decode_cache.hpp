@@ -0,0 +1,290 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <system_error>
+#include <type_traits>
+#include <vector>
+
+#include "filesystem.hpp"
+#include "stf_cache_file.hpp"
+
+/**
+ * \class STFDecodeCache
+ *
+ * On-disk table of decode results. It lets a decoder skip constructing Mavis, which parses every Mavis JSON file,
+ * when earlier runs have already decoded every opcode it sees.
+ *
+ * A table is keyed by the ISA string and a hash of the ISA spec and of every JSON file in the Mavis JSON directory,
+ * so editing the Mavis JSON invalidates it. Tables live in $STF_DECODE_CACHE_DIR if it is set, otherwise in
+ * $XDG_CACHE_HOME/stf_tools/decode or ~/.cache/stf_tools/decode. Setting STF_DECODE_CACHE_DIR to an empty string
+ * disables the cache.
+ *
+ * A table file is a header, a HeaderDataType and an array of EntryType sorted by opcode (see STFCacheFile). The
+ * entries are searched in place in the mmapped file, so loading a table does not copy it.
+ *
+ * \tparam HeaderDataType Trivially copyable per-table data stored in the header
+ * \tparam EntryType Trivially copyable per-opcode entry with a uint32_t opcode member
+ */
+template<typename HeaderDataType, typename EntryType>
+class STFDecodeCache {
+    private:
+        static constexpr std::array<char, 8> MAGIC_ = {'S', 'T', 'F', 'D', 'E', 'C', 'C', '\0'};
+
+        /**
+         * \struct Header_
+         * Identifies the decoder configuration a table was generated from
+         */
+        struct Header_ {
+            std::array<char, 8> magic;
+            uint32_t version;
+            uint32_t entry_size;
+            uint64_t key;
+            uint64_t num_entries;
+        };
+
+        static_assert(sizeof(Header_) % STFCacheFile::ALIGNMENT == 0, "Cache header must be padded to the cache alignment");
+
+        const uint32_t version_;
+        uint64_t key_ = 0;
+        fs::path cache_path_;
+        STFCacheFile::Reader reader_;
+        HeaderDataType data_{};
+        const EntryType* entries_ = nullptr;
+        size_t num_entries_ = 0;
+        bool loaded_ = false;
+
+        /**
+         * FNV-1a hash
+         */
+        static inline uint64_t hash_(const char* data, const size_t size, uint64_t hash) {
+            static constexpr uint64_t FNV_PRIME = 0x100000001b3ULL;
+
+            for(size_t i = 0; i < size; ++i) {
+                hash ^= static_cast<uint8_t>(data[i]);
+                hash *= FNV_PRIME;
+            }
+
+            return hash;
+        }
+
+        static inline uint64_t hashString_(const std::string& str, const uint64_t hash) {
+            // Hash the terminator too so that adjacent strings can't run together
+            return hash_(str.c_str(), str.size() + 1, hash);
+        }
+
+        /**
+         * Hashes the name and contents of a file
+         * \returns false if the file could not be read
+         */
+        static inline bool hashFile_(const fs::path& path, const std::string& name, uint64_t& hash) {
+            std::ifstream file(path, std::ios::binary);
+            if(!file) {
+                return false;
+            }
+
+            hash = hashString_(name, hash);
+
+            std::array<char, 65536> buf;
+            while(file) {
+                file.read(buf.data(), static_cast<std::streamsize>(buf.size()));
+                hash = hash_(buf.data(), static_cast<size_t>(file.gcount()), hash);
+            }
+
+            return !file.bad();
+        }
+
+        /**
+         * Computes the table key. Returns false if the Mavis JSON files could not be read.
+         */
+        static inline bool computeKey_(const std::string& isa_string,
+                                       const fs::path& isa_spec,
+                                       const fs::path& json_dir,
+                                       uint64_t& key) {
+            static constexpr uint64_t FNV_OFFSET_BASIS = 0xcbf29ce484222325ULL;
+
+            key = hashString_(isa_string, FNV_OFFSET_BASIS);
+
+            if(!hashFile_(isa_spec, isa_spec.filename().string(), key)) {
+                return false;
+            }
+
+            std::vector<fs::path> json_files;
+            std::error_code ec;
+            for(auto it = fs::recursive_directory_iterator(json_dir, ec);
+                !ec && it != fs::recursive_directory_iterator();
+                it.increment(ec)) {
+                if(it->is_regular_file(ec) && it->path().extension() == ".json") {
+                    json_files.emplace_back(it->path());
+                }
+            }
+
+            if(ec || json_files.empty()) {
+                return false;
+            }
+
+            std::sort(json_files.begin(), json_files.end());
+
+            for(const auto& json_file: json_files) {
+                if(!hashFile_(json_file, json_file.lexically_relative(json_dir).string(), key)) {
+                    return false;
+                }
+            }
+
+            return true;
+        }
+
+        Header_ makeHeader_(const size_t num_entries) const {
+            Header_ header{};
+            header.magic = MAGIC_;
+            header.version = version_;
+            header.entry_size = static_cast<uint32_t>(sizeof(EntryType));
+            header.key = key_;
+            header.num_entries = num_entries;
+            return header;
+        }
+
+        /**
+         * Maps the table file and validates its header
+         */
+        void load_() {
+            if(!reader_.open(cache_path_)) {
+                return;
+            }
+
+            const Header_* header = reader_.readArray<Header_>(1);
+            if(!header) {
+                return;
+            }
+
+            const Header_ expected_header = makeHeader_(header->num_entries);
+            if(memcmp(header, &expected_header, sizeof(Header_)) != 0) {
+                return;
+            }
+
+            const EntryType* entries = nullptr;
+            if(!reader_.read(data_) ||
+               !(entries = reader_.template readArray<EntryType>(header->num_entries)) ||
+               !reader_.atEnd()) {
+                return;
+            }
+
+            // Entries are searched with a binary search, so make sure the file really is sorted
+            const auto num_entries = static_cast<size_t>(header->num_entries);
+            for(size_t i = 1; i < num_entries; ++i) {
+                if(entries[i - 1].opcode >= entries[i].opcode) {
+                    return;
+                }
+            }
+
+            entries_ = entries;
+            num_entries_ = num_entries;
+            loaded_ = true;
+        }
+
+    public:
+        /**
+         * Constructs an STFDecodeCache and loads the matching table if there is one
+         * \param isa_string ISA string the decoder was configured with
+         * \param isa_spec Path to the Mavis ISA spec JSON
+         * \param json_dir Path to the Mavis JSON directory
+         * \param version Layout version of HeaderDataType and EntryType. Must be bumped whenever either changes.
+         * \param cache_dir Directory that holds cache files. An empty path disables the cache.
+         */
+        STFDecodeCache(const std::string& isa_string,
+                       const fs::path& isa_spec,
+                       const fs::path& json_dir,
+                       const uint32_t version,
+                       const fs::path& cache_dir = STFCacheFile::getDefaultCacheDir("STF_DECODE_CACHE_DIR", "decode")) :
+            version_(version)
+        {
+            static_assert(std::is_trivially_copyable_v<HeaderDataType> && std::is_trivially_copyable_v<EntryType>,
+                          "Cached types must be trivially copyable");
+
+            if(cache_dir.empty() || !computeKey_(isa_string, isa_spec, json_dir, key_)) {
+                return;
+            }
+
+            std::ostringstream cache_name;
+            cache_name << std::hex << std::setfill('0') << std::setw(16) << key_ << ".dec";
+            cache_path_ = cache_dir / cache_name.str();
+
+            load_();
+        }
+
+        STFDecodeCache(const STFDecodeCache&) = delete;
+        STFDecodeCache& operator=(const STFDecodeCache&) = delete;
+
+        /**
+         * Returns true if the cache can be used for this configuration
+         */
+        inline bool enabled() const {
+            return !cache_path_.empty();
+        }
+
+        /**
+         * Returns true if a table for this configuration was loaded
+         */
+        inline bool loaded() const {
+            return loaded_;
+        }
+
+        /**
+         * Gets the number of entries in the loaded table
+         */
+        inline size_t size() const {
+            return num_entries_;
+        }
+
+        /**
+         * Gets the per-table data. Only meaningful if loaded() returns true.
+         */
+        inline const HeaderDataType& getData() const {
+            return data_;
+        }
+
+        /**
+         * Looks up an opcode in the loaded table
+         * \returns Pointer to the entry, or nullptr if the opcode is not in the table
+         */
+        inline const EntryType* find(const uint32_t opcode) const {
+            const auto end = entries_ + num_entries_;
+            const auto it = std::lower_bound(entries_,
+                                             end,
+                                             opcode,
+                                             [](const EntryType& entry, const uint32_t op) { return entry.opcode < op; });
+            return (it != end && it->opcode == opcode) ? it : nullptr;
+        }
+
+        /**
+         * Writes the loaded table merged with new entries back to disk
+         * \param data Per-table data to write
+         * \param new_entries Entries that are not in the loaded table. Entries with duplicate opcodes are dropped.
+         */
+        void save(const HeaderDataType& data, std::vector<EntryType> new_entries) const {
+            if(!enabled()) {
+                return;
+            }
+
+            new_entries.insert(new_entries.end(), entries_, entries_ + num_entries_);
+            std::stable_sort(new_entries.begin(),
+                             new_entries.end(),
+                             [](const EntryType& lhs, const EntryType& rhs) { return lhs.opcode < rhs.opcode; });
+            new_entries.erase(std::unique(new_entries.begin(),
+                                          new_entries.end(),
+                                          [](const EntryType& lhs, const EntryType& rhs) { return lhs.opcode == rhs.opcode; }),
+                              new_entries.end());
+
+            STFCacheFile::Writer writer(cache_path_);
+            writer.write(makeHeader_(new_entries.size()));
+            writer.write(data);
+            writer.writeVector(new_entries);
+            writer.commit();
+        }
+};
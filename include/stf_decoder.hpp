@@ -1,18 +1,25 @@
 #pragma once
 
+#include <array>
 #include <bitset>
 #include <cstdlib>
 #include <mavis/DecoderTypes.h>
 #include <mavis/extension_managers/RISCVExtensionManager.hpp>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <ostream>
 #include <string_view>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
 
 #include "mavis_helpers.hpp"
 #include "isa_defs.hpp"
 #include "stf_valid_value.hpp"
 #include "stf_record_types.hpp"
 #include "filesystem.hpp"
+#include "stf_decode_cache.hpp"
 #include "tools_util.hpp"
 
 namespace stf {
@@ -71,8 +78,270 @@ namespace stf {
             const std::string mavis_isa_spec_;
             const std::string isa_string_;
             using ExtMan = mavis::extension_manager::riscv::RISCVExtensionManager;
-            const ExtMan ext_man_;
-            mutable MavisType mavis_; /**< Mavis decoder */
+
+            using BitMask = mavis::DecodedInstructionInfo::BitMask;
+
+            template<typename>
+            struct bitset_size;
+
+            template<size_t N>
+            struct bitset_size<std::bitset<N>> {
+                static constexpr size_t size = N;
+            };
+
+            static constexpr uint32_t DECODE_CACHE_VERSION_ = 1; /**< Must be bumped whenever CachedUIDs_ or CachedOpcode_ changes */
+            static constexpr size_t MAX_CACHED_OPCODES_ = 1 << 18; /**< Maximum number of opcodes held in an on-disk decode cache */
+            static constexpr size_t BIT_MASK_WORDS_ = (bitset_size<BitMask>::size + 63) / 64;
+
+            using PackedBitMask_ = std::array<uint64_t, BIT_MASK_WORDS_>;
+
+            static inline PackedBitMask_ packBitMask_(const BitMask& mask) {
+                PackedBitMask_ packed{};
+                for(size_t i = 0; i < bitset_size<BitMask>::size; ++i) {
+                    if(mask.test(i)) {
+                        packed[i / 64] |= 1ULL << (i % 64);
+                    }
+                }
+                return packed;
+            }
+
+            static inline BitMask unpackBitMask_(const PackedBitMask_& packed) {
+                BitMask mask;
+                for(size_t i = 0; i < bitset_size<BitMask>::size; ++i) {
+                    mask[i] = (packed[i / 64] >> (i % 64)) & 1;
+                }
+                return mask;
+            }
+
+            /**
+             * \struct CachedUIDs_
+             * Instruction UIDs that every decoder looks up, as they are stored in the on-disk decode cache
+             */
+            struct CachedUIDs_ {
+                uint64_t ecall;
+                uint64_t mret;
+                uint64_t sret;
+                uint64_t uret;
+            };
+
+            /**
+             * \struct CachedOpcode_
+             * Decode results for a single opcode, as they are stored in the on-disk decode cache
+             */
+            struct CachedOpcode_ {
+                uint32_t opcode;
+                uint32_t valid;
+                uint64_t uid;
+                uint64_t inst_types;
+                uint64_t isa_extensions;
+                PackedBitMask_ int_sources;
+                PackedBitMask_ float_sources;
+                PackedBitMask_ vector_sources;
+                PackedBitMask_ int_dests;
+                PackedBitMask_ float_dests;
+                PackedBitMask_ vector_dests;
+            };
+
+            static_assert(sizeof(mavis_helpers::MavisInstTypeArray::int_t) <= sizeof(uint64_t) &&
+                          sizeof(mavis_helpers::MavisISAExtensionTypeArray::int_t) <= sizeof(uint64_t) &&
+                          sizeof(mavis::InstructionUniqueID) <= sizeof(uint64_t),
+                          "Decode cache fields are too small");
+
+            /**
+             * Extracts the cached decode results from Mavis decode info
+             * \param opcode Opcode that was decoded
+             * \param decode_info Mavis decode info. Null if the opcode is invalid.
+             */
+            static inline CachedOpcode_ makeCachedOpcode_(const uint32_t opcode, const typename MavisType::DecodeInfoType& decode_info) {
+                CachedOpcode_ cached_opcode{};
+                cached_opcode.opcode = opcode;
+
+                if(!decode_info) {
+                    return cached_opcode;
+                }
+
+                const auto& op_info = decode_info->opinfo;
+                cached_opcode.valid = 1;
+                cached_opcode.uid = op_info->getInstructionUniqueID();
+                cached_opcode.inst_types = op_info->getInstType();
+                cached_opcode.isa_extensions = op_info->getISA();
+                cached_opcode.int_sources = packBitMask_(op_info->getIntSourceRegs());
+                cached_opcode.float_sources = packBitMask_(op_info->getFloatSourceRegs());
+                cached_opcode.vector_sources = packBitMask_(op_info->getVectorSourceRegs());
+                cached_opcode.int_dests = packBitMask_(op_info->getIntDestRegs());
+                cached_opcode.float_dests = packBitMask_(op_info->getFloatDestRegs());
+                cached_opcode.vector_dests = packBitMask_(op_info->getVectorDestRegs());
+                return cached_opcode;
+            }
+
+            /**
+             * \class DecodeTable_
+             * \brief Decode results and Mavis decoder shared by every STFDecoderBase in the process that uses the same Mavis configuration
+             *
+             * Opcodes are looked up in the on-disk decode cache (see STFDecodeCache) first. Mavis, which parses all
+             * of the Mavis JSON files, is only constructed when an opcode is missing from the cache or a decoder
+             * needs the full Mavis decode info (mnemonics, disassembly, immediates, operand fields, tags or
+             * annotations). Cache lookups don't take a lock. Calls into Mavis are serialized so that decoders on
+             * different threads can share a table. Opcodes decoded by Mavis are added to the on-disk cache when the
+             * table is destroyed at process exit.
+             */
+            class DecodeTable_ {
+                private:
+                    using Key_ = std::tuple<std::string, std::string, std::string>;
+                    using Cache_ = STFDecodeCache<CachedUIDs_, CachedOpcode_>;
+
+                    /**
+                     * \struct MavisInstance_
+                     * Mavis decoder and the extension manager it was constructed from
+                     */
+                    struct MavisInstance_ {
+                        const ExtMan ext_man;
+                        MavisType mavis;
+
+                        MavisInstance_(const std::string& mavis_path, const std::string& mavis_isa_spec, const std::string& isa_string) :
+                            ext_man(ExtMan::fromISA(isa_string, mavis_isa_spec, mavis_helpers::getMavisJSONPath(mavis_path))),
+                            mavis(ext_man.constructMavis<InstType, AnnotationType>({}))
+                        {
+                        }
+                    };
+
+                    const std::string mavis_path_;
+                    const std::string mavis_isa_spec_;
+                    const std::string isa_string_;
+                    const Cache_ cache_;
+                    CachedUIDs_ uids_;
+
+                    mutable std::mutex mutex_; /**< Guards the members below */
+                    mutable std::unique_ptr<MavisInstance_> mavis_;
+                    mutable std::unordered_map<uint32_t, CachedOpcode_> new_opcodes_; /**< Opcodes decoded by Mavis that are not in the on-disk cache */
+
+                    /**
+                     * Gets the Mavis decoder, constructing it if necessary. mutex_ must be held.
+                     */
+                    MavisType& getMavis_() const {
+                        if(STF_EXPECT_FALSE(!mavis_)) {
+                            mavis_ = std::make_unique<MavisInstance_>(mavis_path_, mavis_isa_spec_, isa_string_);
+                        }
+                        return mavis_->mavis;
+                    }
+
+                public:
+                    DecodeTable_(const std::string& mavis_path, const std::string& mavis_isa_spec, const std::string& isa_string) :
+                        mavis_path_(mavis_path),
+                        mavis_isa_spec_(mavis_isa_spec),
+                        isa_string_(isa_string),
+                        cache_(isa_string_, mavis_isa_spec_, mavis_helpers::getMavisJSONPath(mavis_path_), DECODE_CACHE_VERSION_)
+                    {
+                        if(cache_.loaded()) {
+                            uids_ = cache_.getData();
+                        }
+                        else {
+                            uids_.ecall = lookupInstructionUniqueID("ecall");
+                            uids_.mret = lookupInstructionUniqueID("mret");
+                            uids_.sret = lookupInstructionUniqueID("sret");
+                            uids_.uret = lookupInstructionUniqueID("uret");
+                        }
+                    }
+
+                    DecodeTable_(const DecodeTable_&) = delete;
+                    DecodeTable_& operator=(const DecodeTable_&) = delete;
+
+                    ~DecodeTable_() {
+                        if(cache_.loaded() && new_opcodes_.empty()) {
+                            return;
+                        }
+
+                        // The cache is best effort, so a failure to save it shouldn't take down the process
+                        try {
+                            std::vector<CachedOpcode_> new_opcodes;
+                            new_opcodes.reserve(new_opcodes_.size());
+                            for(const auto& p: new_opcodes_) {
+                                new_opcodes.emplace_back(p.second);
+                            }
+                            cache_.save(uids_, std::move(new_opcodes));
+                        }
+                        catch(const std::exception&) {
+                        }
+                    }
+
+                    /**
+                     * Gets the shared decode table for the given configuration, constructing it if necessary
+                     * \param mavis_path Path to Mavis checkout
+                     * \param mavis_isa_spec Path to Mavis ISA spec JSON
+                     * \param isa_string ISA string
+                     */
+                    static std::shared_ptr<const DecodeTable_> get(const std::string& mavis_path,
+                                                                   const std::string& mavis_isa_spec,
+                                                                   const std::string& isa_string) {
+                        static std::mutex registry_mutex;
+                        static std::map<Key_, std::shared_ptr<const DecodeTable_>> registry;
+
+                        const std::lock_guard<std::mutex> lock(registry_mutex);
+                        auto& table = registry[Key_(mavis_path, mavis_isa_spec, isa_string)];
+                        if(!table) {
+                            table = std::make_shared<const DecodeTable_>(mavis_path, mavis_isa_spec, isa_string);
+                        }
+
+                        return table;
+                    }
+
+                    /**
+                     * Gets the UIDs of the instructions every decoder looks up
+                     */
+                    const CachedUIDs_& getUIDs() const {
+                        return uids_;
+                    }
+
+                    /**
+                     * Gets the decode results for an opcode
+                     * \param opcode Opcode to decode
+                     * \param decode_info Set to the Mavis decode info if the opcode had to be decoded by Mavis
+                     */
+                    CachedOpcode_ lookup(const uint32_t opcode, typename MavisType::DecodeInfoType& decode_info) const {
+                        if(const auto* cached_opcode = cache_.find(opcode)) {
+                            return *cached_opcode;
+                        }
+
+                        const std::lock_guard<std::mutex> lock(mutex_);
+
+                        if(const auto it = new_opcodes_.find(opcode); it != new_opcodes_.end()) {
+                            return it->second;
+                        }
+
+                        try {
+                            decode_info = getMavis_().getInfo(opcode);
+                        }
+                        catch(const mavis::UnknownOpcode&) {
+                        }
+                        catch(const mavis::IllegalOpcode&) {
+                        }
+
+                        const auto cached_opcode = makeCachedOpcode_(opcode, decode_info);
+
+                        if(cache_.enabled() && cache_.size() + new_opcodes_.size() < MAX_CACHED_OPCODES_) {
+                            new_opcodes_.emplace(opcode, cached_opcode);
+                        }
+
+                        return cached_opcode;
+                    }
+
+                    typename MavisType::DecodeInfoType getInfo(const uint32_t opcode) const {
+                        const std::lock_guard<std::mutex> lock(mutex_);
+                        return getMavis_().getInfo(opcode);
+                    }
+
+                    mavis::InstructionUniqueID lookupInstructionUniqueID(const std::string& mnemonic) const {
+                        const std::lock_guard<std::mutex> lock(mutex_);
+                        return getMavis_().lookupInstructionUniqueID(mnemonic);
+                    }
+
+                    const std::string& lookupInstructionMnemonic(const mavis::InstructionUniqueID uid) const {
+                        const std::lock_guard<std::mutex> lock(mutex_);
+                        return getMavis_().lookupInstructionMnemonic(uid);
+                    }
+            };
+
+            std::shared_ptr<const DecodeTable_> table_; /**< Shared decode results and Mavis decoder */
 
             // Cached instruction UIDs allow us to identify ecall/mret/sret/uret without needing to check the mnemonic
             const mavis::InstructionUniqueID ecall_uid_;
@@ -88,37 +357,141 @@ namespace stf {
             uint32_t start_markpoint_opcode_ = DEFAULT_START_MARKPOINT_OPCODE_;
             uint32_t stop_markpoint_opcode_ = DEFAULT_STOP_MARKPOINT_OPCODE_;
 
-            mutable typename MavisType::DecodeInfoType decode_info_; /**< Cached decode info */
-            mutable bool has_pending_decode_info_ = false; /**< Cached decode info */
+            static constexpr size_t MAX_DECODE_CACHE_SIZE_ = 65536; /**< Maximum number of opcodes held in the decode cache */
+            static constexpr size_t NUM_CACHED_OPERAND_FIELDS_ = 8; /**< Operand field values with IDs below this are cached */
+
+            /**
+             * \struct DecodedOpcode_
+             * Decode results for a single opcode. The commonly used properties are extracted once when the opcode
+             * is first decoded so that the predicate methods do not have to go through Mavis.
+             */
+            struct DecodedOpcode_ {
+                typename MavisType::DecodeInfoType decode_info; /**< Mavis decode info. Looked up on first use if the opcode came from the decode cache. */
+                bool is_valid = false;
+                mavis_helpers::MavisInstTypeArray::int_t inst_types = 0;
+                mavis_helpers::MavisISAExtensionTypeArray::int_t isa_extensions = 0;
+                mavis::InstructionUniqueID uid = 0;
+                BitMask int_sources;
+                BitMask float_sources;
+                BitMask vector_sources;
+                BitMask int_dests;
+                BitMask float_dests;
+                BitMask vector_dests;
+                std::array<uint32_t, NUM_CACHED_OPERAND_FIELDS_> source_fields{};
+                std::array<uint32_t, NUM_CACHED_OPERAND_FIELDS_> dest_fields{};
+                std::bitset<NUM_CACHED_OPERAND_FIELDS_> has_source_field; /**< Set when the corresponding source field has been cached */
+                std::bitset<NUM_CACHED_OPERAND_FIELDS_> has_dest_field; /**< Set when the corresponding dest field has been cached */
+                std::string disasm; /**< Lazily generated disassembly */
+
+                DecodedOpcode_(const CachedOpcode_& cached_opcode, typename MavisType::DecodeInfoType&& info) :
+                    decode_info(std::move(info)),
+                    is_valid(cached_opcode.valid != 0),
+                    inst_types(static_cast<mavis_helpers::MavisInstTypeArray::int_t>(cached_opcode.inst_types)),
+                    isa_extensions(static_cast<mavis_helpers::MavisISAExtensionTypeArray::int_t>(cached_opcode.isa_extensions)),
+                    uid(static_cast<mavis::InstructionUniqueID>(cached_opcode.uid)),
+                    int_sources(unpackBitMask_(cached_opcode.int_sources)),
+                    float_sources(unpackBitMask_(cached_opcode.float_sources)),
+                    vector_sources(unpackBitMask_(cached_opcode.vector_sources)),
+                    int_dests(unpackBitMask_(cached_opcode.int_dests)),
+                    float_dests(unpackBitMask_(cached_opcode.float_dests)),
+                    vector_dests(unpackBitMask_(cached_opcode.vector_dests))
+                {
+                }
+
+                inline bool valid() const {
+                    return is_valid;
+                }
+            };
+
+            mutable std::unordered_map<uint32_t, DecodedOpcode_> decode_cache_; /**< Decode results for every opcode seen so far */
+            mutable DecodedOpcode_* decoded_opcode_ = nullptr; /**< Decode results for the current opcode */
+            mutable bool has_pending_decode_info_ = false; /**< Set when decoded_opcode_ needs to be looked up */
+            mutable uint64_t decode_cache_hits_ = 0;
+            mutable uint64_t decode_cache_misses_ = 0;
             stf::ValidValue<uint32_t> opcode_;
             bool is_compressed_ = false; /**< Set to true if the decoded instruction was compressed */
-            mutable bool is_invalid_ = false;
-            mutable std::string disasm_;
             mutable bool unknown_disasm_ = false;
 
-            const typename MavisType::DecodeInfoType& getDecodeInfo_() const {
+            /**
+             * Gets the cached decode results for the current opcode, looking it up in the decode table if it hasn't been seen before
+             */
+            DecodedOpcode_& getDecodedOpcode_() const {
                 if(STF_EXPECT_FALSE(has_pending_decode_info_)) {
-                    try {
-                        decode_info_ = mavis_.getInfo(opcode_.get());
-                        has_pending_decode_info_ = false;
-                        is_invalid_ = false;
-                        disasm_.clear();
-                    }
-                    catch(const mavis::UnknownOpcode&) {
-                        is_invalid_ = true;
-                        throw InvalidInstException(opcode_.get());
+                    const uint32_t opcode = opcode_.get();
+                    auto it = decode_cache_.find(opcode);
+
+                    if(STF_EXPECT_TRUE(it != decode_cache_.end())) {
+                        ++decode_cache_hits_;
                     }
-                    catch(const mavis::IllegalOpcode&) {
-                        is_invalid_ = true;
-                        throw InvalidInstException(opcode_.get());
+                    else {
+                        ++decode_cache_misses_;
+
+                        typename MavisType::DecodeInfoType decode_info;
+                        const auto cached_opcode = table_->lookup(opcode, decode_info);
+
+                        if(STF_EXPECT_FALSE(decode_cache_.size() >= MAX_DECODE_CACHE_SIZE_)) {
+                            decode_cache_.clear();
+                        }
+
+                        it = decode_cache_.emplace(opcode, DecodedOpcode_(cached_opcode, std::move(decode_info))).first;
                     }
+
+                    decoded_opcode_ = &it->second;
+                    has_pending_decode_info_ = false;
                 }
-                else if(STF_EXPECT_FALSE(is_invalid_)) {
+
+                stf_assert(decoded_opcode_, "Attempted to get instruction info without calling decode() first.");
+                return *decoded_opcode_;
+            }
+
+            /**
+             * Gets the cached decode results for the current opcode
+             * \throws InvalidInstException if the opcode could not be decoded
+             */
+            DecodedOpcode_& getValidDecodedOpcode_() const {
+                auto& decoded_opcode = getDecodedOpcode_();
+                if(STF_EXPECT_FALSE(!decoded_opcode.valid())) {
                     throw InvalidInstException(opcode_.get());
                 }
+                return decoded_opcode;
+            }
 
-                stf_assert(decode_info_, "Attempted to get instruction info without calling decode() first.");
-                return decode_info_;
+            /**
+             * Gets the Mavis decode info for the current opcode, looking it up in Mavis if the opcode came from the decode cache
+             * \param decoded_opcode Valid decode results for the current opcode
+             */
+            const typename MavisType::DecodeInfoType& getDecodeInfo_(DecodedOpcode_& decoded_opcode) const {
+                if(STF_EXPECT_FALSE(!decoded_opcode.decode_info)) {
+                    decoded_opcode.decode_info = table_->getInfo(opcode_.get());
+                }
+                return decoded_opcode.decode_info;
+            }
+
+            const typename MavisType::DecodeInfoType& getDecodeInfo_() const {
+                return getDecodeInfo_(getValidDecodedOpcode_());
+            }
+
+            /**
+             * Gets an operand field value, caching it in the decode results if possible
+             */
+            template<typename GetOpInfoFunc>
+            inline uint32_t getCachedFieldValue_(DecodedOpcode_& decoded_opcode,
+                                                 std::array<uint32_t, NUM_CACHED_OPERAND_FIELDS_>& fields,
+                                                 std::bitset<NUM_CACHED_OPERAND_FIELDS_>& has_field,
+                                                 const mavis::InstMetaData::OperandFieldID fid,
+                                                 GetOpInfoFunc&& get_op_info) const {
+                const auto field_idx = static_cast<size_t>(stf::enums::to_int(fid));
+
+                if(STF_EXPECT_FALSE(field_idx >= NUM_CACHED_OPERAND_FIELDS_)) {
+                    return get_op_info(getDecodeInfo_(decoded_opcode)->opinfo).getFieldValue(fid);
+                }
+
+                if(STF_EXPECT_FALSE(!has_field.test(field_idx))) {
+                    fields[field_idx] = get_op_info(getDecodeInfo_(decoded_opcode)->opinfo).getFieldValue(fid);
+                    has_field.set(field_idx);
+                }
+
+                return fields[field_idx];
             }
 
             /**
@@ -209,28 +582,15 @@ namespace stf {
                 }
             }
 
-            template<typename>
-            struct bitset_size;
-
-            template<size_t N>
-            struct bitset_size<std::bitset<N>> {
-                static constexpr size_t size = N;
-            };
-
-            static ExtMan constructExtMan_(const std::string& isa_string, const std::string& mavis_isa_spec, const std::string& mavis_path) {
-                return ExtMan::fromISA(isa_string, mavis_isa_spec, mavis_helpers::getMavisJSONPath(mavis_path));
-            }
-
             STFDecoderBase(const std::string& mavis_path, const std::string& mavis_isa_spec, const std::string& isa_string) :
                 mavis_path_(mavis_path),
                 mavis_isa_spec_(mavis_isa_spec),
                 isa_string_(isa_string),
-                ext_man_(constructExtMan_(isa_string_, mavis_isa_spec_, mavis_path_)),
-                mavis_(ext_man_.constructMavis<InstType, AnnotationType>({})),
-                ecall_uid_(lookupInstructionUID("ecall")),
-                mret_uid_(lookupInstructionUID("mret")),
-                sret_uid_(lookupInstructionUID("sret")),
-                uret_uid_(lookupInstructionUID("uret"))
+                table_(DecodeTable_::get(mavis_path_, mavis_isa_spec_, isa_string_)),
+                ecall_uid_(static_cast<mavis::InstructionUniqueID>(table_->getUIDs().ecall)),
+                mret_uid_(static_cast<mavis::InstructionUniqueID>(table_->getUIDs().mret)),
+                sret_uid_(static_cast<mavis::InstructionUniqueID>(table_->getUIDs().sret)),
+                uret_uid_(static_cast<mavis::InstructionUniqueID>(table_->getUIDs().uret))
             {
             }
 
@@ -261,12 +621,11 @@ namespace stf {
                 mavis_path_(rhs.mavis_path_),
                 mavis_isa_spec_(rhs.mavis_isa_spec_),
                 isa_string_(rhs.isa_string_),
-                ext_man_(constructExtMan_(isa_string_, mavis_isa_spec_, mavis_path_)),
-                mavis_(ext_man_.constructMavis<InstType, AnnotationType>({})),
-                ecall_uid_(lookupInstructionUID("ecall")),
-                mret_uid_(lookupInstructionUID("mret")),
-                sret_uid_(lookupInstructionUID("sret")),
-                uret_uid_(lookupInstructionUID("uret")),
+                table_(rhs.table_),
+                ecall_uid_(rhs.ecall_uid_),
+                mret_uid_(rhs.mret_uid_),
+                sret_uid_(rhs.sret_uid_),
+                uret_uid_(rhs.uret_uid_),
                 start_tracepoint_opcode_(rhs.start_tracepoint_opcode_),
                 stop_tracepoint_opcode_(rhs.stop_tracepoint_opcode_),
                 start_markpoint_opcode_(rhs.start_markpoint_opcode_),
@@ -285,24 +644,14 @@ namespace stf {
              * \param type Instruction type to check
              */
             inline bool isInstType(const mavis::InstMetaData::InstructionTypes type) const {
-                try {
-                    return getDecodeInfo_()->opinfo->isInstType(type);
-                }
-                catch(const InvalidInstException&) {
-                    return false;
-                }
+                return (getDecodedOpcode_().inst_types & stf::enums::to_int(type)) != 0;
             }
 
             /**
              * Returns all of the instruction types for the decoded instruction
              */
-            inline auto getInstTypes() const {
-                try {
-                    return getDecodeInfo_()->opinfo->getInstType();
-                }
-                catch(const InvalidInstException&) {
-                    return mavis_helpers::MavisInstTypeArray::int_t(0);
-                }
+            inline mavis_helpers::MavisInstTypeArray::int_t getInstTypes() const {
+                return getDecodedOpcode_().inst_types;
             }
 
             /**
@@ -448,20 +797,20 @@ namespace stf {
              * Gets the disassembly for the decoded instruction
              */
             inline const std::string& getDisassembly() const {
-                try {
-                    const auto& decode_info = getDecodeInfo_();
-                    if(STF_EXPECT_FALSE(disasm_.empty())) {
-                        disasm_ = decode_info->opinfo->dasmString();
-                    }
-                }
-                catch(const InvalidInstException& e) {
-                    if(e.getOpcode() != 0) { // opcode == 0 usually implies a fault/interrupt in the trace
+                auto& decoded_opcode = getDecodedOpcode_();
+
+                if(STF_EXPECT_FALSE(!decoded_opcode.valid())) {
+                    if(opcode_.get() != 0) { // opcode == 0 usually implies a fault/interrupt in the trace
                         unknown_disasm_ = true;
                     }
                     return UNIMP_;
                 }
 
-                return disasm_;
+                if(STF_EXPECT_FALSE(decoded_opcode.disasm.empty())) {
+                    decoded_opcode.disasm = getDecodeInfo_(decoded_opcode)->opinfo->dasmString();
+                }
+
+                return decoded_opcode.disasm;
             }
 
             /**
@@ -504,24 +853,34 @@ namespace stf {
              * Gets a source register field for the decoded instruction
              */
             inline uint32_t getSourceRegister(const mavis::InstMetaData::OperandFieldID& fid) const {
-                try {
-                    return getDecodeInfo_()->opinfo->getSourceOpInfo().getFieldValue(fid);
-                }
-                catch(const InvalidInstException&) {
+                auto& decoded_opcode = getDecodedOpcode_();
+
+                if(STF_EXPECT_FALSE(!decoded_opcode.valid())) {
                     return 0;
                 }
+
+                return getCachedFieldValue_(decoded_opcode,
+                                            decoded_opcode.source_fields,
+                                            decoded_opcode.has_source_field,
+                                            fid,
+                                            [](const auto& op_info) -> decltype(auto) { return op_info->getSourceOpInfo(); });
             }
 
             /**
              * Gets a destination register field for the decoded instruction
              */
             inline uint32_t getDestRegister(const mavis::InstMetaData::OperandFieldID& fid) const {
-                try {
-                    return getDecodeInfo_()->opinfo->getDestOpInfo().getFieldValue(fid);
-                }
-                catch(const InvalidInstException&) {
+                auto& decoded_opcode = getDecodedOpcode_();
+
+                if(STF_EXPECT_FALSE(!decoded_opcode.valid())) {
                     return 0;
                 }
+
+                return getCachedFieldValue_(decoded_opcode,
+                                            decoded_opcode.dest_fields,
+                                            decoded_opcode.has_dest_field,
+                                            fid,
+                                            [](const auto& op_info) -> decltype(auto) { return op_info->getDestOpInfo(); });
             }
 
             /**
@@ -540,17 +899,17 @@ namespace stf {
 
             std::vector<stf::InstRegRecord> getRegisterOperands() const {
                 std::vector<stf::InstRegRecord> operands;
-                const auto& op_info = getDecodeInfo_()->opinfo;
+                const auto& decoded_opcode = getValidDecodedOpcode_();
 
-                const auto int_sources = op_info->getIntSourceRegs();
-                const auto float_sources = op_info->getFloatSourceRegs();
-                const auto vector_sources = op_info->getVectorSourceRegs();
+                const auto& int_sources = decoded_opcode.int_sources;
+                const auto& float_sources = decoded_opcode.float_sources;
+                const auto& vector_sources = decoded_opcode.vector_sources;
 
-                const auto int_dests = op_info->getIntDestRegs();
-                const auto float_dests = op_info->getFloatDestRegs();
-                const auto vector_dests = op_info->getVectorDestRegs();
+                const auto& int_dests = decoded_opcode.int_dests;
+                const auto& float_dests = decoded_opcode.float_dests;
+                const auto& vector_dests = decoded_opcode.vector_dests;
 
-                for(size_t i = 0; i < bitset_size<mavis::DecodedInstructionInfo::BitMask>::size; ++i) {
+                for(size_t i = 0; i < bitset_size<BitMask>::size; ++i) {
                     if(STF_EXPECT_FALSE(int_sources.test(i))) {
                         operands.emplace_back(i,
                                               stf::Registers::STF_REG_TYPE::INTEGER,
@@ -596,32 +955,34 @@ namespace stf {
                 const auto reg_num = stf::Registers::getArchRegIndex(reg);
                 stf_assert(!stf::Registers::isCSR(reg), "CSRs are not supported yet");
 
-                try {
-                    if(stf::Registers::isFPR(reg)) {
-                        return getDecodeInfo_()->opinfo->getFloatSourceRegs().test(reg_num);
-                    }
+                const auto& decoded_opcode = getDecodedOpcode_();
 
-                    return getDecodeInfo_()->opinfo->getIntSourceRegs().test(reg_num);
-                }
-                catch(const InvalidInstException&) {
+                if(STF_EXPECT_FALSE(!decoded_opcode.valid())) {
                     return false;
                 }
+
+                if(stf::Registers::isFPR(reg)) {
+                    return decoded_opcode.float_sources.test(reg_num);
+                }
+
+                return decoded_opcode.int_sources.test(reg_num);
             }
 
             inline bool hasDestRegister(const stf::Registers::STF_REG reg) const {
                 const auto reg_num = stf::Registers::getArchRegIndex(reg);
                 stf_assert(!stf::Registers::isCSR(reg), "CSRs are not supported yet");
 
-                try {
-                    if(stf::Registers::isFPR(reg)) {
-                        return getDecodeInfo_()->opinfo->getFloatDestRegs().test(reg_num);
-                    }
+                const auto& decoded_opcode = getDecodedOpcode_();
 
-                    return getDecodeInfo_()->opinfo->getIntDestRegs().test(reg_num);
-                }
-                catch(const InvalidInstException&) {
+                if(STF_EXPECT_FALSE(!decoded_opcode.valid())) {
                     return false;
                 }
+
+                if(stf::Registers::isFPR(reg)) {
+                    return decoded_opcode.float_dests.test(reg_num);
+                }
+
+                return decoded_opcode.int_dests.test(reg_num);
             }
 
             /**
@@ -677,37 +1038,21 @@ namespace stf {
              * Returns whether the last decode operation failed
              */
             bool decodeFailed() const {
-                try {
-                    getDecodeInfo_();
-                    return false;
-                }
-                catch(const InvalidInstException&) {
-                    return true;
-                }
+                return !getDecodedOpcode_().valid();
             }
 
             /**
              * Returns whether the instruction is from the bitmanip ISA extension
              */
             bool isBitmanip() const {
-                try {
-                    return getDecodeInfo_()->opinfo->isISA(mavis::OpcodeInfo::ISAExtension::B);
-                }
-                catch(const InvalidInstException&) {
-                    return false;
-                }
+                return (getDecodedOpcode_().isa_extensions & stf::enums::to_int(mavis::OpcodeInfo::ISAExtension::B)) != 0;
             }
 
             /**
              * Returns all of the ISA extensions an instruction belongs to
              */
-            inline auto getISAExtensions() const {
-                try {
-                    return getDecodeInfo_()->opinfo->getISA();
-                }
-                catch(const InvalidInstException&) {
-                    return mavis_helpers::MavisISAExtensionTypeArray::int_t(0);
-                }
+            inline mavis_helpers::MavisISAExtensionTypeArray::int_t getISAExtensions() const {
+                return getDecodedOpcode_().isa_extensions;
             }
 
             bool hasTag(const std::string& tag) const {
@@ -715,15 +1060,15 @@ namespace stf {
             }
 
             mavis::InstructionUniqueID lookupInstructionUID(const std::string& mnemonic) const {
-                return mavis_.lookupInstructionUniqueID(mnemonic);
+                return table_->lookupInstructionUniqueID(mnemonic);
             }
 
             mavis::InstructionUniqueID getInstructionUID() const {
-                return getDecodeInfo_()->opinfo->getInstructionUniqueID();
+                return getValidDecodedOpcode_().uid;
             }
 
             const std::string& getMnemonicFromUID(const mavis::InstructionUniqueID uid) const {
-                return mavis_.lookupInstructionMnemonic(uid);
+                return table_->lookupInstructionMnemonic(uid);
             }
 
             /**
@@ -764,6 +1109,28 @@ namespace stf {
             uint32_t getStopTracepointOpcode() const {
                 return stop_tracepoint_opcode_;
             }
+
+            /**
+             * Gets the number of decodes that were served from the decode cache
+             */
+            uint64_t getDecodeCacheHits() const {
+                return decode_cache_hits_;
+            }
+
+            /**
+             * Gets the number of decodes that had to go to the shared decode table
+             */
+            uint64_t getDecodeCacheMisses() const {
+                return decode_cache_misses_;
+            }
+
+            /**
+             * Gets the fraction of decodes that were served from the decode cache
+             */
+            double getDecodeCacheHitRate() const {
+                const uint64_t total = decode_cache_hits_ + decode_cache_misses_;
+                return total == 0 ? 0.0 : static_cast<double>(decode_cache_hits_) / static_cast<double>(total);
+            }
     };
 
     class STFDecoder : public STFDecoderBase<mavis_helpers::InstType, mavis_helpers::DummyAnnotationType> {
@@ -12,22 +12,68 @@ class STFDwarf {
     private:
         const dwarf_wrapper::DwarfInterface dwarf_;
 
+        static constexpr Dwarf_Bool is_info_ = dwarf_wrapper::DWARF_TRUE;
+
+        /**
+         * Calls func(cu_die) on the root DIE of every compilation unit
+         */
+        template<typename Func>
+        inline void iterateCus_(Func&& func) {
+            static constexpr Dwarf_Die no_die = nullptr;
+
+            while(dwarf_.nextCuHeader(is_info_)) {
+                /* The CU will have a single sibling, a cu_die. */
+                const auto cu_die = dwarf_.siblingOf(no_die, is_info_);
+                stf_assert(cu_die, "Error reading CU siblings");
+                func(cu_die);
+            }
+        }
+
     public:
         explicit STFDwarf(const std::string& filename) :
             dwarf_(filename)
         {
         }
 
+        /**
+         * Calls callback(const std::shared_ptr<dwarf_wrapper::Die>&) on every DIE
+         */
         template<typename Callback>
         inline void iterateDies(Callback&& callback) {
-            static constexpr Dwarf_Bool is_info = dwarf_wrapper::DWARF_TRUE;
-            static constexpr Dwarf_Die no_die = nullptr;
+            iterateCus_([this, &callback](const Dwarf_Die cu_die) {
+                dwarf_wrapper::Die::construct(&dwarf_, cu_die)->iterateSiblings(callback, is_info_);
+            });
+        }
 
-            while(dwarf_.nextCuHeader(is_info)) {
-                /* The CU will have a single sibling, a cu_die. */
-                const auto cu_die = dwarf_.siblingOf(no_die, is_info);
-                stf_assert(cu_die, "Error reading CU siblings");
-                dwarf_wrapper::Die::construct(&dwarf_, cu_die)->iterateSiblings(callback, is_info);
-            }
+        /**
+         * Calls callback(const dwarf_wrapper::Die&) on every DIE. Unlike iterateDies, the DIEs live on the
+         * stack and are only valid for the duration of the callback, so nothing is allocated per DIE.
+         */
+        template<typename Callback>
+        inline void visitDies(Callback&& callback) {
+            iterateCus_([this, &callback](const Dwarf_Die cu_die) {
+                dwarf_wrapper::Die::visitSiblings(&dwarf_, cu_die, callback, is_info_);
+            });
+        }
+
+        /**
+         * Gets the offset of the root DIE of every compilation unit, in the order they appear in the file
+         */
+        inline std::vector<Dwarf_Off> getCuOffsets() {
+            std::vector<Dwarf_Off> cu_offsets;
+            iterateCus_([this, &cu_offsets](const Dwarf_Die cu_die) {
+                cu_offsets.emplace_back(dwarf_wrapper::Die(&dwarf_, cu_die).getOffset());
+            });
+            return cu_offsets;
+        }
+
+        /**
+         * Like visitDies, but only visits the DIEs in a single compilation unit
+         * \param cu_offset Offset of the compilation unit's root DIE, as returned by getCuOffsets
+         * \param callback Callback to invoke on each DIE
+         */
+        template<typename Callback>
+        inline void visitCuDies(const Dwarf_Off cu_offset, Callback&& callback) {
+            dwarf_wrapper::Die::visitSiblings(&dwarf_, dwarf_.offDie(cu_offset), callback, is_info_);
         }
 };
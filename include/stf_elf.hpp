@@ -1,8 +1,15 @@
 #pragma once
 
 #include <algorithm>
+#include <cstddef>
 #include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <limits>
 #include <map>
+#include <string>
+#include <vector>
 
 #include "stf_address_range.hpp"
 #include "stf_bin.hpp"
@@ -65,7 +72,104 @@ class STFElf : public STFBinary {
             }
         }
 
+        /**
+         * Searches the note sections of an ELF for a GNU build-id note
+         */
+        template<typename EhdrType, typename ShdrType>
+        static std::vector<uint8_t> readBuildID_(std::ifstream& elf_file) {
+            static constexpr uint32_t NT_GNU_BUILD_ID = 3;
+            static constexpr char GNU_NOTE_NAME[] = "GNU";
+            // Build-id notes are a few dozen bytes, so anything larger than this is corrupt or not worth reading
+            static constexpr uint64_t MAX_NOTE_SECTION_SIZE = 1ULL << 20;
+
+            elf_file.seekg(0, std::ios::end);
+            const auto file_end = elf_file.tellg();
+            if(file_end < 0) {
+                return {};
+            }
+            const auto file_size = static_cast<uint64_t>(file_end);
+
+            EhdrType ehdr;
+            elf_file.seekg(0);
+            if(!elf_file.read(reinterpret_cast<char*>(&ehdr), sizeof(ehdr))) {
+                return {};
+            }
+
+            for(size_t i = 0; i < ehdr.e_shnum; ++i) {
+                ShdrType shdr;
+                elf_file.seekg(static_cast<std::streamoff>(ehdr.e_shoff + i * ehdr.e_shentsize));
+                if(!elf_file.read(reinterpret_cast<char*>(&shdr), sizeof(shdr))) {
+                    return {};
+                }
+
+                if(shdr.sh_type != ELFIO::SHT_NOTE) {
+                    continue;
+                }
+
+                // Don't trust the section header until it has been checked against the file
+                if(shdr.sh_size > MAX_NOTE_SECTION_SIZE ||
+                   shdr.sh_offset > file_size ||
+                   shdr.sh_size > file_size - shdr.sh_offset) {
+                    continue;
+                }
+
+                std::vector<char> notes(static_cast<size_t>(shdr.sh_size));
+                elf_file.seekg(static_cast<std::streamoff>(shdr.sh_offset));
+                if(!elf_file.read(notes.data(), static_cast<std::streamsize>(notes.size()))) {
+                    return {};
+                }
+
+                // Each note is a 12 byte header followed by the name and descriptor, each padded to 4 bytes
+                size_t offset = 0;
+                while(offset + 3 * sizeof(uint32_t) <= notes.size()) {
+                    uint32_t note_header[3];
+                    memcpy(note_header, notes.data() + offset, sizeof(note_header));
+                    const auto [name_size, desc_size, type] = note_header;
+                    const size_t name_offset = offset + sizeof(note_header);
+                    const size_t desc_offset = name_offset + ((name_size + 3ULL) & ~3ULL);
+                    offset = desc_offset + ((desc_size + 3ULL) & ~3ULL);
+
+                    if(offset > notes.size()) {
+                        break;
+                    }
+
+                    if(type == NT_GNU_BUILD_ID &&
+                       name_size == sizeof(GNU_NOTE_NAME) &&
+                       memcmp(notes.data() + name_offset, GNU_NOTE_NAME, sizeof(GNU_NOTE_NAME)) == 0) {
+                        const auto desc_begin = std::next(notes.begin(), static_cast<std::ptrdiff_t>(desc_offset));
+                        return std::vector<uint8_t>(desc_begin, std::next(desc_begin, desc_size));
+                    }
+                }
+            }
+
+            return {};
+        }
+
     public:
+        /**
+         * Reads the GNU build-id of an ELF without loading the rest of the file
+         * \param filename ELF to read
+         * \returns The build-id bytes, or an empty vector if the ELF does not have a build-id
+         */
+        static std::vector<uint8_t> readBuildID(const std::string& filename) {
+            std::ifstream elf_file(filename, std::ios::binary);
+            unsigned char ident[ELFIO::EI_NIDENT];
+
+            if(!elf_file.read(reinterpret_cast<char*>(ident), sizeof(ident)) ||
+               ident[ELFIO::EI_MAG0] != ELFIO::ELFMAG0 ||
+               ident[ELFIO::EI_MAG1] != ELFIO::ELFMAG1 ||
+               ident[ELFIO::EI_MAG2] != ELFIO::ELFMAG2 ||
+               ident[ELFIO::EI_MAG3] != ELFIO::ELFMAG3) {
+                return {};
+            }
+
+            if(ident[ELFIO::EI_CLASS] == ELFIO::ELFCLASS64) {
+                return readBuildID_<ELFIO::Elf64_Ehdr, ELFIO::Elf64_Shdr>(elf_file);
+            }
+
+            return readBuildID_<ELFIO::Elf32_Ehdr, ELFIO::Elf32_Shdr>(elf_file);
+        }
+
         STFElf() :
             STFBinary(0)
         {
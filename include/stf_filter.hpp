@@ -2,6 +2,8 @@
 
 #include <string>
 #include <iostream>
+#include <map>
+#include <utility>
 #include <vector>
 #include "stf_inst_reader.hpp"
 #include "stf_pte.hpp"
@@ -95,7 +97,14 @@ namespace stf {
 
                         const auto& insts_to_write = static_cast<DerivedType*>(this)->filter(inst);
 
-                        if (stf_writer_ && !insts_to_write.empty()) {
+                        if (&insts_to_write == &FORWARD_INST_) {
+                            // Unmodified instructions are written straight from the reader's buffer
+                            if (stf_writer_) {
+                                inst.write(*stf_writer_);
+                                ++num_insts_written_;
+                            }
+                        }
+                        else if (stf_writer_ && !insts_to_write.empty()) {
                             for (const auto& inst_to_write: insts_to_write) {
                                 inst_to_write.write(*stf_writer_);
                                 ++num_insts_written_;
@@ -120,20 +129,28 @@ namespace stf {
         protected:
             inline static const std::vector<stf::STFInst> EMPTY_INST_LIST_;
 
+            /**
+             * Returned by filter() to write the current instruction to the output trace unmodified. The
+             * instruction's records are written straight from the reader, so nothing is copied. Only
+             * instructions that have been rewritten need to be returned in a vector.
+             */
+            inline static const std::vector<stf::STFInst> FORWARD_INST_;
+
             /**
              * This function should be overridden by child classes for different
              * filtering purposes. This function is called on every instruction
              * extracted from the input trace, not including any skipped instructions
              * at the beginning of the trace.
              *
-             * The parent class does not filter anything out--it just returns all the
+             * The parent class does not filter anything out--it just forwards all the
              * instructions given to it.
              *
              * \param inst The next instruction read from the input trace
              *
-             * \returns vector of instructions to write to the output trace
+             * \returns vector of instructions to write to the output trace, or FORWARD_INST_
+             * to write inst unmodified
              */
-            inline const std::vector<STFInst>& filter(const STFInst& inst) { return EMPTY_INST_LIST_; }
+            inline const std::vector<STFInst>& filter(const STFInst& inst) { return FORWARD_INST_; }
 
             /**
              * Sometimes a task needs to be performed at the end of an extraction. This
@@ -158,8 +175,24 @@ namespace stf {
                     }
                 }
 
-                for(const auto& walk_info: orig_records.at(stf::descriptors::internal::Descriptor::STF_PAGE_TABLE_WALK)) {
-                    page_table_.UpdatePTE(inst.pid(), &walk_info->as<PageTableWalkRecord>());
+                // The page table is only used to write the starting records. It keeps pointers to its PTEs, so they
+                // have to outlive the reader's copy of the instruction. The newest PTE for each page is kept and reused
+                // until the page's mapping changes.
+                if (stf_writer_) {
+                    for(const auto& walk_info: orig_records.at(stf::descriptors::internal::Descriptor::STF_PAGE_TABLE_WALK)) {
+                        const auto& pte = walk_info->as<PageTableWalkRecord>();
+                        auto& retained_pte = retained_ptes_[std::make_pair(inst.pid(), pte.getVA())];
+
+                        if (!retained_pte || retained_pte->as<PageTableWalkRecord>() != pte) {
+                            // The old PTE can only be freed once the page table points to the new one
+                            auto new_pte = walk_info->clone();
+                            page_table_.UpdatePTE(inst.pid(), &new_pte->as<PageTableWalkRecord>());
+                            retained_pte = std::move(new_pte);
+                        }
+                        else {
+                            page_table_.UpdatePTE(inst.pid(), &retained_pte->as<PageTableWalkRecord>());
+                        }
+                    }
                 }
 
                 for(const auto& rec: orig_records.at(stf::descriptors::internal::Descriptor::STF_COMMENT)) {
@@ -238,6 +271,7 @@ namespace stf {
             uint64_t num_insts_read_ = 0; /**< Counts number of instructions read */
             uint64_t num_insts_written_ = 0; /**< Counts number of instructions written */
             STF_PTE page_table_; /**< Tracks page table info */
+            std::map<std::pair<uint32_t, uint64_t>, STFRecord::UniqueHandle> retained_ptes_; /**< Owns the PTE records referenced by page_table_, keyed by PID and VA */
 
             bool dump_ptes_on_demand_ = false; /**< If true, dumps PTEs inline with instructions */
             bool in_user_code_ = false; /**< If true, current instruction is user code */
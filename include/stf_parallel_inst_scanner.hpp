@@ -0,0 +1,186 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "stf_inst_reader.hpp"
+#include "stf_writer.hpp"
+#include "thread_pool.hpp"
+
+namespace stf {
+    /**
+     * \class STFParallelInstScanner
+     *
+     * Scans a range of instructions from a trace on multiple threads.
+     *
+     * The range is split into fixed-size segments. Each segment is read by
+     * its own STFInstReader, which seeks directly to the start of the segment
+     * using the trace's chunk index, so every compressed chunk is only
+     * decompressed by the worker that owns it. The default segment size is a
+     * multiple of the default STF chunk size, so for traces written with the
+     * default chunk size every segment starts on a chunk boundary.
+     *
+     * Each segment accumulates into its own SegmentResultType object. The
+     * results are returned in trace order so that the caller can reduce them
+     * deterministically.
+     *
+     * How to use:
+     *
+     * Define a default-constructible SegmentResultType and a scan function
+     * with the signature
+     *
+     *     void scan_func(STFParallelInstScanner<SegmentResultType>::Segment& segment, const STFInst& inst);
+     *
+     * scan_func is called once for every instruction in the segment, in
+     * order. segment.start_inst + segment.num_insts is the 0-based index of
+     * inst within the trace. scan_func may be called concurrently for
+     * different segments, so it must not modify any shared state.
+     */
+    template<typename SegmentResultType>
+    class STFParallelInstScanner {
+        public:
+            static constexpr uint64_t DEFAULT_SEGMENT_CHUNKS = 64; /**< Default number of chunks per segment */
+            static constexpr uint64_t DEFAULT_SEGMENT_SIZE = DEFAULT_SEGMENT_CHUNKS * STFWriter::DEFAULT_CHUNK_SIZE; /**< Default number of instructions per segment */
+
+            /**
+             * \struct Segment
+             * Holds the range and accumulated result for a single segment
+             */
+            struct Segment {
+                uint64_t start_inst = 0; /**< 0-based index of the first instruction in the segment */
+                uint64_t num_insts = 0; /**< Number of instructions scanned so far */
+                SegmentResultType result; /**< Result accumulated by the scan function */
+
+                Segment() = default;
+
+                explicit Segment(const uint64_t start) :
+                    start_inst(start)
+                {
+                }
+            };
+
+        private:
+            const std::string filename_;
+            const size_t num_threads_;
+            const uint64_t segment_size_;
+
+        public:
+            /**
+             * Constructs an STFParallelInstScanner
+             * \param filename Trace to scan
+             * \param num_threads Number of worker threads. 0 uses all available hardware threads.
+             * \param segment_size Number of instructions in each segment
+             */
+            STFParallelInstScanner(std::string filename,
+                                   const size_t num_threads,
+                                   const uint64_t segment_size = DEFAULT_SEGMENT_SIZE) :
+                filename_(std::move(filename)),
+                num_threads_(num_threads),
+                segment_size_(segment_size)
+            {
+                stf_assert(segment_size_ != 0, "Segment size must be nonzero");
+            }
+
+            /**
+             * Scans a single segment on the calling thread. The segment is scanned
+             * starting from segment.start_inst + segment.num_insts, so a segment whose
+             * result has been preset by the caller can be rescanned with the same
+             * scan function.
+             *
+             * \param segment Segment to scan
+             * \param max_insts Maximum number of instructions to scan
+             * \param scan_func Function called on every instruction
+             *
+             * \returns true if there are more instructions in the trace after the segment
+             */
+            template<typename ScanFunc>
+            bool scanSegment(Segment& segment, const uint64_t max_insts, ScanFunc&& scan_func) const {
+                STFInstReader reader(filename_);
+
+                auto it = reader.begin(segment.start_inst + segment.num_insts);
+                const auto end_it = reader.end();
+
+                for(; it != end_it && segment.num_insts < max_insts; ++it) {
+                    scan_func(segment, *it);
+                    ++segment.num_insts;
+                }
+
+                return it != end_it;
+            }
+
+            /**
+             * Scans instructions [start_inst, end_inst) of the trace in parallel.
+             *
+             * \param start_inst 0-based index of the first instruction to scan
+             * \param end_inst 0-based index of the instruction to stop at. The default scans to the end of the trace.
+             * \param scan_func Function called on every instruction
+             *
+             * \returns Every nonempty segment, in trace order
+             */
+            template<typename ScanFunc>
+            std::vector<Segment> scan(const uint64_t start_inst,
+                                      const uint64_t end_inst,
+                                      ScanFunc&& scan_func) const {
+                if(end_inst <= start_inst) {
+                    return {};
+                }
+
+                const uint64_t num_insts = end_inst - start_inst;
+                const size_t max_segments = static_cast<size_t>(num_insts / segment_size_ + (num_insts % segment_size_ != 0));
+                std::vector<std::vector<Segment>> worker_segments(trace_tools::getNumWorkerThreads(num_threads_));
+
+                trace_tools::parallelForUntil(
+                    num_threads_,
+                    [this, start_inst, end_inst, &worker_segments, &scan_func](const size_t segment_idx, const size_t worker_idx) {
+                        const uint64_t segment_start = start_inst + segment_idx * segment_size_;
+                        Segment segment(segment_start);
+                        const uint64_t max_insts = std::min(segment_size_, end_inst - segment_start);
+                        const bool more_insts = scanSegment(segment, max_insts, scan_func);
+
+                        if(segment.num_insts != 0) {
+                            worker_segments[worker_idx].emplace_back(std::move(segment));
+                        }
+
+                        return more_insts;
+                    },
+                    max_segments
+                );
+
+                std::vector<Segment> segments;
+                for(auto& w: worker_segments) {
+                    std::move(w.begin(), w.end(), std::back_inserter(segments));
+                }
+
+                std::sort(segments.begin(),
+                          segments.end(),
+                          [](const Segment& lhs, const Segment& rhs) { return lhs.start_inst < rhs.start_inst; });
+
+                return segments;
+            }
+
+            /**
+             * Scans every instruction from start_inst to the end of the trace in parallel.
+             *
+             * \param start_inst 0-based index of the first instruction to scan
+             * \param scan_func Function called on every instruction
+             *
+             * \returns Every nonempty segment, in trace order
+             */
+            template<typename ScanFunc>
+            std::vector<Segment> scan(const uint64_t start_inst, ScanFunc&& scan_func) const {
+                return scan(start_inst, std::numeric_limits<uint64_t>::max(), std::forward<ScanFunc>(scan_func));
+            }
+
+            /**
+             * Gets the segment size
+             */
+            uint64_t getSegmentSize() const {
+                return segment_size_;
+            }
+    };
+} // end namespace stf
@@ -1,6 +1,8 @@
 #pragma once
 
-#include <set>
+#include <array>
+#include <cstdint>
+#include <limits>
 #include <unordered_map>
 #include <vector>
 
@@ -27,7 +29,7 @@ namespace stf {
             struct Data {
                 uint32_t pid = 0; /**< PID for the PTE */
                 using pointer_type = const PageTableWalkRecord*;
-                pointer_type walk_info_; /**< Walk record containing the PTE */
+                pointer_type walk_info_ = nullptr; /**< Walk record containing the PTE */
                 bool used = false; /**< Whether the PTE is used in the trace */
 
                 Data() = default;
@@ -43,73 +45,313 @@ namespace stf {
             };
 
             /**
-             * \typedef PTE
-             * Map used to store PTEs
+             * \class PTETable
+             *
+             * Flat open-addressing hash table that maps a (PID, virtual page address) pair to its PTE. Uses
+             * linear probing with backward-shift deletion, so erasing never leaves tombstones behind.
              */
-            using PTE = std::unordered_map<uint64_t, Data>;
+            class PTETable {
+                public:
+                    static constexpr size_t NOT_FOUND = std::numeric_limits<size_t>::max(); /**< Returned by findSlot if the PTE doesn't exist */
+
+                private:
+                    struct Slot {
+                        uint64_t vpage = 0;
+                        uint32_t pid = 0;
+                        bool occupied = false;
+                        Data data;
+                    };
+
+                    static constexpr size_t INITIAL_CAPACITY_ = 256;
+
+                    std::vector<Slot> slots_;
+                    size_t mask_ = INITIAL_CAPACITY_ - 1;
+                    size_t size_ = 0;
+
+                    static inline size_t hash_(const uint32_t pid, const uint64_t vpage) {
+                        // Page addresses have their low bits clear, so mix everything down into the low bits
+                        uint64_t h = (vpage ^ (static_cast<uint64_t>(pid) << 32)) * 0x9e3779b97f4a7c15ULL;
+                        h ^= h >> 29;
+                        return static_cast<size_t>(h);
+                    }
 
-            /**
-             * \typedef PIDPTEs
-             * Maps PIDs to PTEs
-             */
-            using PIDPTEs = std::unordered_map<uint32_t, PTE>;
+                    void grow_() {
+                        std::vector<Slot> old_slots(slots_.size() * 2);
+                        old_slots.swap(slots_);
+                        mask_ = slots_.size() - 1;
+
+                        for(auto& slot: old_slots) {
+                            if(slot.occupied) {
+                                size_t idx = hash_(slot.pid, slot.vpage) & mask_;
+                                while(slots_[idx].occupied) {
+                                    idx = (idx + 1) & mask_;
+                                }
+                                slots_[idx] = std::move(slot);
+                            }
+                        }
+                    }
+
+                public:
+                    PTETable() :
+                        slots_(INITIAL_CAPACITY_)
+                    {
+                    }
+
+                    /**
+                     * Gets the slot holding the PTE for the given page, or NOT_FOUND. Slot indices are
+                     * invalidated by insert and erase.
+                     */
+                    inline size_t findSlot(const uint32_t pid, const uint64_t vpage) const {
+                        for(size_t idx = hash_(pid, vpage) & mask_; slots_[idx].occupied; idx = (idx + 1) & mask_) {
+                            if(slots_[idx].vpage == vpage && slots_[idx].pid == pid) {
+                                return idx;
+                            }
+                        }
+
+                        return NOT_FOUND;
+                    }
+
+                    inline Data& getSlot(const size_t idx) {
+                        return slots_[idx].data;
+                    }
+
+                    inline Data* find(const uint32_t pid, const uint64_t vpage) {
+                        const size_t idx = findSlot(pid, vpage);
+                        return idx == NOT_FOUND ? nullptr : &slots_[idx].data;
+                    }
+
+                    /**
+                     * Inserts a PTE. The page must not already be in the table.
+                     */
+                    void insert(const uint32_t pid, const uint64_t vpage, const Data& data) {
+                        size_t idx = hash_(pid, vpage) & mask_;
+                        while(slots_[idx].occupied) {
+                            idx = (idx + 1) & mask_;
+                        }
+
+                        auto& slot = slots_[idx];
+                        slot.vpage = vpage;
+                        slot.pid = pid;
+                        slot.occupied = true;
+                        slot.data = data;
+
+                        // Keep the load factor at or below 1/2
+                        if(STF_EXPECT_FALSE(++size_ * 2 > slots_.size())) {
+                            grow_();
+                        }
+                    }
+
+                    /**
+                     * Erases the PTE for the given page if it exists
+                     */
+                    void erase(const uint32_t pid, const uint64_t vpage) {
+                        size_t idx = findSlot(pid, vpage);
+                        if(idx == NOT_FOUND) {
+                            return;
+                        }
+
+                        // Shift later entries in the probe sequence back into the hole
+                        for(size_t next = (idx + 1) & mask_; slots_[next].occupied; next = (next + 1) & mask_) {
+                            const size_t home = hash_(slots_[next].pid, slots_[next].vpage) & mask_;
+                            if(((next - home) & mask_) >= ((next - idx) & mask_)) {
+                                slots_[idx] = std::move(slots_[next]);
+                                idx = next;
+                            }
+                        }
+
+                        slots_[idx] = Slot();
+                        --size_;
+                    }
+
+                    /**
+                     * Calls func(pid, vpage, data) on every PTE
+                     */
+                    template<typename FuncType>
+                    void forEach(FuncType&& func) {
+                        for(auto& slot: slots_) {
+                            if(slot.occupied) {
+                                func(slot.pid, slot.vpage, slot.data);
+                            }
+                        }
+                    }
+            };
 
             /**
-             * \typedef PSizes
-             * Tracks page sizes
+             * \struct TLBEntry
+             *
+             * Caches the result of a page mask lookup for a single 4K page of a single PID
              */
-            using PSizes = std::set<uint64_t>;
+            struct TLBEntry {
+                uint64_t vpage = 0; /**< 4K-aligned virtual address */
+                uint32_t pid = 0; /**< PID */
+                bool valid = false; /**< Whether the entry holds a translation */
+                uint64_t mask = page_utils::INVALID_PAGE_SIZE; /**< Page mask returned by GetPageMask */
+                size_t slot = PTETable::NOT_FOUND; /**< PTETable slot holding the PTE for vaddr & ~mask */
+            };
 
             /**
              * \typedef PIDPageSizes
-             * Tracks per-PID page sizes
+             * Tracks per-PID page sizes. Page sizes are powers of 2, so each PID's sizes are stored as the bitwise
+             * OR of all of its page sizes.
              */
-            using PIDPageSizes = std::unordered_map<uint32_t, PSizes>;
+            using PIDPageSizes = std::unordered_map<uint32_t, uint64_t>;
+
+            static constexpr uint64_t PAGE4K_MASK_ = 0X0000000000000FFFULL;
+            static constexpr uint64_t PAGE2M_MASK_ = 0X00000000001FFFFFULL;
+            static constexpr uint64_t PAGE1G_MASK_ = 0X000000003FFFFFFFULL;
+            static constexpr size_t TLB_SIZE_ = 16; /**< Number of entries in the translation cache. Must be a power of 2. */
+            static constexpr uint64_t MAX_OVERLAP_PROBES_ = 64; /**< Maximum number of candidate pages probed when checking for overlaps */
 
             std::shared_ptr<STFWriter> writer_; /**< STFWriter, may be nullptr if writing is not enabled */
             std::shared_ptr<STFWriter> pte_writer_; /**< PTE-only STFWriter, may be nullptr if writing is not enabled */
             const bool ignore_pid_mismatch_; /**< Whether PID mismatches should be ignored */
 
-            PIDPTEs ptemap_; /**< Maps PIDs to PTEs */
+            PTETable ptemap_; /**< Maps PIDs and virtual pages to PTEs */
             PIDPageSizes page_sizes_; /**< Maps PIDs to page sizes */
+            std::array<TLBEntry, TLB_SIZE_> tlb_; /**< Caches the most recent page mask lookups */
 
             /**
-             * \class PTENotFoundException
-             * Used to inform callers of checkPTE_ if a PTE was not found
+             * Invalidates the translation cache. Must be called whenever a PTE is inserted or erased.
              */
-            class PTENotFoundException : public std::exception {
-            };
+            inline void flushTLB_() {
+                tlb_.fill(TLBEntry());
+            }
+
+            /**
+             * Gets the translation cache entry for the 4K page containing vaddr, filling it if it isn't cached
+             *
+             * \param pid PID
+             * \param vaddr Virtual address
+             */
+            const TLBEntry& lookupTLB_(const uint32_t pid, const uint64_t vaddr) {
+                const uint64_t vpage = vaddr & ~PAGE4K_MASK_;
+                auto& entry = tlb_[static_cast<size_t>((vpage >> 12) ^ pid) & (TLB_SIZE_ - 1)];
+
+                if(STF_EXPECT_TRUE(entry.valid && entry.vpage == vpage && entry.pid == pid)) {
+                    return entry;
+                }
+
+                // The lookup result only depends on which 4K page vaddr is in
+                entry.vpage = vpage;
+                entry.pid = pid;
+                entry.valid = true;
+                entry.mask = page_utils::INVALID_PAGE_SIZE;
+                entry.slot = PTETable::NOT_FOUND;
+
+                for(const auto mask: {PAGE4K_MASK_, PAGE2M_MASK_, PAGE1G_MASK_}) {
+                    const size_t slot = ptemap_.findSlot(pid, vaddr & ~mask);
+                    if(slot != PTETable::NOT_FOUND) {
+                        entry.mask = mask;
+                        entry.slot = slot;
+                        break;
+                    }
+                }
+
+                return entry;
+            }
+
+            /**
+             * Removes every PTE for the given PID that overlaps the page [vpage, vpage + page_size)
+             *
+             * \param pid PID
+             * \param vpage Virtual page address
+             * \param page_size Page size
+             * \param pid_page_sizes Page sizes used by the PID
+             */
+            void removeOverlappingPTEs_(const uint32_t pid, const uint64_t vpage, const uint64_t page_size, const uint64_t pid_page_sizes) {
+                const uint64_t vpage_end = vpage + page_size;
+
+                // An existing page of size S overlaps the new page only if it starts on an S-aligned address in
+                // [vpage & ~(S - 1), vpage_end). If there aren't too many of those, probe them directly.
+                uint64_t num_probes = 0;
+                for(uint64_t sizes = pid_page_sizes; sizes; sizes &= sizes - 1) {
+                    const uint64_t size = sizes & -sizes;
+                    num_probes += (vpage_end - (vpage & ~(size - 1)) + size - 1) / size;
+                }
+
+                const auto overlaps = [vpage, vpage_end](const uint64_t evpage, const Data& d) {
+                    return (vpage_end > evpage) && ((evpage + d.walk_info_->getPageSize()) > vpage);
+                };
+
+                if(num_probes <= MAX_OVERLAP_PROBES_) {
+                    for(uint64_t sizes = pid_page_sizes; sizes; sizes &= sizes - 1) {
+                        const uint64_t size = sizes & -sizes;
+                        for(uint64_t evpage = vpage & ~(size - 1); evpage < vpage_end; evpage += size) {
+                            const Data* const d = ptemap_.find(pid, evpage);
+                            if(d && overlaps(evpage, *d)) {
+                                ptemap_.erase(pid, evpage);
+                            }
+                        }
+                    }
+                }
+                else {
+                    std::vector<uint64_t> keys;
+                    ptemap_.forEach([pid, &keys, &overlaps](const uint32_t epid, const uint64_t evpage, const Data& d) {
+                        if(epid == pid && overlaps(evpage, d)) {
+                            keys.push_back(evpage);
+                        }
+                    });
+
+                    for (const auto& key : keys) {
+                        ptemap_.erase(pid, key);
+                    }
+                }
+            }
 
             /**
-             * Checks whether a given PTE already exists, and marks it used if it is - throws a PTENotFoundException if it was not
+             * Checks whether a given PTE already exists, and marks it used if it is
              *
              * \param pid PID
              * \param vaddr Virtual address
              * \param paddr Physical address
              * \param page_size Page size
+             * \param result Set to the physical address, or INVALID_PHYS_ADDR if the PTE maps vaddr to a different page
+             * \returns false if the PTE was not found
              */
-            uint64_t checkPTE_(uint32_t pid, uint64_t vaddr, uint64_t paddr, uint64_t page_size) {
+            bool checkPTE_(uint32_t pid, uint64_t vaddr, uint64_t paddr, uint64_t page_size, uint64_t& result) {
                 const uint64_t page_mask = page_size - 1;
                 const uint64_t vpage = vaddr & ~page_mask;
-                try {
-                    Data &d = ptemap_.at(pid).at(vpage);
-                    if (!d.used) {
-                        d.used = true;
-                        if (writer_) {
-                            *writer_ << *d.walk_info_;
-                        }
-                        if (pte_writer_) {
-                            *pte_writer_ << *d.walk_info_;
-                        }
+                Data* const d = ptemap_.find(pid, vpage);
+                if(!d) {
+                    return false;
+                }
+
+                if (!d->used) {
+                    d->used = true;
+                    if (writer_) {
+                        *writer_ << *d->walk_info_;
                     }
-                    if (d.walk_info_->getPhysicalPageAddr() == (paddr & ~page_mask)) {
-                        return d.walk_info_->getPhysicalPageAddr() | (vaddr & page_mask);
+                    if (pte_writer_) {
+                        *pte_writer_ << *d->walk_info_;
                     }
-                    return page_utils::INVALID_PHYS_ADDR;
                 }
-                catch(const std::out_of_range&) {
-                    throw PTENotFoundException();
+                if (d->walk_info_->getPhysicalPageAddr() == (paddr & ~page_mask)) {
+                    result = d->walk_info_->getPhysicalPageAddr() | (vaddr & page_mask);
                 }
+                else {
+                    result = page_utils::INVALID_PHYS_ADDR;
+                }
+                return true;
+            }
+
+            /**
+             * Tries every page size used by a PID to find the PTE for vaddr
+             * \returns false if no PTE was found
+             */
+            bool checkPIDPTEs_(uint32_t pid, uint64_t vaddr, uint64_t paddr, uint64_t& result) {
+                const auto it = page_sizes_.find(pid);
+                if(it == page_sizes_.end()) {
+                    return false;
+                }
+
+                // Smallest page size first
+                for(uint64_t sizes = it->second; sizes; sizes &= sizes - 1) {
+                    if(checkPTE_(pid, vaddr, paddr, sizes & -sizes, result)) {
+                        return true;
+                    }
+                }
+
+                return false;
             }
 
         public:
@@ -161,43 +403,35 @@ namespace stf {
                 stf_assert((walk_info->getPhysicalPageAddr() & page_size_mask) == 0,
                            "Physical page address is not page-aligned: " << std::hex << walk_info->getPhysicalPageAddr());
 
-                uint32_t ppid = pid;
-                page_sizes_[ppid].insert(walk_info->getPageSize());
+                const uint64_t page_size = walk_info->getPageSize();
+                stf_assert(page_size && !(page_size & page_size_mask),
+                           "Page size is not a power of 2: " << std::hex << page_size);
 
-                if (ptemap_.find(ppid) != ptemap_.end()) {
-                    if (ptemap_.at(ppid).find(walk_info->getVA()) != ptemap_.at(ppid).end()) {
-                        Data &d = ptemap_.at(ppid).at(walk_info->getVA());
+                auto& pid_page_sizes = page_sizes_[pid];
+                const uint64_t prev_page_sizes = pid_page_sizes;
+                pid_page_sizes |= page_size;
 
-                        if(d.walk_info_) {
-                            // same vpage different attributes
-                            if ((d.pid != pid) || (*d.walk_info_ != *walk_info)) {
+                if (Data* const d = ptemap_.find(pid, walk_info->getVA())) {
+                    if(d->walk_info_) {
+                        // same vpage different attributes
+                        if ((d->pid != pid) || (*d->walk_info_ != *walk_info)) {
 
-                                d.pid = pid;
-                                d.walk_info_ = walk_info;
-                                d.used = false;
-                            }
+                            d->pid = pid;
+                            d->walk_info_ = walk_info;
+                            d->used = false;
                         }
-
-                        return d.used;
                     }
 
-                    // check overlappings only when vpage is not found in ptemap_
-                    std::vector<uint64_t> keys;
-                    for (const auto& it : ptemap_.at(ppid)) {
-                        const uint64_t evpage = it.first;
-                        const uint64_t epsize = it.second.walk_info_->getPageSize();
-
-                        if (((walk_info->getVA() + walk_info->getPageSize()) > evpage) && ((evpage + epsize) > walk_info->getVA())) {
-                            keys.push_back(it.first);
-                        }
-                    }
+                    return d->used;
+                }
 
-                    for (const auto& key : keys) {
-                        ptemap_.at(ppid).erase(key);
-                    }
+                // check overlappings only when vpage is not found in ptemap_
+                if (prev_page_sizes) {
+                    removeOverlappingPTEs_(pid, walk_info->getVA(), page_size, prev_page_sizes);
                 }
 
-                ptemap_[ppid].emplace(walk_info->getVA(), Data(pid, walk_info, false));
+                ptemap_.insert(pid, walk_info->getVA(), Data(pid, walk_info, false));
+                flushTLB_();
 
                 return false;
             }
@@ -209,38 +443,16 @@ namespace stf {
              * \param vaddr Virtual address
              */
             uint64_t GetPageMask(uint32_t pid, uint64_t vaddr) {
-                static constexpr uint64_t PAGE4K_MASK = 0X0000000000000FFFULL;
-                static constexpr uint64_t PAGE2M_MASK = 0X00000000001FFFFFULL;
-                static constexpr uint64_t PAGE1G_MASK = 0X000000003FFFFFFFULL;
-
-                try {
-                    uint64_t mask = PAGE4K_MASK;
-                    const auto& ptemap = ptemap_.at(pid);
-                    if(ptemap.find(vaddr & ~mask) == ptemap.end()) {
-                        mask = PAGE2M_MASK;
-                        if(ptemap.find(vaddr & ~mask) == ptemap.end()) {
-                            mask = PAGE1G_MASK;
-                            if(ptemap.find(vaddr & ~mask) == ptemap.end()) {
-                                return page_utils::INVALID_PAGE_SIZE;
-                            }
-                        }
-                    }
-                    return mask;
-                }
-                catch(const std::out_of_range&) {
-                }
-                return page_utils::INVALID_PAGE_SIZE;
+                return lookupTLB_(pid, vaddr).mask;
             }
 
             /**
              * Marks all pages as unused
              */
             void ResetUsage() {
-                for(auto &pid : ptemap_) {
-                    for(auto &vpage : pid.second) {
-                        vpage.second.used = false;
-                    }
-                }
+                ptemap_.forEach([](const uint32_t, const uint64_t, Data& d) {
+                    d.used = false;
+                });
             }
 
             /**
@@ -252,27 +464,20 @@ namespace stf {
              * \returns The physical page address if the PTE exists, otherwise INVALID_PHYS_ADDR
              */
             uint64_t MarkPTE(uint32_t pid, uint64_t vaddr, uint64_t paddr) {
-                for (const auto& page_size: page_sizes_[pid]) {
-                    try {
-                        return checkPTE_(pid, vaddr, paddr, page_size);
-                    }
-                    catch(const PTENotFoundException&) {
-                    }
+                uint64_t result;
+                if (checkPIDPTEs_(pid, vaddr, paddr, result)) {
+                    return result;
                 }
 
                 if (ignore_pid_mismatch_) {
                     // try other PIDs' memory spaces
-                    for (const auto& a: ptemap_) {
+                    for (const auto& a: page_sizes_) {
                         uint32_t ppid = a.first;
                         if (ppid == pid) {
                             continue;
                         }
-                        for (const auto& page_size: page_sizes_[ppid]) {
-                            try {
-                                return checkPTE_(ppid, vaddr, paddr, page_size);
-                            }
-                            catch(const PTENotFoundException&) {
-                            }
+                        if (checkPIDPTEs_(ppid, vaddr, paddr, result)) {
+                            return result;
                         }
                     }
                     std::cerr << "ERROR: Expected PTE entry 'PTE ";
@@ -309,12 +514,10 @@ namespace stf {
                     return pte_count;
                 }
 
-                for (const auto &pid : ptemap_) {
-                    for (const auto &pte : pid.second) {
-                        stf_writer << *pte.second.walk_info_;
-                        ++pte_count;
-                    }
-                }
+                ptemap_.forEach([&stf_writer, &pte_count](const uint32_t, const uint64_t, const Data& d) {
+                    stf_writer << *d.walk_info_;
+                    ++pte_count;
+                });
 
                 return pte_count;
             }
@@ -338,38 +541,34 @@ namespace stf {
                     return false;
                 }
 
-                uint64_t mask = GetPageMask(pid, vaddr);
+                const auto& tlb_entry = lookupTLB_(pid, vaddr);
+                const uint64_t mask = tlb_entry.mask;
                 if(mask != page_utils::INVALID_PAGE_SIZE) {
-                    try {
-                        Data &pte = ptemap_.at(pid).at(vaddr & ~mask);
-                        if(!pte.used) {
-                            PageTableWalkRecord new_rec = *pte.walk_info_;
-                            new_rec.setFirstAccessIndex(inst_offset + 1);
-                            stf_writer << new_rec;
-                            pte.used = true;
-                            retval = true;
-                        }
+                    Data &pte = ptemap_.getSlot(tlb_entry.slot);
+                    if(!pte.used) {
+                        PageTableWalkRecord new_rec = *pte.walk_info_;
+                        new_rec.setFirstAccessIndex(inst_offset + 1);
+                        stf_writer << new_rec;
+                        pte.used = true;
+                        retval = true;
+                    }
 
-                        if (!size) {
-                            return retval;
-                        }
+                    if (!size) {
+                        return retval;
+                    }
 
-                        //Check for page crossing
-                        if(((vaddr + size - 1) & ~mask) != (vaddr & ~mask)) {
-                            uint64_t nextPageVaddr = (vaddr + size - 1) & ~mask;
-                            Data &pte2 = ptemap_.at(pid).at(nextPageVaddr);
-                            if(!pte2.used) {
-                                PageTableWalkRecord new_rec2 = *pte2.walk_info_;
-                                new_rec2.setFirstAccessIndex(inst_offset + 1);
-                                stf_writer << new_rec2;
-                                pte2.used = true;
-                                retval = true;
-                            }
+                    //Check for page crossing
+                    if(((vaddr + size - 1) & ~mask) != (vaddr & ~mask)) {
+                        uint64_t nextPageVaddr = (vaddr + size - 1) & ~mask;
+                        Data* const pte2 = ptemap_.find(pid, nextPageVaddr);
+                        if(pte2 && !pte2->used) {
+                            PageTableWalkRecord new_rec2 = *pte2->walk_info_;
+                            new_rec2.setFirstAccessIndex(inst_offset + 1);
+                            stf_writer << new_rec2;
+                            pte2->used = true;
+                            retval = true;
                         }
                     }
-                    catch(const std::out_of_range&)
-                    {
-                    }
                 }
 
                 return retval;
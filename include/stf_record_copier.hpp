@@ -0,0 +1,122 @@
+#pragma once
+
+#include <cstddef>
+#include <exception>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "stf_exception.hpp"
+#include "stf_reader.hpp"
+#include "stf_record_types.hpp"
+#include "stf_writer.hpp"
+#include "thread_pool.hpp"
+
+namespace trace_tools {
+    /**
+     * \class STFRecordCopier
+     *
+     * Copies every remaining record from an STFReader to an STFWriter. Used by tools that rewrite a trace
+     * with a modified header (stf_recompress, stf_disable_feature, stf_trace_info). Every record is decoded
+     * and re-encoded.
+     *
+     * In pipelined mode the input is read and decoded on a separate thread, which hands batches of records
+     * to the calling thread to be encoded and compressed. The output is identical either way.
+     */
+    class STFRecordCopier {
+        public:
+            static constexpr size_t RECORD_BATCH_SIZE = 4096; /**< Number of records handed from the reader thread to the writer at a time */
+            static constexpr size_t MAX_PENDING_BATCHES = 64; /**< Maximum number of batches waiting to be written */
+
+        private:
+            using RecordBatch_ = std::vector<stf::STFRecord::UniqueHandle>;
+            using RecordBatchQueue_ = BoundedQueue<RecordBatch_>;
+
+            static void copySerial_(stf::STFReader& reader, stf::STFWriter& writer) {
+                try {
+                    stf::STFRecord::UniqueHandle r;
+                    while(reader) {
+                        reader >> r;
+                        writer << *r;
+                    }
+                }
+                catch(const stf::EOFException&) {
+                }
+            }
+
+            static void copyPipelined_(stf::STFReader& reader, stf::STFWriter& writer) {
+                RecordBatchQueue_ queue(MAX_PENDING_BATCHES);
+                std::exception_ptr reader_exception;
+
+                std::thread reader_thread([&reader, &queue, &reader_exception]() {
+                    try {
+                        RecordBatch_ batch;
+                        batch.reserve(RECORD_BATCH_SIZE);
+
+                        try {
+                            stf::STFRecord::UniqueHandle r;
+                            while(reader) {
+                                reader >> r;
+                                batch.emplace_back(std::move(r));
+                                if(STF_EXPECT_FALSE(batch.size() == RECORD_BATCH_SIZE)) {
+                                    queue.push(std::move(batch));
+                                    batch = RecordBatch_();
+                                    batch.reserve(RECORD_BATCH_SIZE);
+                                }
+                            }
+                        }
+                        catch(const stf::EOFException&) {
+                        }
+
+                        if(!batch.empty()) {
+                            queue.push(std::move(batch));
+                        }
+                    }
+                    catch(const RecordBatchQueue_::AbortedException&) {
+                        // The writer failed and will report its own exception
+                    }
+                    catch(...) {
+                        reader_exception = std::current_exception();
+                    }
+
+                    queue.close();
+                });
+
+                try {
+                    RecordBatch_ batch;
+                    while(queue.pop(batch)) {
+                        for(const auto& r: batch) {
+                            writer << *r;
+                        }
+                    }
+                }
+                catch(...) {
+                    queue.abort();
+                    reader_thread.join();
+                    throw;
+                }
+
+                reader_thread.join();
+
+                if(reader_exception) {
+                    std::rethrow_exception(reader_exception);
+                }
+            }
+
+        public:
+            /**
+             * Copies every remaining record from reader to writer. The writer's header must already be finalized.
+             * \param reader Reader to copy from
+             * \param writer Writer to copy to
+             * \param pipelined If true, read the input on a separate thread
+             */
+            static void copy(stf::STFReader& reader, stf::STFWriter& writer, const bool pipelined) {
+                if(pipelined) {
+                    copyPipelined_(reader, writer);
+                }
+                else {
+                    copySerial_(reader, writer);
+                }
+            }
+    };
+} // end namespace trace_tools
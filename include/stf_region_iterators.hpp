@@ -179,12 +179,21 @@ namespace stf {
             }
     };
 
+    /**
+     * Gets an iterator to the instruction skip_count instructions into the trace.
+     * Plain instruction iterators seek through the trace chunk index, so only a single chunk has to be decoded.
+     */
     template<typename IteratorType, typename... IteratorArgs>
     std::enable_if_t<std::is_same_v<IteratorType, STFInstReader::iterator>, STFInstReader::iterator>
     getStartIterator(STFInstReader& reader, const size_t skip_count, IteratorArgs&&...) {
         return reader.begin(skip_count);
     }
 
+    /**
+     * Gets a region iterator to the instruction skip_count instructions into the region of interest.
+     * Finding the region requires looking at every instruction from the start of the trace, so region
+     * iterators can't use the chunk index and advance one instruction at a time.
+     */
     template<typename IteratorType, typename... IteratorArgs>
     std::enable_if_t<std::is_base_of_v<STFRegionIterator<IteratorType>, IteratorType>, IteratorType>
     getStartIterator(STFInstReader& reader, const size_t skip_count, IteratorArgs&&... args) {
@@ -1,7 +1,13 @@
 #pragma once
 
-#include <map>
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <iterator>
+#include <limits>
 #include <memory>
+#include <numeric>
+#include <set>
 #include <string>
 #include <unordered_map>
 #include <vector>
@@ -10,8 +16,12 @@
 
 #include "stf_dwarf.hpp"
 #include "stf_elf.hpp"
+#include "stf_symbol_table_cache.hpp"
+#include "thread_pool.hpp"
 
 class STFSymbol {
+    friend class STFSymbolTable; // Needed to rebuild symbols from the symbol table cache
+
     private:
         const bool valid_ = true;
         const bool inlined_ = false;
@@ -189,19 +199,63 @@ class STFSymbol {
 
 class STFSymbolTable {
     private:
-        std::multimap<STFAddressRange, STFSymbol::Handle> symbols_;
+        static constexpr size_t NO_SYMBOL_ = std::numeric_limits<size_t>::max();
+        static constexpr size_t PC_MEMO_SIZE_ = 4096; // Must be a power of 2
+        static constexpr uint64_t INVALID_PC_ = std::numeric_limits<uint64_t>::max();
+
+        /**
+         * \struct Segment_
+         * Address segment in which the innermost containing symbol range does not change
+         */
+        struct Segment_ {
+            uint64_t range_start = 0; // Start address of the innermost symbol range covering this segment
+            size_t symbol_idx = NO_SYMBOL_; // Index of the innermost symbol covering this segment
+        };
+
+        /**
+         * \struct CachedSymbol_
+         * Symbol as it is stored in the symbol table cache. The name and ranges are stored in separate arrays.
+         */
+        struct CachedSymbol_ {
+            uint64_t name_offset = 0;
+            uint64_t name_size = 0;
+            uint64_t first_range = 0;
+            uint32_t num_ranges = 0;
+            uint32_t inlined = 0;
+        };
+
+        /**
+         * \struct CachedRange_
+         * Address range as it is stored in the symbol table cache
+         */
+        struct CachedRange_ {
+            uint64_t start = 0;
+            uint64_t end = 0;
+        };
+
+        /**
+         * \struct PCMemoEntry_
+         * Caches the segment found for a PC
+         */
+        struct PCMemoEntry_ {
+            uint64_t pc = INVALID_PC_;
+            size_t segment_idx = 0;
+        };
+
+        std::vector<STFSymbol::Handle> symbols_;
+        // Flattened interval index. Segment i covers [segment_starts_[i], segment_starts_[i + 1]).
+        std::vector<uint64_t> segment_starts_;
+        std::vector<Segment_> segments_;
+        mutable std::array<PCMemoEntry_, PC_MEMO_SIZE_> pc_memo_;
         uint64_t elf_min_address_ = 0;
         uint64_t elf_max_address_ = 0;
 
         template<typename... Args>
-        inline bool emplaceSymbol_(Args&&... args) {
+        static inline bool appendSymbol_(std::vector<STFSymbol::Handle>& symbols, Args&&... args) {
             auto new_symbol = std::make_shared<STFSymbol>(std::forward<Args>(args)...);
 
             if(*new_symbol) {
-                for(const auto& p: new_symbol->getRanges()) {
-                    symbols_.emplace(p, new_symbol);
-                }
-
+                symbols.emplace_back(std::move(new_symbol));
                 return true;
             }
 
@@ -209,30 +263,331 @@ class STFSymbolTable {
         }
 
         template<typename... Args>
-        inline void emplaceSymbolFromDwarf_(const dwarf_wrapper::Die& die, Args&&... args) {
-            if(!emplaceSymbol_(die, std::forward<Args>(args)...)) {
-                auto ranges = die.getRanges();
-                if(!ranges.empty()) {
-                    std::sort(ranges.begin(), ranges.end());
-                    stf_assert(emplaceSymbol_(die, std::forward<Args>(args)..., std::move(ranges)),
-                               "Failed to create symbol");
-                }
+        inline bool emplaceSymbol_(Args&&... args) {
+            return appendSymbol_(symbols_, std::forward<Args>(args)...);
+        }
+
+        /**
+         * Adds a symbol for a subprogram or inlined subroutine DIE
+         * \param symbols Symbol list to append to
+         * \param die DIE to add
+         * \param range_buffer Scratch buffer used to read the DIE's address ranges
+         */
+        static inline void emplaceSymbolFromDwarf_(std::vector<STFSymbol::Handle>& symbols,
+                                                   const dwarf_wrapper::Die& die,
+                                                   std::vector<STFAddressRange>& range_buffer) {
+            // Most subprogram DIEs are declarations without any code, so don't bother demangling their names
+            // or allocating a symbol unless the DIE has an address range
+            if(die.getLowPC() && appendSymbol_(symbols, die)) {
+                return;
+            }
+
+            die.getRanges(range_buffer);
+            if(!range_buffer.empty()) {
+                std::sort(range_buffer.begin(), range_buffer.end());
+                stf_assert(appendSymbol_(symbols, die, std::vector<STFAddressRange>(range_buffer)),
+                           "Failed to create symbol");
             }
         }
 
-    public:
-        explicit STFSymbolTable(const STFElf& elf) {
-            // Try to populate with DWARF info first
-            try {
-                STFDwarf dwarf(elf.getFilename());
+        static inline bool isFunctionDie_(const dwarf_wrapper::Die& die) {
+            return die.isSubprogram() || die.isInlinedSubroutine();
+        }
+
+        /**
+         * Loads symbols for every subprogram and inlined subroutine in the DWARF info.
+         *
+         * With more than 1 thread, the compilation units are parsed in parallel. libdwarf handles can't be shared
+         * between threads, so each worker opens the ELF with its own STFDwarf. Every compilation unit gets its own
+         * symbol list, and the lists are appended in compilation unit order, so the result is identical to a
+         * serial load.
+         *
+         * \param filename ELF to load
+         * \param num_threads Number of threads to use. 0 uses all available hardware threads.
+         */
+        inline void loadDwarf_(const std::string& filename, const size_t num_threads) {
+            STFDwarf dwarf(filename);
 
-                dwarf.iterateDies(
-                    [this](const std::shared_ptr<dwarf_wrapper::Die>& die) {
-                        if(die->isSubprogram() || die->isInlinedSubroutine()) {
-                            emplaceSymbolFromDwarf_(*die);
+            if(num_threads == 1) {
+                std::vector<STFAddressRange> range_buffer;
+
+                dwarf.visitDies(
+                    [this, &range_buffer](const dwarf_wrapper::Die& die) {
+                        if(isFunctionDie_(die)) {
+                            emplaceSymbolFromDwarf_(symbols_, die, range_buffer);
                         }
                     }
                 );
+                return;
+            }
+
+            /**
+             * \struct Worker
+             * Per-worker DWARF handle and scratch space
+             */
+            struct Worker {
+                std::unique_ptr<STFDwarf> own_dwarf;
+                STFDwarf* dwarf = nullptr;
+                std::vector<STFAddressRange> range_buffer;
+            };
+
+            const auto cu_offsets = dwarf.getCuOffsets();
+            const size_t num_workers = std::min(trace_tools::getNumWorkerThreads(num_threads), cu_offsets.size());
+            std::vector<Worker> workers(num_workers);
+            std::vector<std::vector<STFSymbol::Handle>> cu_symbols(cu_offsets.size());
+
+            // Worker 0 reuses the handle that enumerated the compilation units. The rest open their own on first use.
+            if(!workers.empty()) {
+                workers.front().dwarf = &dwarf;
+            }
+
+            trace_tools::parallelFor(cu_offsets.size(), num_workers,
+                [&filename, &cu_offsets, &workers, &cu_symbols](const size_t cu_idx, const size_t worker_idx) {
+                    auto& worker = workers[worker_idx];
+                    if(STF_EXPECT_FALSE(!worker.dwarf)) {
+                        worker.own_dwarf = std::make_unique<STFDwarf>(filename);
+                        worker.dwarf = worker.own_dwarf.get();
+                    }
+
+                    auto& symbols = cu_symbols[cu_idx];
+                    worker.dwarf->visitCuDies(
+                        cu_offsets[cu_idx],
+                        [&symbols, &worker](const dwarf_wrapper::Die& die) {
+                            if(isFunctionDie_(die)) {
+                                emplaceSymbolFromDwarf_(symbols, die, worker.range_buffer);
+                            }
+                        }
+                    );
+                }
+            );
+
+            const size_t num_symbols = std::accumulate(cu_symbols.begin(),
+                                                       cu_symbols.end(),
+                                                       symbols_.size(),
+                                                       [](const size_t total, const auto& symbols) {
+                                                           return total + symbols.size();
+                                                       });
+            symbols_.reserve(num_symbols);
+
+            for(auto& symbols: cu_symbols) {
+                std::move(symbols.begin(), symbols.end(), std::back_inserter(symbols_));
+            }
+        }
+
+        /**
+         * Splits the address space into segments at every symbol range boundary and records the innermost
+         * (smallest) range covering each segment. If several ranges of the same size cover a segment, the
+         * range that was loaded last wins, so ELF symbols take priority over DWARF symbols with the same range.
+         */
+        inline void buildIndex_() {
+            struct SymbolRange {
+                uint64_t start;
+                uint64_t end;
+                size_t symbol_idx;
+            };
+
+            std::vector<SymbolRange> ranges;
+            for(size_t i = 0; i < symbols_.size(); ++i) {
+                for(const auto& range: symbols_[i]->getRanges()) {
+                    ranges.emplace_back(SymbolRange{range.startAddress(), range.endAddress(), i});
+                }
+            }
+
+            std::vector<size_t> by_start(ranges.size());
+            std::iota(by_start.begin(), by_start.end(), 0);
+            std::vector<size_t> by_end(by_start);
+            std::sort(by_start.begin(),
+                      by_start.end(),
+                      [&ranges](const size_t lhs, const size_t rhs) { return ranges[lhs].start < ranges[rhs].start; });
+            std::sort(by_end.begin(),
+                      by_end.end(),
+                      [&ranges](const size_t lhs, const size_t rhs) { return ranges[lhs].end < ranges[rhs].end; });
+
+            // Ranges covering the current segment, innermost first
+            const auto innermost_first = [&ranges](const size_t lhs, const size_t rhs) {
+                const uint64_t lhs_size = ranges[lhs].end - ranges[lhs].start;
+                const uint64_t rhs_size = ranges[rhs].end - ranges[rhs].start;
+                return lhs_size < rhs_size || (lhs_size == rhs_size && lhs > rhs);
+            };
+            std::set<size_t, decltype(innermost_first)> active(innermost_first);
+            auto start_it = by_start.begin();
+            auto end_it = by_end.begin();
+            size_t cur_range = NO_SYMBOL_;
+
+            while(start_it != by_start.end() || end_it != by_end.end()) {
+                uint64_t address = std::numeric_limits<uint64_t>::max();
+                if(start_it != by_start.end()) {
+                    address = ranges[*start_it].start;
+                }
+                if(end_it != by_end.end()) {
+                    address = std::min(address, ranges[*end_it].end);
+                }
+
+                for(; end_it != by_end.end() && ranges[*end_it].end == address; ++end_it) {
+                    active.erase(*end_it);
+                }
+
+                for(; start_it != by_start.end() && ranges[*start_it].start == address; ++start_it) {
+                    active.emplace(*start_it);
+                }
+
+                const size_t innermost = active.empty() ? NO_SYMBOL_ : *active.begin();
+
+                // Adjacent segments covered by the same range are combined
+                if(innermost != cur_range) {
+                    cur_range = innermost;
+                    segment_starts_.emplace_back(address);
+                    if(innermost == NO_SYMBOL_) {
+                        segments_.emplace_back();
+                    }
+                    else {
+                        segments_.emplace_back(Segment_{ranges[innermost].start, ranges[innermost].symbol_idx});
+                    }
+                }
+            }
+
+            segment_starts_.shrink_to_fit();
+            segments_.shrink_to_fit();
+        }
+
+        inline size_t findSegment_(const uint64_t address) const {
+            auto& memo = pc_memo_[(address >> 1) & (PC_MEMO_SIZE_ - 1)];
+
+            if(STF_EXPECT_TRUE(memo.pc == address)) {
+                return memo.segment_idx;
+            }
+
+            const auto it = std::upper_bound(segment_starts_.begin(), segment_starts_.end(), address);
+            const size_t segment_idx = it == segment_starts_.begin() ?
+                                       segments_.size() :
+                                       static_cast<size_t>(std::distance(segment_starts_.begin(), it)) - 1;
+
+            memo.pc = address;
+            memo.segment_idx = segment_idx;
+
+            return segment_idx;
+        }
+
+        /**
+         * Loads the symbol table from a cache file. Returns false and leaves the table empty if there is no
+         * valid cache file for the ELF.
+         */
+        inline bool loadCache_(const STFSymbolTableCache& cache) {
+            STFSymbolTableCache::Reader reader;
+            if(!cache.open(reader)) {
+                return false;
+            }
+
+            std::array<uint64_t, 4> counts;
+            std::vector<CachedSymbol_> cached_symbols;
+            std::vector<CachedRange_> cached_ranges;
+            const char* names = nullptr;
+
+            if(!(reader.read(elf_min_address_) &&
+                 reader.read(elf_max_address_) &&
+                 reader.read(counts) &&
+                 reader.readVector(cached_symbols, counts[0]) &&
+                 reader.readVector(cached_ranges, counts[1]) &&
+                 (names = reader.readArray<char>(counts[2])) &&
+                 reader.readVector(segment_starts_, counts[3]) &&
+                 reader.readVector(segments_, counts[3]) &&
+                 reader.atEnd())) {
+                clear_();
+                return false;
+            }
+
+            const uint64_t names_size = counts[2];
+            symbols_.reserve(cached_symbols.size());
+            for(const auto& cached_symbol: cached_symbols) {
+                if(cached_symbol.name_offset > names_size ||
+                   cached_symbol.name_size > names_size - cached_symbol.name_offset ||
+                   cached_symbol.first_range > cached_ranges.size() ||
+                   cached_symbol.num_ranges > cached_ranges.size() - cached_symbol.first_range) {
+                    clear_();
+                    return false;
+                }
+
+                std::vector<STFAddressRange> ranges;
+                ranges.reserve(cached_symbol.num_ranges);
+                const auto first_range = std::next(cached_ranges.begin(), static_cast<std::ptrdiff_t>(cached_symbol.first_range));
+                for(auto it = first_range; it != std::next(first_range, cached_symbol.num_ranges); ++it) {
+                    if(it->start >= it->end) {
+                        clear_();
+                        return false;
+                    }
+                    ranges.emplace_back(it->start, it->end);
+                }
+
+                std::string name(names + cached_symbol.name_offset, cached_symbol.name_size);
+                STFSymbol::Handle symbol(new STFSymbol(std::move(name), std::move(ranges), cached_symbol.inlined != 0));
+                if(!*symbol) {
+                    clear_();
+                    return false;
+                }
+                symbols_.emplace_back(std::move(symbol));
+            }
+
+            if(std::any_of(segments_.begin(),
+                           segments_.end(),
+                           [this](const Segment_& segment) {
+                               return segment.symbol_idx != NO_SYMBOL_ && segment.symbol_idx >= symbols_.size();
+                           })) {
+                clear_();
+                return false;
+            }
+
+            return true;
+        }
+
+        /**
+         * Saves the symbol table to a cache file
+         */
+        inline void saveCache_(const STFSymbolTableCache& cache) const {
+            std::vector<CachedSymbol_> cached_symbols;
+            std::vector<CachedRange_> cached_ranges;
+            std::string names;
+
+            cached_symbols.reserve(symbols_.size());
+            for(const auto& symbol: symbols_) {
+                auto& cached_symbol = cached_symbols.emplace_back();
+                cached_symbol.name_offset = names.size();
+                cached_symbol.name_size = symbol->name().size();
+                cached_symbol.first_range = cached_ranges.size();
+                cached_symbol.num_ranges = static_cast<uint32_t>(symbol->getRanges().size());
+                cached_symbol.inlined = symbol->inlined();
+                names += symbol->name();
+
+                for(const auto& range: symbol->getRanges()) {
+                    cached_ranges.emplace_back(CachedRange_{range.startAddress(), range.endAddress()});
+                }
+            }
+
+            const std::array<uint64_t, 4> counts{cached_symbols.size(), cached_ranges.size(), names.size(), segments_.size()};
+
+            STFSymbolTableCache::Writer writer(cache);
+            writer.write(elf_min_address_);
+            writer.write(elf_max_address_);
+            writer.write(counts);
+            writer.writeVector(cached_symbols);
+            writer.writeVector(cached_ranges);
+            writer.writeArray(names.data(), names.size());
+            writer.writeVector(segment_starts_);
+            writer.writeVector(segments_);
+            writer.commit();
+        }
+
+        inline void clear_() {
+            symbols_.clear();
+            segment_starts_.clear();
+            segments_.clear();
+            elf_min_address_ = 0;
+            elf_max_address_ = 0;
+        }
+
+        inline void load_(const STFElf& elf, const size_t num_threads) {
+            // Try to populate with DWARF info first
+            try {
+                loadDwarf_(elf.getFilename(), num_threads);
             }
             catch(const dwarf_wrapper::NoDwarfInfoException&) {
             }
@@ -246,18 +601,44 @@ class STFSymbolTable {
                 if(STF_EXPECT_FALSE(section->get_type() == ELFIO::SHT_SYMTAB)) {
                     const ELFIO::symbol_section_accessor symbols(elf_reader, section);
                     for(unsigned int j = 0; j < symbols.get_symbols_num(); ++j) {
-                        auto new_symbol = std::make_shared<STFSymbol>(symbols, j);
-                        if(*new_symbol) {
-                            symbols_.emplace(new_symbol->getRanges().front(), std::move(new_symbol));
-                        }
+                        emplaceSymbol_(symbols, j);
                     }
                 }
             }
+
+            buildIndex_();
         }
 
-        explicit STFSymbolTable(const std::string& filename) :
-            STFSymbolTable(STFElf(filename))
-        {
+    public:
+        /**
+         * Constructs an STFSymbolTable from an already opened ELF
+         * \param elf ELF to load
+         * \param num_threads Number of threads used to load DWARF info. 0 uses all available hardware threads.
+         */
+        explicit STFSymbolTable(const STFElf& elf, const size_t num_threads = 1) {
+            load_(elf, num_threads);
+        }
+
+        /**
+         * Constructs an STFSymbolTable from an ELF file
+         * \param filename ELF to load
+         * \param use_cache If true, the symbol table is loaded from the on-disk cache when possible. If it has to be
+         * rebuilt from the ELF, the cache is updated.
+         * \param num_threads Number of threads used to load DWARF info. 0 uses all available hardware threads.
+         */
+        explicit STFSymbolTable(const std::string& filename, const bool use_cache = true, const size_t num_threads = 1) {
+            if(!use_cache) {
+                load_(STFElf(filename), num_threads);
+                return;
+            }
+
+            const STFSymbolTableCache cache(filename);
+            if(!loadCache_(cache)) {
+                load_(STFElf(filename), num_threads);
+                if(cache.enabled()) {
+                    saveCache_(cache);
+                }
+            }
         }
 
         inline bool validPC(const uint64_t pc) const {
@@ -265,41 +646,29 @@ class STFSymbolTable {
         }
 
         /**
-         * Finds the function containing the specified address
+         * Finds the innermost function containing the specified address. The second element of the
+         * returned pair is true if the address is the start of the matching function range.
+         *
+         * Recent lookups are memoized, so this method is not thread-safe.
          */
         inline std::pair<STFSymbol::Handle, bool> findFunction(const uint64_t address) const {
             if(!validPC(address)) {
                 return std::make_pair(nullptr, false);
             }
 
-            const STFAddressRange key(address);
-            auto it = symbols_.upper_bound(key);
+            const size_t segment_idx = findSegment_(address);
 
-            while(it != symbols_.begin() && (it == symbols_.end() || std::prev(it)->first.contains(key))) {
-                --it;
+            if(STF_EXPECT_FALSE(segment_idx >= segments_.size())) {
+                return std::make_pair(nullptr, false);
             }
 
-            if(!it->first.contains(key)) {
-                stf_assert(it->first.startsAfter(key));
-                bool found = false;
-                for(auto search_it = std::next(it); search_it != symbols_.end(); ++search_it) {
-                    if(search_it->first.contains(key)) {
-                        it = search_it;
-                        found = true;
-                        break;
-                    }
-                }
-
-                if(STF_EXPECT_FALSE(!found)) {
-                    return std::make_pair(nullptr, false);
-                }
-            }
+            const auto& segment = segments_[segment_idx];
 
-            if(it->second->checkPC(address)) {
-                return std::make_pair(it->second, it->first.startAddress() == address);
+            if(STF_EXPECT_FALSE(segment.symbol_idx == NO_SYMBOL_)) {
+                return std::make_pair(nullptr, false);
             }
 
-            return std::make_pair(nullptr, false);
+            return std::make_pair(symbols_[segment.symbol_idx], segment.range_start == address);
         }
 
         inline bool empty() const {
@@ -0,0 +1,151 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <system_error>
+
+#include "filesystem.hpp"
+#include "stf_cache_file.hpp"
+#include "stf_elf.hpp"
+
+/**
+ * \class STFSymbolTableCache
+ *
+ * Locates and validates on-disk symbol table cache files.
+ *
+ * A cache file is keyed by the ELF's GNU build-id, modification time and size. ELFs without a build-id
+ * are keyed by their canonical path instead. The cache lives in $STF_SYMBOL_CACHE_DIR if it is set,
+ * otherwise in $XDG_CACHE_HOME/stf_tools/symbols or ~/.cache/stf_tools/symbols. Setting
+ * STF_SYMBOL_CACHE_DIR to an empty string disables the cache.
+ *
+ * The file format is described in STFCacheFile. The layout of the arrays after the header is defined by STFSymbolTable.
+ */
+class STFSymbolTableCache {
+    public:
+        static constexpr uint32_t VERSION = 1; /**< Cache format version. Must be bumped whenever the layout changes. */
+
+    private:
+        static constexpr size_t MAX_BUILD_ID_SIZE_ = 64;
+        static constexpr std::array<char, 8> MAGIC_ = {'S', 'T', 'F', 'S', 'Y', 'M', 'C', '\0'};
+
+        /**
+         * \struct Header_
+         * Identifies the ELF a cache file was generated from. Two headers are compared bytewise.
+         */
+        struct Header_ {
+            std::array<char, 8> magic;
+            uint32_t version;
+            uint32_t build_id_size;
+            std::array<uint8_t, MAX_BUILD_ID_SIZE_> build_id;
+            int64_t mtime;
+            uint64_t file_size;
+            uint64_t path_hash;
+        };
+
+        static_assert(sizeof(Header_) % STFCacheFile::ALIGNMENT == 0, "Cache header must be padded to the cache alignment");
+
+        Header_ header_;
+        fs::path cache_path_;
+
+    public:
+        using Reader = STFCacheFile::Reader; /**< Reads arrays from a memory-mapped cache file */
+
+        /**
+         * \class Writer
+         * Writes arrays to a temporary file that replaces the cache file once it is complete
+         */
+        class Writer : public STFCacheFile::Writer {
+            public:
+                /**
+                 * Creates a new cache file for the specified cache and writes the cache header
+                 * \param cache Cache to write
+                 */
+                explicit Writer(const STFSymbolTableCache& cache) :
+                    STFCacheFile::Writer(cache.cache_path_)
+                {
+                    write(cache.header_);
+                }
+        };
+
+        /**
+         * Constructs an STFSymbolTableCache for the specified ELF
+         * \param elf_filename ELF file whose symbol table will be cached
+         * \param cache_dir Directory that holds cache files. An empty path disables the cache.
+         */
+        explicit STFSymbolTableCache(const std::string& elf_filename,
+                                     const fs::path& cache_dir = STFCacheFile::getDefaultCacheDir("STF_SYMBOL_CACHE_DIR", "symbols")) :
+            header_()
+        {
+            if(cache_dir.empty()) {
+                return;
+            }
+
+            std::error_code ec;
+            const auto mtime = fs::last_write_time(elf_filename, ec);
+            if(ec) {
+                return;
+            }
+
+            const auto file_size = fs::file_size(elf_filename, ec);
+            if(ec) {
+                return;
+            }
+
+            header_.magic = MAGIC_;
+            header_.version = VERSION;
+            header_.mtime = static_cast<int64_t>(mtime.time_since_epoch().count());
+            header_.file_size = static_cast<uint64_t>(file_size);
+
+            std::ostringstream cache_name;
+            cache_name << std::hex << std::setfill('0');
+
+            if(const auto build_id = STFElf::readBuildID(elf_filename);
+               !build_id.empty() && build_id.size() <= MAX_BUILD_ID_SIZE_) {
+                header_.build_id_size = static_cast<uint32_t>(build_id.size());
+                std::copy(build_id.begin(), build_id.end(), header_.build_id.begin());
+
+                for(const auto b: build_id) {
+                    cache_name << std::setw(2) << static_cast<uint32_t>(b);
+                }
+            }
+            else {
+                const auto canonical_path = fs::canonical(elf_filename, ec);
+                if(ec) {
+                    return;
+                }
+
+                header_.path_hash = std::hash<std::string>()(canonical_path.string());
+                cache_name << "path-" << std::setw(16) << header_.path_hash;
+            }
+
+            cache_name << ".symtab";
+            cache_path_ = cache_dir / cache_name.str();
+        }
+
+        /**
+         * Returns true if the cache can be used for this ELF
+         */
+        inline bool enabled() const {
+            return !cache_path_.empty();
+        }
+
+        /**
+         * Opens the cache file for reading
+         * \param reader Reader to open. It is positioned after the cache header.
+         * \returns true if a cache file exists and was generated from the same ELF
+         */
+        inline bool open(Reader& reader) const {
+            if(!enabled() || !reader.open(cache_path_)) {
+                return false;
+            }
+
+            const Header_* header = reader.readArray<Header_>(1);
+            return header && memcmp(header, &header_, sizeof(Header_)) == 0;
+        }
+};
@@ -0,0 +1,322 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace trace_tools {
+    /**
+     * Converts a user-requested thread count into the number of worker threads to launch.
+     * A value of 0 selects the number of hardware threads available on the machine.
+     *
+     * \param num_threads Requested number of threads
+     */
+    inline size_t getNumWorkerThreads(const size_t num_threads) {
+        if(num_threads != 0) {
+            return num_threads;
+        }
+
+        return std::max(static_cast<size_t>(std::thread::hardware_concurrency()), static_cast<size_t>(1));
+    }
+
+    /**
+     * Calls func(item_idx, worker_idx) for item_idx = 0, 1, 2, ... using up to num_threads worker threads
+     * until func reports that it has run past the end of the available work. Use this when the number of
+     * items is not known ahead of time.
+     *
+     * func must return false if item_idx was the last item (or was past the last item). Once that happens
+     * no items with a larger index are handed out, although items that were already handed out are still
+     * allowed to finish. worker_idx is always less than getNumWorkerThreads(num_threads).
+     *
+     * If any call throws, the remaining items are abandoned and the exception is rethrown on the calling
+     * thread once every worker has stopped.
+     *
+     * \param num_threads Maximum number of worker threads to use
+     * \param func Callable invoked as bool func(size_t item_idx, size_t worker_idx)
+     * \param max_items Upper bound on the number of items
+     */
+    template<typename FuncType>
+    inline void parallelForUntil(const size_t num_threads,
+                                 FuncType&& func,
+                                 const size_t max_items = std::numeric_limits<size_t>::max()) {
+        const size_t num_workers = std::min(getNumWorkerThreads(num_threads), max_items);
+
+        if(num_workers <= 1) {
+            for(size_t i = 0; i < max_items && func(i, 0); ++i) {
+            }
+            return;
+        }
+
+        std::atomic<size_t> next_item(0);
+        std::atomic<size_t> item_limit(max_items);
+        std::exception_ptr exception;
+        std::mutex exception_mutex;
+
+        const auto worker = [&](const size_t worker_idx) {
+            try {
+                size_t item_idx;
+                while((item_idx = next_item.fetch_add(1, std::memory_order_relaxed)) < item_limit.load(std::memory_order_relaxed)) {
+                    if(!func(item_idx, worker_idx)) {
+                        // Lower the limit so that nothing past this item gets handed out
+                        size_t cur_limit = item_limit.load(std::memory_order_relaxed);
+                        while(item_idx + 1 < cur_limit &&
+                              !item_limit.compare_exchange_weak(cur_limit, item_idx + 1, std::memory_order_relaxed)) {
+                        }
+                    }
+                }
+            }
+            catch(...) {
+                std::lock_guard<std::mutex> lock(exception_mutex);
+                if(!exception) {
+                    exception = std::current_exception();
+                }
+                item_limit = 0;
+            }
+        };
+
+        std::vector<std::thread> threads;
+        threads.reserve(num_workers - 1);
+
+        for(size_t i = 1; i < num_workers; ++i) {
+            threads.emplace_back(worker, i);
+        }
+
+        // The calling thread acts as worker 0
+        worker(0);
+
+        for(auto& t: threads) {
+            t.join();
+        }
+
+        if(exception) {
+            std::rethrow_exception(exception);
+        }
+    }
+
+    /**
+     * Calls func(item_idx, worker_idx) for every item_idx in [0, num_items) using up to num_threads
+     * worker threads. Items are handed out to workers in increasing order, and worker_idx is always less
+     * than the number of workers actually launched, so it can be used to index per-worker state.
+     *
+     * If num_threads is 1 (or there is only 1 item) everything runs on the calling thread.
+     *
+     * If any call throws, the remaining items are abandoned and the exception is rethrown on the calling
+     * thread once every worker has stopped.
+     *
+     * \param num_items Number of work items
+     * \param num_threads Maximum number of worker threads to use
+     * \param func Callable invoked as func(size_t item_idx, size_t worker_idx)
+     */
+    template<typename FuncType>
+    inline void parallelFor(const size_t num_items, const size_t num_threads, FuncType&& func) {
+        parallelForUntil(num_threads,
+                         [&func](const size_t item_idx, const size_t worker_idx) {
+                             func(item_idx, worker_idx);
+                             return true;
+                         },
+                         num_items);
+    }
+
+    /**
+     * \class OrderedCommitQueue
+     *
+     * Passes the results of work items that finish in any order to a commit function in item order.
+     * Use this with parallelForUntil to stream results (e.g. formatted text) as soon as every earlier
+     * item has been committed.
+     *
+     * Every item index that is handed out must be passed to commit() exactly once, even if it produced no
+     * result, or later items will never be committed. commit_func is called with the queue's lock held,
+     * so it is never called concurrently.
+     *
+     * To keep memory bounded, waitForSlot() blocks a worker until its item is within max_pending items of
+     * the oldest uncommitted item.
+     */
+    template<typename ResultType>
+    class OrderedCommitQueue {
+        public:
+            /**
+             * \class AbortedException
+             * Thrown by waitForSlot() if the queue was aborted
+             */
+            class AbortedException : public std::exception {
+            };
+
+        private:
+            using CommitFunc = std::function<void(ResultType&&)>;
+
+            const size_t max_pending_;
+            const CommitFunc commit_func_;
+            std::mutex mutex_;
+            std::condition_variable cv_;
+            size_t next_item_ = 0;
+            bool aborted_ = false;
+            std::map<size_t, ResultType> pending_;
+
+        public:
+            /**
+             * Constructs an OrderedCommitQueue
+             * \param max_pending Maximum distance between an item being worked on and the oldest uncommitted item
+             * \param commit_func Callable invoked as commit_func(ResultType&& result) in item order
+             */
+            OrderedCommitQueue(const size_t max_pending, CommitFunc commit_func) :
+                max_pending_(std::max(max_pending, static_cast<size_t>(1))),
+                commit_func_(std::move(commit_func))
+            {
+            }
+
+            /**
+             * Blocks until item_idx is close enough to the oldest uncommitted item to be started.
+             * Throws AbortedException if the queue is aborted while waiting.
+             * \param item_idx Item that is about to be started
+             */
+            void waitForSlot(const size_t item_idx) {
+                std::unique_lock<std::mutex> lock(mutex_);
+                cv_.wait(lock, [this, item_idx]() { return aborted_ || item_idx < next_item_ + max_pending_; });
+                if(aborted_) {
+                    throw AbortedException();
+                }
+            }
+
+            /**
+             * Commits the result of an item, along with any later results that were waiting on it
+             * \param item_idx Item that finished
+             * \param result Result of the item
+             */
+            void commit(const size_t item_idx, ResultType&& result) {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if(aborted_) {
+                    return;
+                }
+
+                if(item_idx != next_item_) {
+                    pending_.emplace(item_idx, std::move(result));
+                    return;
+                }
+
+                commit_func_(std::move(result));
+                ++next_item_;
+
+                for(auto it = pending_.begin(); it != pending_.end() && it->first == next_item_; it = pending_.erase(it)) {
+                    commit_func_(std::move(it->second));
+                    ++next_item_;
+                }
+
+                cv_.notify_all();
+            }
+
+            /**
+             * Stops committing results and wakes up any waiting workers. Call this if a worker fails.
+             */
+            void abort() {
+                std::lock_guard<std::mutex> lock(mutex_);
+                aborted_ = true;
+                pending_.clear();
+                cv_.notify_all();
+            }
+    };
+
+    /**
+     * \class BoundedQueue
+     *
+     * Single-producer/single-consumer style queue with a fixed capacity, used to overlap a producer thread
+     * (e.g. a trace reader) with a consumer thread (e.g. a compressor or writer).
+     *
+     * push() blocks while the queue is full and pop() blocks while it is empty. The producer calls close()
+     * once it is done, after which pop() drains the remaining items and then returns false. If the consumer
+     * fails, it calls abort() so that a producer blocked in push() wakes up with an AbortedException instead
+     * of waiting forever.
+     */
+    template<typename ItemType>
+    class BoundedQueue {
+        public:
+            /**
+             * \class AbortedException
+             * Thrown by push() if the queue was aborted
+             */
+            class AbortedException : public std::exception {
+            };
+
+        private:
+            const size_t max_size_;
+            std::mutex mutex_;
+            std::condition_variable not_empty_cv_;
+            std::condition_variable not_full_cv_;
+            std::deque<ItemType> items_;
+            bool closed_ = false;
+            bool aborted_ = false;
+
+        public:
+            /**
+             * Constructs a BoundedQueue
+             * \param max_size Maximum number of items in the queue
+             */
+            explicit BoundedQueue(const size_t max_size) :
+                max_size_(std::max(max_size, static_cast<size_t>(1)))
+            {
+            }
+
+            /**
+             * Adds an item to the queue, blocking while the queue is full.
+             * Throws AbortedException if the queue is aborted.
+             * \param item Item to add
+             */
+            void push(ItemType&& item) {
+                std::unique_lock<std::mutex> lock(mutex_);
+                not_full_cv_.wait(lock, [this]() { return aborted_ || items_.size() < max_size_; });
+                if(aborted_) {
+                    throw AbortedException();
+                }
+
+                items_.emplace_back(std::move(item));
+                not_empty_cv_.notify_one();
+            }
+
+            /**
+             * Removes the oldest item from the queue, blocking while the queue is empty.
+             * \param item Set to the removed item
+             * \returns false if the queue has been closed (or aborted) and there are no more items
+             */
+            bool pop(ItemType& item) {
+                std::unique_lock<std::mutex> lock(mutex_);
+                not_empty_cv_.wait(lock, [this]() { return aborted_ || closed_ || !items_.empty(); });
+                if(aborted_ || items_.empty()) {
+                    return false;
+                }
+
+                item = std::move(items_.front());
+                items_.pop_front();
+                not_full_cv_.notify_one();
+                return true;
+            }
+
+            /**
+             * Indicates that no more items will be pushed
+             */
+            void close() {
+                std::lock_guard<std::mutex> lock(mutex_);
+                closed_ = true;
+                not_empty_cv_.notify_all();
+            }
+
+            /**
+             * Discards any queued items and wakes up any waiting threads. Call this if the consumer fails.
+             */
+            void abort() {
+                std::lock_guard<std::mutex> lock(mutex_);
+                aborted_ = true;
+                items_.clear();
+                not_empty_cv_.notify_all();
+                not_full_cv_.notify_all();
+            }
+    };
+} // end namespace trace_tools
@@ -272,6 +272,90 @@ namespace binutils_wrapper {
             }
 #endif
 
+            /**
+             * print_address handler that records whether binutils printed an address for the current instruction
+             */
+            static void printAddressWrapper_(bfd_vma addr, struct disassemble_info* dinfo) {
+                static_cast<binutils_wrapper::DisassemblerInternals*>(dinfo->application_data)->printed_address_ = true;
+                generic_print_address(addr, dinfo);
+            }
+
+            static constexpr uint32_t REG_MASK_ = 0x1f;
+            static constexpr uint32_t COMPRESSED_REG_MASK_ = 0x7;
+            static constexpr uint32_t COMPRESSED_REG_OFFSET_ = 8;
+            static constexpr uint32_t SP_REG_ = 2;
+
+            static inline uint32_t regBit_(const uint32_t reg) {
+                return 1U << reg;
+            }
+
+            static inline bool isCompressed_(const uint32_t opcode) {
+                return (opcode & 0x3) != 0x3;
+            }
+
+            static inline uint32_t getRd_(const uint32_t opcode) {
+                return (opcode >> 7) & REG_MASK_;
+            }
+
+            static inline uint32_t getRs1_(const uint32_t opcode) {
+                return (opcode >> 15) & REG_MASK_;
+            }
+
+            static inline uint32_t getMajorOpcode_(const uint32_t opcode) {
+                return opcode & 0x7f;
+            }
+
+            static inline uint32_t getCompressedFunct3_(const uint32_t opcode) {
+                return (opcode >> 13) & 0x7;
+            }
+
+            static inline bool isCompressedQuadrant1_(const uint32_t opcode) {
+                return (opcode & 0x3) == 0x1;
+            }
+
+            /**
+             * Returns true if the instruction is a lui, auipc or c.lui. Binutils remembers the immediate
+             * of these instructions and uses it to annotate a later instruction that consumes the register.
+             */
+            static inline bool setsHiAddr_(const uint32_t opcode) {
+                if(isCompressed_(opcode)) {
+                    // c.lui shares its encoding with c.addi16sp when rd == sp
+                    return isCompressedQuadrant1_(opcode) && getCompressedFunct3_(opcode) == 0x3 && getRd_(opcode) != SP_REG_;
+                }
+
+                const auto major_opcode = getMajorOpcode_(opcode);
+                return major_opcode == 0x37 || major_opcode == 0x17;
+            }
+
+            /**
+             * Returns true if the instruction is a branch or direct jump, whose disassembly includes the target address
+             */
+            static inline bool isPCRelative_(const uint32_t opcode) {
+                if(isCompressed_(opcode)) {
+                    // c.j, c.beqz, c.bnez. c.jal is left out since it shares its encoding with c.addiw on RV64.
+                    return isCompressedQuadrant1_(opcode) && getCompressedFunct3_(opcode) >= 0x5;
+                }
+
+                const auto major_opcode = getMajorOpcode_(opcode);
+                return major_opcode == 0x63 || major_opcode == 0x6f;
+            }
+
+            /**
+             * Gets a conservative mask of the registers an instruction might read or write
+             */
+            static inline uint32_t getTouchedRegs_(const uint32_t opcode) {
+                if(isCompressed_(opcode)) {
+                    // Register fields move around between the compressed formats, so include every possibility
+                    return regBit_(getRd_(opcode)) |
+                           regBit_(COMPRESSED_REG_OFFSET_ + ((opcode >> 7) & COMPRESSED_REG_MASK_)) |
+                           regBit_((opcode >> 2) & REG_MASK_) |
+                           regBit_(COMPRESSED_REG_OFFSET_ + ((opcode >> 2) & COMPRESSED_REG_MASK_)) |
+                           regBit_(SP_REG_);
+                }
+
+                return regBit_(getRd_(opcode)) | regBit_(getRs1_(opcode));
+            }
+
             /**
              * Gets a specific byte from a given value
              */
@@ -365,6 +449,16 @@ namespace binutils_wrapper {
 
             mutable UnTabStream dismStr_;
 
+            //! Superset of the registers binutils may be holding a lui/auipc immediate for. Any instruction that
+            //! touches one of these registers could be annotated with an address, so it can't be cached.
+            mutable uint32_t hi_addr_regs_ = 0;
+
+            //! Set if binutils printed an address while disassembling the current instruction
+            mutable bool printed_address_ = false;
+
+            //! Set if the output of the last disassembled instruction can be cached
+            mutable bool last_cacheable_ = false;
+
         public:
             DisassemblerInternals(const std::string& elf,
                                   const unsigned long bfd_mach,
@@ -382,6 +476,7 @@ namespace binutils_wrapper {
                 );
                 dis_info_.read_memory_func = readMemoryWrapper_;
                 dis_info_.application_data = static_cast<void*>(this);
+                dis_info_.print_address_func = printAddressWrapper_;
                 dis_info_.mach = bfd_mach;
                 dis_info_.stream = static_cast<void *>(&dismStr_);
                 if (!use_aliases) {
@@ -396,9 +491,38 @@ namespace binutils_wrapper {
                 dismStr_.reset(os);
                 opcode_pc_ = pc;
                 copyU32_(opcode_mem_, opcode);
+                printed_address_ = false;
                 print_insn_riscv(opcode_pc_, &dis_info_);
+
+                const bool pc_relative = isPCRelative_(opcode);
+                if(setsHiAddr_(opcode)) {
+                    hi_addr_regs_ |= regBit_(getRd_(opcode));
+                }
+                else if(printed_address_ && !pc_relative && !isCompressed_(opcode)) {
+                    // Binutils only annotates uncompressed instructions using their rs1 register, and forgets the
+                    // immediate once it has been used
+                    hi_addr_regs_ &= ~regBit_(getRs1_(opcode));
+                }
+
+                // Branch and jump targets only depend on the PC. Any other address came from earlier instructions.
+                last_cacheable_ = pc_relative || !printed_address_;
+
                 return dismStr_.hasUnknownDisasm();
             }
+
+            stf::disassemblers::BaseDisassembler::CacheKeyType getCacheKeyType(const uint32_t opcode) const {
+                using CacheKeyType = stf::disassemblers::BaseDisassembler::CacheKeyType;
+
+                if(setsHiAddr_(opcode) || (getTouchedRegs_(opcode) & hi_addr_regs_)) {
+                    return CacheKeyType::NONE;
+                }
+
+                return isPCRelative_(opcode) ? CacheKeyType::PC_AND_OPCODE : CacheKeyType::OPCODE;
+            }
+
+            bool lastDisassemblyCacheable() const {
+                return last_cacheable_;
+            }
     };
 }
 
@@ -443,5 +567,18 @@ namespace stf {
             unknown_disasm_ |= dis_->disassemble(os, pc, opcode);
         }
 
+        BaseDisassembler::CacheKeyType BinutilsDisassembler::getCacheKeyType_(const uint64_t pc,
+                                                                              const uint32_t opcode) const {
+            return dis_->getCacheKeyType(opcode);
+        }
+
+        bool BinutilsDisassembler::lastDisassemblyCacheable_() const {
+            return dis_->lastDisassemblyCacheable();
+        }
+
+        bool BinutilsDisassembler::isStateful_() const {
+            return true;
+        }
+
     }
 }
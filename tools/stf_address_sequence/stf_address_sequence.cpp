@@ -1,8 +1,6 @@
 #include <iostream>
 #include <sstream>
-#include <fstream>
 #include <map>
-#include <cstdlib>
 #include <iterator>
 #include <regex>
 
@@ -12,6 +10,7 @@
 #include "stf_record_types.hpp"
 
 #include "command_line_parser.hpp"
+#include "external_sorter.hpp"
 #include "file_utils.hpp"
 #include "tools_util.hpp"
 
@@ -31,6 +30,7 @@ void parseCommandLine(int argc,
                       bool& only_instruction_pc
                       , bool& exclude_reads, bool& exclude_writes
                       , uint64_t& max_distance_access, uint64_t& max_distance_stream
+                      , size_t& max_sort_memory
                       ) {
     trace_tools::CommandLineParser parser("stf_address_sequence");
 
@@ -44,6 +44,7 @@ void parseCommandLine(int argc,
     parser.addFlag('W', "exclude writes");
     parser.addFlag('C', "max_distance_access", "restrict report to repeated accesses with at MOST this distance. Each memory transaction(RD or WR) counts one access");
     parser.addFlag('A', "max_distance_stream", "restrict report to repeated streams with at MOST this distance. Each gather counts one. Access pattern ABA counts 3, AABB counts 2");
+    parser.addFlag('M', "MiB", "cap the memory used to sort streams by address at this many MiB (default 1024). Larger outputs are sorted in runs spilled to $TMPDIR");
     parser.addPositionalArgument("trace", "trace in STF format");
     parser.appendHelpText("Terminology:");
     parser.appendHelpText("    Repeated access  - The access pattern AAAAA doesn't count. AABAAAAA counts 5 repeated accesses to A. ABABABAB counts 3 repeated accesses to A, and 3 to B");
@@ -76,6 +77,10 @@ void parseCommandLine(int argc,
     exclude_writes = parser.hasArgument('W');
     parser.getArgumentValue('C', max_distance_access);
     parser.getArgumentValue('A', max_distance_stream);
+    size_t max_sort_memory_mib = max_sort_memory >> 20;
+    parser.getArgumentValue('M', max_sort_memory_mib);
+    parser.assertCondition(max_sort_memory_mib != 0, "Sort memory limit must be at least 1 MiB");
+    max_sort_memory = max_sort_memory_mib << 20;
 }
 
 struct MemAccessCount {
@@ -111,7 +116,28 @@ inline void countPC(AddressMap& address_map, const uint64_t pc, const uint64_t a
     ++address_map[pc & address_mask].reads;
 }
 
-inline void printAddressMap(AddressMap& address_map, const uint64_t min_accesses, OutputFileStream& output_file, int COLUMN_WIDTH) {
+/**
+ * \struct AddressStream
+ * Binary form of a single output row, used to sort streams by address without reparsing the text output
+ */
+struct AddressStream {
+    uint64_t address;
+    uint64_t reads;
+    uint64_t writes;
+    uint64_t access_id;
+    uint64_t stream_id;
+
+    /**
+     * Orders streams by address, then by access ID
+     */
+    bool operator<(const AddressStream& rhs) const {
+        return address < rhs.address || (address == rhs.address && access_id < rhs.access_id);
+    }
+};
+
+using AddressStreamSorter = trace_tools::ExternalSorter<AddressStream>;
+
+inline void printAddressMap(AddressMap& address_map, const uint64_t min_accesses, OutputFileStream& output_file, int COLUMN_WIDTH, AddressStreamSorter& sorter) {
     static uint64_t seq_id_1st = 0, stream_id = 0;
 
     for(const auto& p: address_map) {
@@ -127,6 +153,7 @@ inline void printAddressMap(AddressMap& address_map, const uint64_t min_accesses
         } else {
             COLUMN_WIDTH += 4; // random natural number
             stf::format_utils::formatDecLeft(output_file, p.first, COLUMN_WIDTH);
+            sorter.push(AddressStream{p.first, reads, writes, seq_id_1st, stream_id});
         }
         stf::format_utils::formatDecLeft(output_file, reads, COLUMN_WIDTH);
         stf::format_utils::formatDecLeft(output_file, writes, COLUMN_WIDTH);
@@ -148,6 +175,7 @@ int main(int argc, char** argv) {
     bool only_instruction_pc = false;
     bool exclude_reads = false, exclude_writes = false;
     uint64_t max_distance_access = std::numeric_limits<uint64_t>::max(), max_distance_stream = std::numeric_limits<uint64_t>::max();
+    size_t max_sort_memory = AddressStreamSorter::DEFAULT_MAX_MEMORY;
     std::string wkld_id, wkld_name;
 
     try {
@@ -162,6 +190,7 @@ int main(int argc, char** argv) {
                          only_instruction_pc
                          , exclude_reads, exclude_writes
                          , max_distance_access, max_distance_stream
+                         , max_sort_memory
                          );
     }
     catch(const trace_tools::CommandLineParser::EarlyExitException& e) {
@@ -204,6 +233,7 @@ int main(int argc, char** argv) {
         output_file << "\n";
     }
     AddressMap address_map;
+    AddressStreamSorter sorter(max_sort_memory);
     const uint64_t address_mask = std::numeric_limits<uint64_t>::max() << log2(alignment);
 
     size_t total_insts = 0;
@@ -214,7 +244,7 @@ int main(int argc, char** argv) {
             if(!only_instruction_pc) {
                 for(const auto& access: inst.getMemoryAccesses()) {
                     if (countAddress(address_map, access.getAccessRecord(), address_mask, exclude_reads, exclude_writes) < 0) {
-                        printAddressMap(address_map, min_accesses, output_file, COLUMN_WIDTH);
+                        printAddressMap(address_map, min_accesses, output_file, COLUMN_WIDTH, sorter);
                         address_map.clear();
                         countAddress(address_map, access.getAccessRecord(), address_mask, exclude_reads, exclude_writes);
                     }
@@ -237,7 +267,7 @@ int main(int argc, char** argv) {
                 if(STF_EXPECT_TRUE(!only_instruction_pc &&
                                     rec->getId() == stf::descriptors::internal::Descriptor::STF_INST_MEM_ACCESS)) {
                     if (countAddress(address_map, rec->as<stf::InstMemAccessRecord>(), address_mask, exclude_reads, exclude_writes) < 0) {
-                        printAddressMap(address_map, min_accesses, output_file, COLUMN_WIDTH);
+                        printAddressMap(address_map, min_accesses, output_file, COLUMN_WIDTH, sorter);
                         address_map.clear();
                         countAddress(address_map, rec->as<stf::InstMemAccessRecord>(), address_mask, exclude_reads, exclude_writes);
                     }
@@ -257,61 +287,48 @@ int main(int argc, char** argv) {
     }
 
     if(!address_map.empty()) {
-        printAddressMap(address_map, min_accesses, output_file, COLUMN_WIDTH);
+        printAddressMap(address_map, min_accesses, output_file, COLUMN_WIDTH, sorter);
     }
     output_file.close();
 
     if(!output_file.isStdout()) {
-        const auto sorted_filename = output_filename + ".sorted";
-        std::stringstream ss_sort;
-        ss_sort << "sort -n -k" << Columns::ADDR + 1 << " -k" << Columns::ACCESS_ID + 1 << " -o " << sorted_filename << " " << output_filename;
-        std::system(ss_sort.str().c_str());
-        std::ifstream ifstrm(sorted_filename);
-        stf_assert(ifstrm.is_open(), "failed to open " << sorted_filename)
-
-        const auto tagged_filename = sorted_filename + ".tagged";
+        const auto tagged_filename = output_filename + ".sorted.tagged";
         OutputFileStream tagged_file(tagged_filename);
         for(size_t i = Columns::ADDR; i != Columns::END; ++i) {
             stf::format_utils::formatLeft(tagged_file, columns.at(i).c_str(), COLUMN_WIDTH);
         }
         tagged_file << "\n";
 
-        uint64_t prev_addr = std::numeric_limits<uint64_t>::max(), curr_addr;
+        uint64_t prev_addr = std::numeric_limits<uint64_t>::max();
         uint64_t prev_access_id = 0, prev_accesses = 0, prev_stream_id = 0;
-        uint64_t curr_access_id, curr_accesses, curr_stream_id;
         size_t total_accesses = 0, repeated_accesses = 0, distance_access;
         size_t total_streams = 0, repeated_streams = 0, distance_stream;
-        for(std::string line; std::getline(ifstrm, line); ) {
-            if (line.empty()) {
-                continue;
-            }
-            std::istringstream iss(line);
-            std::vector<std::string> strings((std::istream_iterator<std::string>(iss)), std::istream_iterator<std::string>());
-            stf_assert(strings.size() == Columns::OUT_END, "wrong fields in file " << sorted_filename << ":" << total_streams)
-            total_accesses += (curr_accesses = std::stoul(strings.at(Columns::SUM)));
+        sorter.consume([&](const AddressStream& stream) {
+            const uint64_t curr_accesses = stream.reads + stream.writes;
+            total_accesses += curr_accesses;
             ++total_streams;
-            stf::format_utils::formatVA(tagged_file, curr_addr = std::stoul(strings.front()));
+            stf::format_utils::formatVA(tagged_file, stream.address);
             stf::format_utils::formatSpaces(tagged_file, 4);
-            for (std::size_t i = Columns::RD; i != Columns::OUT_END; ++i) {
-                stf::format_utils::formatLeft(tagged_file, strings[i], COLUMN_WIDTH);
-            }
-            curr_access_id = std::stoul(strings.at(Columns::ACCESS_ID));
-            curr_stream_id = std::stoul(strings.at(Columns::STREAM_ID));
-            if (prev_addr != curr_addr) {
-                prev_addr = curr_addr;
+            stf::format_utils::formatDecLeft(tagged_file, stream.reads, COLUMN_WIDTH);
+            stf::format_utils::formatDecLeft(tagged_file, stream.writes, COLUMN_WIDTH);
+            stf::format_utils::formatDecLeft(tagged_file, curr_accesses, COLUMN_WIDTH);
+            stf::format_utils::formatDecLeft(tagged_file, stream.access_id, COLUMN_WIDTH);
+            stf::format_utils::formatDecLeft(tagged_file, stream.stream_id, COLUMN_WIDTH);
+            if (prev_addr != stream.address) {
+                prev_addr = stream.address;
                 stf::format_utils::formatDecLeft(tagged_file, -1, COLUMN_WIDTH);
                 stf::format_utils::formatDecLeft(tagged_file, 0, COLUMN_WIDTH);
                 stf::format_utils::formatDecLeft(tagged_file, -1, COLUMN_WIDTH);
                 stf::format_utils::formatDecLeft(tagged_file, 0, COLUMN_WIDTH);
             } else {
                 stf::format_utils::formatDecLeft(tagged_file, prev_access_id, COLUMN_WIDTH);
-                stf_assert((prev_access_id + prev_accesses) < curr_access_id, "wrong order for duplicated address in file " << sorted_filename << ":" << total_streams)
-                distance_access = curr_access_id + 1 - prev_access_id - prev_accesses;
+                stf_assert((prev_access_id + prev_accesses) < stream.access_id, "wrong order for duplicated address at stream " << total_streams)
+                distance_access = stream.access_id + 1 - prev_access_id - prev_accesses;
                 stf::format_utils::formatDecLeft(tagged_file, distance_access, COLUMN_WIDTH);
 
                 stf::format_utils::formatDecLeft(tagged_file, prev_stream_id, COLUMN_WIDTH);
-                stf_assert(prev_stream_id < curr_stream_id, "wrong order for duplicated address in file " << sorted_filename << ":" << total_streams)
-                distance_stream = curr_stream_id - prev_stream_id;
+                stf_assert(prev_stream_id < stream.stream_id, "wrong order for duplicated address at stream " << total_streams)
+                distance_stream = stream.stream_id - prev_stream_id;
                 stf::format_utils::formatDecLeft(tagged_file, distance_stream, COLUMN_WIDTH);
 
                 if (distance_access <= max_distance_access && distance_stream <= max_distance_stream) {
@@ -320,10 +337,10 @@ int main(int argc, char** argv) {
                 }
             }
             tagged_file << "\n";
-            prev_access_id = curr_access_id;
+            prev_access_id = stream.access_id;
             prev_accesses = curr_accesses;
-            prev_stream_id = curr_stream_id;
-        }
+            prev_stream_id = stream.stream_id;
+        });
         tagged_file.close();
 
         const auto summary_filename = output_filename + ".summary";
@@ -3,15 +3,26 @@
  *
  */
 
+#include <algorithm>
+#include <charconv>
 #include <cstdint>
 #include <iostream>
+#include <iterator>
 #include <limits>
+#include <memory>
+#include <set>
 #include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <boost/container_hash/hash.hpp>
 
 #include "stf_inst_reader.hpp"
 
 #include "command_line_parser.hpp"
 #include "file_utils.hpp"
+#include "filesystem.hpp"
+#include "tools_util.hpp"
 
 static void parseCommandLine(int argc,
                              char **argv,
@@ -20,14 +31,16 @@ static void parseCommandLine(int argc,
                              std::string& user_mode_filename,
                              uint64_t& start_inst,
                              uint64_t& end_inst,
-                             uint64_t& interval,
+                             std::vector<uint64_t>& intervals,
                              uint64_t& min_user_insts) {
     trace_tools::CommandLineParser parser("stf_bbv");
     parser.addFlag('o', "output", "output filename (defaults to stdout if omitted)");
     parser.addFlag('u', "user_mode_file", "output filename containing whether each interval has non-user code in it");
     parser.addFlag('s', "N", "start to collect Basic Block Vector info at N-th instruction");
     parser.addFlag('e', "M", "end basic block vector collection at M-th instruction");
-    parser.addFlag('w', "K", "basic block vector collection in every K instructions");
+    parser.addMultiFlag('w', "K", "basic block vector collection in every K instructions (default 100000000). "
+                                  "Can be specified multiple times to generate BBVs for several interval sizes in a single pass. "
+                                  "Each interval size K then writes its own set of output files with .K inserted before the file extension.");
     parser.addFlag('m', "L", "ensure a minimum of L instructions have passed before dumping user-mode BBVs");
     parser.addPositionalArgument("trace", "trace in STF format");
 
@@ -37,10 +50,15 @@ static void parseCommandLine(int argc,
     parser.getArgumentValue('u', user_mode_filename);
     parser.getArgumentValue('s', start_inst);
     parser.getArgumentValue('e', end_inst);
-    parser.getArgumentValue('w', interval);
+    for(const auto& interval: parser.getMultipleValueArgument('w')) {
+        intervals.emplace_back(parseInt<uint64_t>(interval));
+        parser.assertCondition(intervals.back() != 0, "Interval size must be nonzero");
+    }
     parser.getArgumentValue('m', min_user_insts);
     parser.getPositionalArgument(0, trace_filename);
 
+    parser.assertCondition(intervals.size() <= 1 || output_filename != "-", "Multiple interval sizes require an output filename");
+    parser.assertCondition(std::set<uint64_t>(intervals.begin(), intervals.end()).size() == intervals.size(), "Interval sizes must be unique");
     parser.assertCondition(!end_inst || (end_inst <= start_inst), "End inst must be greater than start inst");
 }
 
@@ -61,109 +79,215 @@ class BasicBlockTracker {
                        (this->bb_start > other.bb_start) ? false :
                        (this->bb_end < other.bb_end);
             }
+
+            bool operator==(const BasicBlockRange& other) const {
+                return bb_start == other.bb_start && bb_end == other.bb_end;
+            }
+
+            struct Hash {
+                size_t operator()(const BasicBlockRange& bbr) const {
+                    size_t seed = 0;
+                    boost::hash_combine(seed, bbr.bb_start);
+                    boost::hash_combine(seed, bbr.bb_end);
+                    return seed;
+                }
+            };
         };
 
     private:
-        class BasicBlockInfo {
-            friend class BasicBlockTracker;
+        using BasicBlockRangeVec = std::vector<BasicBlockRange>;
 
+        /**
+         * \class IntervalWriter
+         * Accumulates block counts and writes the BBV output files for a single interval size
+         */
+        class IntervalWriter {
             private:
-                uint64_t bb_id_;     // block id;
-                //uint64_t bb_insts_;  // instructions in block
-                uint64_t bb_count_;  // block executed count;
+                const uint64_t interval_;
+                const uint64_t min_user_insts_;
+                OutputFileStream os_;
+                OutputFileStream interval_file_;
+                std::ofstream user_mode_file_;
+                std::ofstream user_interval_file_;
+                uint64_t last_interval_idx_ = 0;
+                uint64_t interval_count_ = 0;
+                bool has_non_user_code_ = false;
+                std::vector<uint64_t> bb_counts_; // Indexed by block index
+                std::vector<size_t> touched_blocks_; // Blocks with a nonzero count in the current interval
+                std::string line_buf_;
+
+                void appendDec_(const uint64_t val) {
+                    char buf[std::numeric_limits<uint64_t>::digits10 + 1];
+                    const auto result = std::to_chars(std::begin(buf), std::end(buf), val);
+                    line_buf_.append(buf, result.ptr);
+                }
 
             public:
-                BasicBlockInfo(const uint64_t id, const uint64_t i, const uint64_t c) :
-                    bb_id_(id),
-                    //bb_insts_(i),
-                    bb_count_(c)
+                IntervalWriter(const uint64_t interval, const uint64_t min_user_insts, const std::string& output_filename, const std::string& user_mode_filename, const uint64_t start_inst) :
+                    interval_(interval),
+                    min_user_insts_(min_user_insts),
+                    os_(output_filename),
+                    interval_file_(output_filename != "-" ? output_filename + ".interval" : "-"),
+                    last_interval_idx_(start_inst)
                 {
+                    if(!user_mode_filename.empty()) {
+                        user_mode_file_.open(user_mode_filename, std::ofstream::trunc);
+                        user_interval_file_.open(user_mode_filename + ".interval", std::ofstream::trunc);
+                    }
+                }
+
+                void updateUserMode(const bool is_change_from_user_mode) {
+                    has_non_user_code_ |= is_change_from_user_mode;
+                }
+
+                void countInst() {
+                    ++interval_count_;
+                }
+
+                void addBlock(const size_t bb_idx, const uint64_t instcnt) {
+                    if(STF_EXPECT_FALSE(bb_idx >= bb_counts_.size())) {
+                        bb_counts_.resize(bb_idx + 1, 0);
+                    }
+
+                    auto& count = bb_counts_[bb_idx];
+                    if(!count) {
+                        touched_blocks_.emplace_back(bb_idx);
+                    }
+                    count += instcnt;
+                }
+
+                void checkInterval(const BasicBlockRangeVec& bb_ranges, const uint64_t inst_idx, const bool dump_interval) {
+                    if(interval_count_ >= interval_) {
+                        dumpBasicBlockVector(bb_ranges, inst_idx, dump_interval);
+                        interval_count_ = 0;
+                        has_non_user_code_ = false;
+                    }
+                }
+
+                void dumpBasicBlockVector(const BasicBlockRangeVec& bb_ranges, const uint64_t inst_idx, const bool dump_interval) {
+                    if(interval_count_) {
+                        // Only visit the blocks that executed in this interval, keeping them in address order
+                        std::sort(touched_blocks_.begin(),
+                                  touched_blocks_.end(),
+                                  [&bb_ranges](const size_t lhs, const size_t rhs) {
+                                      return bb_ranges[lhs] < bb_ranges[rhs];
+                                  });
+
+                        line_buf_.clear();
+                        line_buf_ += 'T';
+                        for(const auto bb_idx: touched_blocks_) {
+                            auto& count = bb_counts_[bb_idx];
+                            line_buf_ += ':';
+                            appendDec_(bb_idx + 1);
+                            line_buf_ += ':';
+                            appendDec_(count);
+                            line_buf_ += ' ';
+                            count = 0;
+                        }
+                        line_buf_ += '\n';
+                        touched_blocks_.clear();
+
+                        os_ << line_buf_;
+
+                        if(user_mode_file_) {
+                            if(has_non_user_code_ || ((inst_idx != std::numeric_limits<uint64_t>::max()) && ((inst_idx - interval_count_) < min_user_insts_))) {
+                                user_mode_file_ << std::endl;
+                            }
+                            else {
+                                user_mode_file_ << line_buf_;
+                                if(dump_interval) {
+                                    user_interval_file_ << last_interval_idx_ << std::endl;
+                                }
+                            }
+                        }
+
+                        if(dump_interval) {
+                            interval_file_ << last_interval_idx_ << std::endl;
+                            last_interval_idx_ = inst_idx;
+                        }
+                    }
                 }
         };
 
-        using BasicBlockMap = std::map<BasicBlockRange, BasicBlockInfo>;
+        // Maps a block to its index in bb_ranges_. The block ID is the index + 1.
+        using BasicBlockIdMap = std::unordered_map<BasicBlockRange, size_t, BasicBlockRange::Hash>;
 
-        const uint64_t interval_;
-        const uint64_t min_user_insts_;
-        OutputFileStream os_;
-        OutputFileStream interval_file_;
-        std::ofstream user_mode_file_;
-        std::ofstream user_interval_file_;
-        uint64_t last_interval_idx_ = 0;
-        BasicBlockMap bbv_;
+        BasicBlockIdMap bb_ids_;
+        BasicBlockRangeVec bb_ranges_;
+        std::vector<std::unique_ptr<IntervalWriter>> writers_;
+
+        /**
+         * Inserts the interval size into a filename so that each interval size gets its own set of files,
+         * e.g. trace.bb -> trace.10000000.bb
+         */
+        static std::string getIntervalFilename_(const std::string& filename, const uint64_t interval) {
+            if(filename.empty() || filename == "-") {
+                return filename;
+            }
+
+            const fs::path path(filename);
+            fs::path interval_path = path.parent_path() / path.stem();
+            interval_path += '.' + std::to_string(interval);
+            interval_path += path.extension();
+            return interval_path.string();
+        }
 
     public:
-        explicit BasicBlockTracker(const uint64_t interval, const uint64_t min_user_insts, const std::string& output_filename, const std::string& user_mode_filename, const uint64_t start_inst) :
-            interval_(interval),
-            min_user_insts_(min_user_insts),
-            os_(output_filename),
-            interval_file_(output_filename != "-" ? output_filename + ".interval" : "-"),
-            last_interval_idx_(start_inst)
-        {
-            if(!user_mode_filename.empty()) {
-                user_mode_file_.open(user_mode_filename, std::ofstream::trunc);
-                user_interval_file_.open(user_mode_filename + ".interval", std::ofstream::trunc);
+        BasicBlockTracker(const std::vector<uint64_t>& intervals, const uint64_t min_user_insts, const std::string& output_filename, const std::string& user_mode_filename, const uint64_t start_inst) {
+            // A single interval size keeps the filenames exactly as specified
+            const bool multiple_intervals = intervals.size() > 1;
+
+            for(const auto interval: intervals) {
+                writers_.emplace_back(
+                    std::make_unique<IntervalWriter>(interval,
+                                                     min_user_insts,
+                                                     multiple_intervals ? getIntervalFilename_(output_filename, interval) : output_filename,
+                                                     multiple_intervals ? getIntervalFilename_(user_mode_filename, interval) : user_mode_filename,
+                                                     start_inst)
+                );
             }
         }
 
-        void updateBasicBlockVector(BasicBlockRange &bbr, uint64_t& instcnt, uint64_t& interval_count, bool& has_non_user_code, const uint64_t inst_idx, const bool dump_interval = true) {
+        void updateUserMode(const bool is_change_from_user_mode) {
+            for(auto& w: writers_) {
+                w->updateUserMode(is_change_from_user_mode);
+            }
+        }
+
+        void countInst() {
+            for(auto& w: writers_) {
+                w->countInst();
+            }
+        }
+
+        void updateBasicBlockVector(BasicBlockRange &bbr, uint64_t& instcnt, const uint64_t inst_idx, const bool dump_interval = true) {
             if(bbr.bb_start == 0) {
                 return;
             }
 
-            auto it = bbv_.find(bbr);
-            if(it == bbv_.end()) {
-                bbv_.emplace_hint(it,
-                                  std::piecewise_construct,
-                                  std::forward_as_tuple(bbr),
-                                  std::forward_as_tuple(bbv_.size()+1, instcnt, instcnt));
+            // Block IDs are shared by every interval size
+            const auto result = bb_ids_.try_emplace(bbr, bb_ranges_.size());
+            if(result.second) {
+                bb_ranges_.emplace_back(bbr);
             }
-            else {
-                it->second.bb_count_ += instcnt;
+
+            const size_t bb_idx = result.first->second;
+            for(auto& w: writers_) {
+                w->addBlock(bb_idx, instcnt);
             }
 
             bbr.bb_start = 0;
             bbr.bb_end = 0;
 
             instcnt = 0;
-            if(interval_count >= interval_) {
-                dumpBasicBlockVector(interval_count, has_non_user_code, inst_idx, dump_interval);
-                interval_count = 0;
-                has_non_user_code = false;
+            for(auto& w: writers_) {
+                w->checkInterval(bb_ranges_, inst_idx, dump_interval);
             }
         }
 
-        void dumpBasicBlockVector(const uint64_t interval_count, const bool has_non_user_code, const uint64_t inst_idx, const bool dump_interval) {
-            if(interval_count) {
-                std::ostringstream ss;
-                ss << 'T';
-                for(auto& b: bbv_) {
-                    if(b.second.bb_count_) {
-                        ss << ':' << b.second.bb_id_ << ':' << b.second.bb_count_ << ' ';
-                        b.second.bb_count_ = 0;
-                    }
-                }
-                ss << std::endl;
-
-                const auto str = ss.str();
-                os_ << str;
-
-                if(user_mode_file_) {
-                    if(has_non_user_code || ((inst_idx != std::numeric_limits<uint64_t>::max()) && ((inst_idx - interval_count) < min_user_insts_))) {
-                        user_mode_file_ << std::endl;
-                    }
-                    else {
-                        user_mode_file_ << str;
-                        if(dump_interval) {
-                            user_interval_file_ << last_interval_idx_ << std::endl;
-                        }
-                    }
-                }
-
-                if(dump_interval) {
-                    interval_file_ << last_interval_idx_ << std::endl;
-                    last_interval_idx_ = inst_idx;
-                }
+        void dumpBasicBlockVector(const uint64_t inst_idx, const bool dump_interval) {
+            for(auto& w: writers_) {
+                w->dumpBasicBlockVector(bb_ranges_, inst_idx, dump_interval);
             }
         }
 };
@@ -176,17 +300,21 @@ int main(int argc, char **argv) {
     std::string user_mode_filename;
     uint64_t start_inst = 0;
     uint64_t end_inst = 0;
-    uint64_t interval = DEFAULT_INTERVAL;
+    std::vector<uint64_t> intervals;
     uint64_t min_user_insts = 0;
 
     try {
-        parseCommandLine(argc, argv, trace_filename, output_filename, user_mode_filename, start_inst, end_inst, interval, min_user_insts);
+        parseCommandLine(argc, argv, trace_filename, output_filename, user_mode_filename, start_inst, end_inst, intervals, min_user_insts);
     }
     catch(const trace_tools::CommandLineParser::EarlyExitException& e) {
         std::cerr << e.what() << std::endl;
         return e.getCode();
     }
 
+    if(intervals.empty()) {
+        intervals.emplace_back(DEFAULT_INTERVAL);
+    }
+
     if(!end_inst) {
         end_inst = std::numeric_limits<uint64_t>::max();
     }
@@ -201,10 +329,8 @@ int main(int argc, char **argv) {
 
     uint64_t cur_bb_count = 0;
     BasicBlockTracker::BasicBlockRange cur_bbr(0,0);
-    uint64_t interval_count = 0;
 
-    BasicBlockTracker tracker(interval, min_user_insts, output_filename, user_mode_filename, start_inst);
-    bool has_non_user_code = false;
+    BasicBlockTracker tracker(intervals, min_user_insts, output_filename, user_mode_filename, start_inst);
 
     for(const auto& inst: stf_reader) {
         if(STF_EXPECT_FALSE(!inst.valid())) {
@@ -219,10 +345,10 @@ int main(int argc, char **argv) {
             break;
         }
 
-        has_non_user_code |= inst.isChangeFromUserMode();
+        tracker.updateUserMode(inst.isChangeFromUserMode());
 
         if(STF_EXPECT_FALSE(inst.isCoF())) {
-            tracker.updateBasicBlockVector(cur_bbr, cur_bb_count, interval_count, has_non_user_code, inst.index(), false);
+            tracker.updateBasicBlockVector(cur_bbr, cur_bb_count, inst.index(), false);
         }
 
         if(!cur_bbr.bb_start) {
@@ -232,14 +358,14 @@ int main(int argc, char **argv) {
 
         cur_bbr.bb_end += inst.opcodeSize();
         cur_bb_count++;
-        interval_count++;
+        tracker.countInst();
 
         if(STF_EXPECT_FALSE(inst.isTakenBranch() || !inst.getEvents().empty())) {
-            tracker.updateBasicBlockVector(cur_bbr, cur_bb_count, interval_count, has_non_user_code, inst.index());
+            tracker.updateBasicBlockVector(cur_bbr, cur_bb_count, inst.index());
         }
     }
 
-    tracker.dumpBasicBlockVector(interval_count, has_non_user_code, std::numeric_limits<uint64_t>::max(), true);
+    tracker.dumpBasicBlockVector(std::numeric_limits<uint64_t>::max(), true);
 
     return 0;
 }
@@ -3,12 +3,14 @@
 #include <memory>
 #include <string>
 #include <string_view>
+#include <vector>
 
 #include <boost/core/demangle.hpp>
 
 #include "command_line_parser.hpp"
 #include "stf_branch_reader.hpp"
 #include "stf_inst_reader.hpp"
+#include "stf_pte.hpp"
 
 template<typename Reader>
 inline std::chrono::duration<double> readAllRecords(Reader& reader) {
@@ -56,12 +58,110 @@ void readerBench(const std::string& filename, Args&&... args) {
               << " insts/s)" << std::endl;
 }
 
+/**
+ * \struct PTEEvent
+ * Page table update (if pte is set) or page mask lookup replayed by pageTableBench
+ */
+struct PTEEvent {
+    const stf::PageTableWalkRecord* pte = nullptr;
+    uint64_t address = 0;
+    uint32_t pid = 0;
+};
+
+/**
+ * Reads a trace with the STFInstReader's page table tracking off and then on. Both passes replay the same
+ * PTE updates and page mask lookups through an STF_PTE, so the difference in read time is the cost of the
+ * reader's own page table tracking.
+ *
+ * The embedded PTEs are copied up front in an untimed pass, since STF_PTE keeps pointers to them. Updates
+ * and lookups are batched so that the STF_PTE time can be measured separately from the reader.
+ */
+void pageTableBench(const std::string& filename, const bool skip_non_user) {
+    static constexpr size_t BATCH_SIZE = 4096;
+
+    std::vector<stf::STFRecord::UniqueHandle> ptes;
+    {
+        stf::STFInstReader reader(filename, skip_non_user);
+        for(const auto& inst: reader) {
+            for(const auto& p: inst.getEmbeddedPTEs()) {
+                ptes.emplace_back(p->clone());
+            }
+        }
+    }
+
+    for(const bool track_ptes: {false, true}) {
+        stf::STFInstReader reader(filename, skip_non_user, track_ptes);
+        stf::STF_PTE page_table(nullptr, nullptr, true);
+        std::vector<PTEEvent> batch;
+        batch.reserve(BATCH_SIZE);
+        size_t next_pte = 0;
+        uint64_t num_lookups = 0;
+        uint64_t num_translated = 0;
+        std::chrono::duration<double> lookup_time(0);
+
+        const auto replay_batch = [&page_table, &batch, &num_translated, &lookup_time]() {
+            const auto start = std::chrono::steady_clock::now();
+            for(const auto& event: batch) {
+                if(event.pte) {
+                    page_table.UpdatePTE(event.pid, event.pte);
+                }
+                else {
+                    num_translated += (page_table.GetPageMask(event.pid, event.address) != stf::page_utils::INVALID_PAGE_SIZE);
+                }
+            }
+            lookup_time += std::chrono::steady_clock::now() - start;
+            batch.clear();
+        };
+
+        const auto start = std::chrono::steady_clock::now();
+        for(const auto& inst: reader) {
+            for(size_t i = 0; i < inst.getEmbeddedPTEs().size(); ++i) {
+                stf_assert(next_pte < ptes.size(), "Trace returned more PTEs than the first pass");
+                batch.emplace_back(PTEEvent{&ptes[next_pte++]->as<stf::PageTableWalkRecord>(), 0, inst.pid()});
+            }
+
+            for(const auto& mem_access: inst.getMemoryAccesses()) {
+                ++num_lookups;
+                batch.emplace_back(PTEEvent{nullptr, mem_access.getAddress(), inst.pid()});
+            }
+
+            if(STF_EXPECT_FALSE(batch.size() >= BATCH_SIZE)) {
+                replay_batch();
+            }
+        }
+        replay_batch();
+        const std::chrono::duration<double> total_time = std::chrono::steady_clock::now() - start;
+        const auto read_time = total_time - lookup_time;
+
+        std::cout << "stf::STFInstReader (page table tracking " << (track_ptes ? "on" : "off") << ")"
+                  << std::endl
+                  << "Read "
+                  << reader.numInstsRead()
+                  << " instructions in "
+                  << read_time.count()
+                  << " seconds ("
+                  << (static_cast<double>(reader.numInstsRead()) / read_time.count())
+                  << " insts/s)" << std::endl
+                  << "stf::STF_PTE: "
+                  << next_pte
+                  << " PTE updates, "
+                  << num_lookups
+                  << " lookups ("
+                  << num_translated
+                  << " translated) in "
+                  << lookup_time.count()
+                  << " seconds ("
+                  << (static_cast<double>(num_lookups) / lookup_time.count())
+                  << " lookups/s)" << std::endl;
+    }
+}
+
 int main(int argc, char* argv[]) {
     try {
         int reader = 0;
 
         trace_tools::CommandLineParser parser("stf_bench");
-        parser.addFlag('r', "reader", "Reader to test (0 = all, 1 = STFReader, 2 = STFInstReader, 3 = STFBranchReader)");
+        parser.addFlag('r', "reader", "Reader to test (0 = all, 1 = STFReader, 2 = STFInstReader, 3 = STFBranchReader, 4 = STFInstReader with page table tracking off vs. on, plus STF_PTE lookups)");
         parser.addFlag('u', "Skip non-user instructions (will not apply to STFReader)");
         parser.addFlag('p', "Enable page table tracking");
         parser.addPositionalArgument("trace", "STF to test with");
@@ -88,6 +188,9 @@ int main(int argc, char* argv[]) {
             case 3:
                 readerBench<stf::STFBranchReader>(trace, skip_non_user);
                 break;
+            case 4:
+                pageTableBench(trace, skip_non_user);
+                break;
         };
     }
     catch(const trace_tools::CommandLineParser::EarlyExitException& e) {
@@ -1,9 +1,13 @@
 #include <array>
+#include <exception>
 #include <iostream>
 #include <map>
 #include <random>
 #include <string_view>
+#include <thread>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include <boost/dynamic_bitset.hpp>
 #include "boost_wrappers/flat_map.hpp"
@@ -12,6 +16,20 @@
 #include "stf_branch_reader.hpp"
 #include "stf_decoder.hpp"
 #include "command_line_parser.hpp"
+#include "thread_pool.hpp"
+
+/**
+ * \struct HDF5WriterConfig
+ * Controls how branches are laid out and compressed in the HDF5 dataset
+ */
+struct HDF5WriterConfig {
+    static constexpr size_t DEFAULT_CHUNK_SIZE = 1000; /**< Default number of branches in each HDF5 chunk */
+    static constexpr unsigned int DEFAULT_DEFLATE_LEVEL = 7; /**< Default zlib compression level */
+
+    size_t chunk_size = DEFAULT_CHUNK_SIZE; /**< Number of branches in each HDF5 chunk */
+    unsigned int deflate_level = DEFAULT_DEFLATE_LEVEL; /**< zlib compression level. 0 disables compression. */
+    bool shuffle = true; /**< If true, apply the shuffle filter before compressing */
+};
 
 enum class HDF5Field {
     INDEX,
@@ -155,7 +173,8 @@ void processCommandLine(int argc,
                         size_t& local_history_length,
                         std::unordered_set<HDF5Field>& excluded_fields,
                         size_t& limit_top_branches,
-                        int32_t& wkld_id) {
+                        int32_t& wkld_id,
+                        HDF5WriterConfig& writer_config) {
     trace_tools::CommandLineParser parser("stf_branch_hdf5");
     parser.addFlag('u', "skip non user-mode instructions");
     parser.addFlag('l', "N", "limit output to the top N most frequent branches");
@@ -167,6 +186,9 @@ void processCommandLine(int argc,
     parser.addFlag('L', "L", "Keep a local history of length L (maximum length is 64). If -1 is specified, this field is broken up into single bit fields.");
     parser.addFlag('X', "exclude loop branches");
     parser.addMultiFlag('x', "exclude_field", "exclude specified field. Can be specified multiple times.");
+    parser.addFlag('C', "N", "number of branches in each HDF5 chunk (default " + std::to_string(HDF5WriterConfig::DEFAULT_CHUNK_SIZE) + ")");
+    parser.addFlag('z', "level", "zlib compression level (0-9, default " + std::to_string(HDF5WriterConfig::DEFAULT_DEFLATE_LEVEL) + "). 0 disables compression.");
+    parser.addFlag('S', "disable the HDF5 shuffle filter");
     parser.addPositionalArgument("trace", "trace in STF format");
     parser.addPositionalArgument("output", "output HDF5");
     parser.parseArguments(argc, argv);
@@ -211,6 +233,12 @@ void processCommandLine(int argc,
         excluded_fields.insert(HDF5Field::LOCAL_HISTORY);
     }
 
+    parser.getArgumentValue('C', writer_config.chunk_size);
+    parser.assertCondition(writer_config.chunk_size != 0, "Chunk size must be nonzero");
+    parser.getArgumentValue('z', writer_config.deflate_level);
+    parser.assertCondition(writer_config.deflate_level <= 9, "Compression level must be between 0 and 9");
+    writer_config.shuffle = !parser.hasArgument('S');
+
     parser.getPositionalArgument(0, trace);
     parser.getPositionalArgument(1, output);
 }
@@ -716,18 +744,40 @@ const HDF5BranchBase<false>::BoolType HDF5BranchBase<false>::False = -1;
 template<>
 const HDF5BranchBase<false>::BoolType HDF5BranchBase<false>::True = 1;
 
-template<size_t CHUNK_SIZE, typename BranchType>
+/**
+ * \class HDF5BranchWriter
+ *
+ * Writes branches to an HDF5 dataset. Branches are collected into chunk-sized buffers on the calling thread,
+ * and full buffers are handed to a background thread that extends the dataset and compresses them. Buffers
+ * are recycled once they have been written, so reading the trace never waits on compression unless every
+ * buffer is in flight. Only the background thread calls into HDF5 while it is running.
+ */
+template<typename BranchType>
 class HDF5BranchWriter {
     private:
         static constexpr int RANK_ = 1;
         static constexpr hsize_t MAX_DIMS_[1] = {H5S_UNLIMITED};
-        static constexpr hsize_t CHUNK_DIM_[1] ={CHUNK_SIZE};
-        static constexpr int ZLIB_COMPRESSION_LEVEL = 7;
+        static constexpr size_t NUM_BUFFERS_ = 4;
         static inline const H5std_string DATASET_NAME_{"branch_info"};
 
-        using BufferT = std::array<BranchType, CHUNK_SIZE>;
-        BufferT branch_buffer_{};
-        typename BufferT::iterator it_ = branch_buffer_.begin();
+        using BufferT = std::vector<BranchType>;
+
+        /**
+         * \struct Chunk_
+         * A buffer that is ready to be written, along with the number of valid branches in it
+         */
+        struct Chunk_ {
+            BufferT branches;
+            size_t num_items = 0;
+        };
+
+        using ChunkQueue_ = trace_tools::BoundedQueue<Chunk_>;
+        using BufferQueue_ = trace_tools::BoundedQueue<BufferT>;
+
+        const size_t chunk_size_;
+        const hsize_t chunk_dim_[1];
+        BufferT branch_buffer_;
+        size_t num_buffered_ = 0;
 
         const H5::H5File hdf5_file_;
         const H5::DataSpace chunk_mspace_;
@@ -743,68 +793,150 @@ class HDF5BranchWriter {
 
         typename BranchType::BoolType last_taken_ = BranchType::False;
 
-        inline void writeChunk_(const size_t num_items, const hsize_t chunk_dim[], const H5::DataSpace& mspace) {
+        ChunkQueue_ full_queue_{NUM_BUFFERS_};
+        BufferQueue_ free_queue_{NUM_BUFFERS_};
+        std::exception_ptr writer_exception_;
+        std::thread writer_thread_;
+
+        inline void writeChunk_(const BufferT& branches, const size_t num_items, const hsize_t chunk_dim[], const H5::DataSpace& mspace) {
             const hsize_t hyperslab_offset = cur_slab_dim_[0];
             cur_slab_dim_[0] += num_items;
             dataset_.extend(cur_slab_dim_);
             H5::DataSpace fspace = dataset_.getSpace();
             fspace.selectHyperslab(H5S_SELECT_SET, chunk_dim, &hyperslab_offset);
-            dataset_.write(branch_buffer_.data(), branch_type_, mspace, fspace);
+            dataset_.write(branches.data(), branch_type_, mspace, fspace);
         }
 
-        inline void writeChunk_() {
-            writeChunk_(CHUNK_SIZE, CHUNK_DIM_, chunk_mspace_);
+        inline void writeChunk_(const Chunk_& chunk) {
+            if(STF_EXPECT_TRUE(chunk.num_items == chunk_size_)) {
+                writeChunk_(chunk.branches, chunk.num_items, chunk_dim_, chunk_mspace_);
+            }
+            else {
+                const hsize_t dim[1] = {chunk.num_items};
+                H5::DataSpace mspace(RANK_, dim, MAX_DIMS_);
+                writeChunk_(chunk.branches, chunk.num_items, dim, mspace);
+            }
         }
 
-        static H5::DSetCreatPropList getDataSetProps_() {
+        void writerThread_() {
+            try {
+                Chunk_ chunk;
+                while(full_queue_.pop(chunk)) {
+                    writeChunk_(chunk);
+                    free_queue_.push(std::move(chunk.branches));
+                }
+            }
+            catch(...) {
+                writer_exception_ = std::current_exception();
+                full_queue_.abort();
+                free_queue_.abort();
+            }
+        }
+
+        [[noreturn]] void rethrowWriterException_() {
+            writer_thread_.join();
+            std::rethrow_exception(writer_exception_);
+        }
+
+        /**
+         * Hands the current buffer to the writer thread
+         */
+        void flushBuffer_() {
+            try {
+                full_queue_.push(Chunk_{std::move(branch_buffer_), num_buffered_});
+            }
+            catch(const typename ChunkQueue_::AbortedException&) {
+                rethrowWriterException_();
+            }
+
+            num_buffered_ = 0;
+        }
+
+        static H5::DSetCreatPropList getDataSetProps_(const hsize_t chunk_dim[], const HDF5WriterConfig& config) {
             H5::DSetCreatPropList cparms;
-            cparms.setChunk(RANK_, CHUNK_DIM_);
-            cparms.setShuffle();
-            cparms.setDeflate(ZLIB_COMPRESSION_LEVEL);
+            cparms.setChunk(RANK_, chunk_dim);
+            if(config.shuffle) {
+                cparms.setShuffle();
+            }
+            if(config.deflate_level) {
+                cparms.setDeflate(config.deflate_level);
+            }
             return cparms;
         }
 
     public:
-        explicit HDF5BranchWriter(const std::string& filename, const bool return_random_for_unknown_target_opcode, const std::unordered_set<HDF5Field>& excluded_fields, const int32_t wkld_id, const size_t local_history_length, const stf::INST_IEM iem, const bool decode_target_opcodes) :
+        explicit HDF5BranchWriter(const std::string& filename, const bool return_random_for_unknown_target_opcode, const std::unordered_set<HDF5Field>& excluded_fields, const int32_t wkld_id, const size_t local_history_length, const stf::INST_IEM iem, const bool decode_target_opcodes, const HDF5WriterConfig& config) :
+            chunk_size_(config.chunk_size),
+            chunk_dim_{config.chunk_size},
+            branch_buffer_(chunk_size_),
             hdf5_file_(filename.c_str(), H5F_ACC_TRUNC),
-            chunk_mspace_(RANK_, CHUNK_DIM_, MAX_DIMS_),
+            chunk_mspace_(RANK_, chunk_dim_, MAX_DIMS_),
             branch_type_(BranchType::initBranchType(excluded_fields, local_history_length, decode_target_opcodes)),
-            dataset_(hdf5_file_.createDataSet(DATASET_NAME_, branch_type_, chunk_mspace_, getDataSetProps_())),
+            dataset_(hdf5_file_.createDataSet(DATASET_NAME_, branch_type_, chunk_mspace_, getDataSetProps_(chunk_dim_, config))),
             opcode_map_(return_random_for_unknown_target_opcode, iem),
             wkld_id_(wkld_id),
             local_history_length_(local_history_length),
             decode_target_opcodes_(decode_target_opcodes)
         {
+            for(size_t i = 1; i < NUM_BUFFERS_; ++i) {
+                free_queue_.push(BufferT(chunk_size_));
+            }
+
+            writer_thread_ = std::thread(&HDF5BranchWriter::writerThread_, this);
         }
 
+        HDF5BranchWriter(const HDF5BranchWriter&) = delete;
+        HDF5BranchWriter& operator=(const HDF5BranchWriter&) = delete;
+
         ~HDF5BranchWriter() {
-            if(it_ != branch_buffer_.begin()) {
-                const auto num_items = static_cast<size_t>(std::distance(branch_buffer_.begin(), it_));
-                const hsize_t dim[1] = {num_items};
-                H5::DataSpace mspace(RANK_, dim, MAX_DIMS_);
-                writeChunk_(num_items, dim, mspace);
+            if(writer_thread_.joinable()) {
+                try {
+                    close();
+                }
+                catch(...) {
+                }
+            }
+        }
+
+        /**
+         * Writes any remaining branches and waits for the writer thread to finish.
+         * Rethrows any exception raised while writing.
+         */
+        void close() {
+            if(num_buffered_) {
+                flushBuffer_();
+            }
+
+            full_queue_.close();
+            writer_thread_.join();
+
+            if(writer_exception_) {
+                std::rethrow_exception(writer_exception_);
             }
         }
 
         inline void append(const stf::STFBranch& branch) {
             opcode_map_.updateOpcode(branch.getTargetPC(), branch.getTargetOpcode());
             const auto pc = branch.getPC();
+            auto& cur_branch = branch_buffer_[num_buffered_];
             if(local_history_length_) {
                 auto& cur_local_history = local_history_.try_emplace(pc, local_history_length_).first->second;
-                *it_ = BranchType(branch, opcode_map_, wkld_id_, decode_target_opcodes_, cur_local_history);
+                cur_branch = BranchType(branch, opcode_map_, wkld_id_, decode_target_opcodes_, cur_local_history);
                 cur_local_history <<= 1;
-                cur_local_history.set(0, it_->taken);
+                cur_local_history.set(0, cur_branch.taken);
             }
             else {
-                *it_ = BranchType(branch, opcode_map_, wkld_id_, decode_target_opcodes_);
+                cur_branch = BranchType(branch, opcode_map_, wkld_id_, decode_target_opcodes_);
             }
 
-            it_->last_taken = last_taken_;
-            last_taken_ = BranchType::encodeBool(it_->taken);
-            ++it_;
-            if(it_ == branch_buffer_.end()) {
-                writeChunk_();
-                it_ = branch_buffer_.begin();
+            cur_branch.last_taken = last_taken_;
+            last_taken_ = BranchType::encodeBool(cur_branch.taken);
+            ++num_buffered_;
+            if(num_buffered_ == chunk_size_) {
+                flushBuffer_();
+                if(STF_EXPECT_FALSE(!free_queue_.pop(branch_buffer_))) {
+                    rethrowWriterException_();
+                }
             }
         }
 };
@@ -836,11 +968,10 @@ void processTrace(const std::string& trace,
                   const int32_t wkld_id,
                   const size_t local_history_length,
                   const bool decode_target_opcodes,
-                  const bool exclude_loop_branches) {
-    static constexpr size_t CHUNK_SIZE = 1000;
-
+                  const bool exclude_loop_branches,
+                  const HDF5WriterConfig& writer_config) {
     stf::STFBranchReader reader(trace, skip_non_user);
-    HDF5BranchWriter<CHUNK_SIZE, typename BranchTypeChooser<byte_chunks, use_unsigned_bool>::type> writer(output, always_fill_in_target_opcode, excluded_fields, wkld_id, local_history_length, reader.getInitialIEM(), decode_target_opcodes);
+    HDF5BranchWriter<typename BranchTypeChooser<byte_chunks, use_unsigned_bool>::type> writer(output, always_fill_in_target_opcode, excluded_fields, wkld_id, local_history_length, reader.getInitialIEM(), decode_target_opcodes, writer_config);
 
     if(top_branches.empty()) {
         for(const auto& branch: reader) {
@@ -856,6 +987,8 @@ void processTrace(const std::string& trace,
             }
         }
     }
+
+    writer.close();
 }
 
 std::set<uint64_t> getTopBranches(const std::string& trace, const bool skip_non_user, const size_t limit_top_branches) {
@@ -898,6 +1031,7 @@ int main(int argc, char** argv) {
     size_t limit_top_branches = 0;
     int32_t wkld_id = -1;
     size_t local_history_length = 0;
+    HDF5WriterConfig writer_config;
 
     try {
         processCommandLine(argc,
@@ -913,7 +1047,8 @@ int main(int argc, char** argv) {
                            local_history_length,
                            excluded_fields,
                            limit_top_branches,
-                           wkld_id);
+                           wkld_id,
+                           writer_config);
     }
     catch(const trace_tools::CommandLineParser::EarlyExitException& e) {
         std::cerr << e.what() << std::endl;
@@ -924,18 +1059,18 @@ int main(int argc, char** argv) {
 
     if(use_unsigned_bool) {
         if(byte_chunks) {
-            processTrace<true, true>(trace, output, skip_non_user, always_fill_in_target_opcode, top_branches, excluded_fields, wkld_id, local_history_length, decode_target_opcodes, exclude_loop_branches);
+            processTrace<true, true>(trace, output, skip_non_user, always_fill_in_target_opcode, top_branches, excluded_fields, wkld_id, local_history_length, decode_target_opcodes, exclude_loop_branches, writer_config);
         }
         else {
-            processTrace<true, false>(trace, output, skip_non_user, always_fill_in_target_opcode, top_branches, excluded_fields, wkld_id, local_history_length, decode_target_opcodes, exclude_loop_branches);
+            processTrace<true, false>(trace, output, skip_non_user, always_fill_in_target_opcode, top_branches, excluded_fields, wkld_id, local_history_length, decode_target_opcodes, exclude_loop_branches, writer_config);
         }
     }
     else {
         if(byte_chunks) {
-            processTrace<false, true>(trace, output, skip_non_user, always_fill_in_target_opcode, top_branches, excluded_fields, wkld_id, local_history_length, decode_target_opcodes, exclude_loop_branches);
+            processTrace<false, true>(trace, output, skip_non_user, always_fill_in_target_opcode, top_branches, excluded_fields, wkld_id, local_history_length, decode_target_opcodes, exclude_loop_branches, writer_config);
         }
         else {
-            processTrace<false, false>(trace, output, skip_non_user, always_fill_in_target_opcode, top_branches, excluded_fields, wkld_id, local_history_length, decode_target_opcodes, exclude_loop_branches);
+            processTrace<false, false>(trace, output, skip_non_user, always_fill_in_target_opcode, top_branches, excluded_fields, wkld_id, local_history_length, decode_target_opcodes, exclude_loop_branches, writer_config);
         }
     }
 
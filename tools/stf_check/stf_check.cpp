@@ -26,10 +26,13 @@
 
 */
 
+#include <atomic>
 #include <string>
 #include <sstream>
 #include <cstring>
 #include <iomanip>
+#include <limits>
+#include <memory>
 #include <vector>
 #include <fstream>
 #include <unordered_map>
@@ -40,6 +43,8 @@
 #include "stf_decoder.hpp"
 #include "stf_enums.hpp"
 #include "stf_inst_reader.hpp"
+#include "stf_writer.hpp"
+#include "thread_pool.hpp"
 #include "tools_util.hpp"
 
 static STFCheckConfig parse_command_line (int argc, char **argv) {
@@ -55,7 +60,9 @@ static STFCheckConfig parse_command_line (int argc, char **argv) {
     parser.addFlag('v', "always print error counts at the end");
     parser.addFlag('e', "M", "end checking at M-th instruction");
     parser.addMultiFlag('i', "err", "ignore the specified error type");
+    parser.addFlag('j', "N", "check trace segments in parallel using N threads. 0 uses all available hardware threads.");
     parser.addPositionalArgument("trace", "trace in STF format");
+    parser.setMutuallyExclusive('j', 'u');
 
     parser.parseArguments(argc, argv);
     config.skip_non_user = parser.hasArgument('u');
@@ -64,6 +71,7 @@ static STFCheckConfig parse_command_line (int argc, char **argv) {
     config.print_info = parser.hasArgument('p');
     config.check_phys_addr = !parser.hasArgument('n');
     parser.getArgumentValue('e', config.end_inst);
+    parser.getArgumentValue('j', config.num_threads);
     config.always_print_error_counts = parser.hasArgument('v');
     for(const auto& err: parser.getMultipleValueArgument('i')) {
         config.ignored_errors.insert(parseErrorCode(err));
@@ -74,129 +82,75 @@ static STFCheckConfig parse_command_line (int argc, char **argv) {
     return config;
 }
 
-inline bool isVectorMemAccessMasked(const stf::STFInst& inst) {
-    if(inst.isVector()) {
-        const auto vl = inst.getSourceOperand(stf::Registers::STF_REG::STF_REG_CSR_VL);
-        const auto v0 = inst.getSourceOperand(stf::Registers::STF_REG::STF_REG_V0);
-
-        if(!vl.second) {
-            return false;
-        }
-        else {
-            auto vlen = vl.first->getScalarValue();
-
-            // If VL == 0, all accesses are masked
-            if(vlen == 0) {
-                return true;
-            }
-            // If V0 is specified, bits [VL-1:0] define the mask
-            // If all of the mask bits are 0, then all load/store accesses are masked
-            else if(v0.second) {
-                // Calculate how many vector elements are needed to hold the mask
-                const auto num_mask_elements = stf::InstRegRecord::calcVectorLen(vlen);
-                stf_assert(num_mask_elements != 0, "There should be at least 1 mask element if vlen != 0");
-
-                const auto& v0_data = v0.first->getVectorValue();
-                using ElementType = std::remove_reference_t<decltype(v0_data)>::value_type;
-
-                // This loop handles the first n-1 mask elements - each one is a full vector element,
-                // so we can do a simple equality check with 0
-                for(size_t i = 0; i < num_mask_elements - 1; ++i) {
-                    if(STF_EXPECT_FALSE(v0_data[i] != 0)) {
-                        return false;
-                    }
-                    // Subtract the number of bits in this element from vlen so we can calculate
-                    // the mask in the final step
-                    vlen -= stf::byte_utils::bitSize<ElementType>();
-                }
-
-                // Check the final mask element - this one may not take up a full vector element,
-                // so we check with a mask instead
-                const auto final_element_mask = stf::byte_utils::bitMask<ElementType>(vlen);
-                return (v0_data[num_mask_elements - 1] & final_element_mask) == 0;
-            }
-        }
+/**
+ * \struct InstCheckCounts
+ * Holds the counts accumulated while checking instructions
+ */
+struct InstCheckCounts {
+    uint64_t inst_count = 0;            // Number of instructions checked.
+    uint64_t embed_pte_count = 0;       // Number of embedded pte entries found in trace.
+    uint64_t pa_count = 0;              // Number of mem PA records found in trace.
+    uint64_t phys_pc_count = 0;         // Number of inst_phys_pc values in trace.
+
+    InstCheckCounts& operator+=(const InstCheckCounts& rhs) {
+        inst_count += rhs.inst_count;
+        embed_pte_count += rhs.embed_pte_count;
+        pa_count += rhs.pa_count;
+        phys_pc_count += rhs.phys_pc_count;
+        return *this;
     }
+};
 
-    return false;
-}
-
-int main (int argc, char **argv) {
-    try {
-        uint64_t inst_count = 0;
-        uint64_t hdr_pte_count = 0;         // Number of pte entries found in trace header.
-        uint64_t embed_pte_count = 0;       // Number of embedded pte entries found in trace.
-        uint64_t pa_count = 0;              // Number of mem PA records found in trace.
-        uint64_t phys_pc_count = 0;         // Number of inst_phys_pc values in trace.
-
-        const STFCheckConfig config = parse_command_line (argc, argv);
-        ErrorTracker ecount(config.ignored_errors);
-        ecount.setContinueOnError(config.continue_on_error);
-
-        // Keep track of thread_info;
-        uint32_t hw_tid = 0;
-        uint32_t pid = 0;
-        uint32_t tid = 0;
-        uint32_t hw_tid_prev = std::numeric_limits<uint32_t>::max();
-        uint32_t pid_prev = std::numeric_limits<uint32_t>::max();
-        uint32_t tid_prev = std::numeric_limits<uint32_t>::max();
-        bool thread_switch = false;
-        ThreadMap thread_pc_prev;
-        ThreadMapKey thread_id;
-
-        // Open stf trace reader
-        stf::STFInstReader stf_reader(config.trace_filename, config.skip_non_user, config.check_phys_addr);
-        stf::STFDecoder decoder(stf_reader.getInitialIEM());
-        /* FIXME Because we have not kept up with STF versioning, this is currently broken and must be loosened.
-        if (!stf_reader.checkVersion()) {
-            exit(1);
+/**
+ * \class InstChecker
+ * Checks instructions for known issues. Errors go to an ErrorTracker when the trace is checked serially, or
+ * to an ErrorRecorder when it is checked in parallel.
+ */
+template<typename ErrorSinkType>
+class InstChecker {
+    private:
+        const STFCheckConfig& config_;
+        const bool has_phys_addr_feature_;
+        stf::STFDecoder decoder_;
+        ErrorSinkType& ecount_;
+        InstCheckCounts counts_;
+
+    public:
+        InstChecker(const STFCheckConfig& config,
+                    const bool has_phys_addr_feature,
+                    const stf::INST_IEM iem,
+                    ErrorSinkType& ecount) :
+            config_(config),
+            has_phys_addr_feature_(has_phys_addr_feature),
+            decoder_(iem),
+            ecount_(ecount)
+        {
         }
-        */
 
-        // Get initial trace thread info
-        if(const auto it = stf_reader.begin(); it != stf_reader.end()) {
-            const auto& inst = *it;
-            hw_tid_prev = inst.hwtid();
-            pid_prev = inst.pid();
-            tid_prev = inst.tid();
-            thread_id = std::make_tuple(hw_tid_prev, pid_prev, tid_prev);
-            thread_pc_prev[thread_id] = inst;
+        /**
+         * Gets the counts accumulated so far
+         */
+        const InstCheckCounts& getCounts() const {
+            return counts_;
         }
 
-        const auto& trace_features = stf_reader.getTraceFeatures();
-        const bool has_rv64_inst = stf_reader.getInitialIEM() == stf::INST_IEM::STF_INST_IEM_RV64;
-        bool ignore_rv64_error = false;
+        /**
+         * Checks an instruction
+         * \param inst Instruction to check
+         * \param inst_prev Summary of the previous instruction from the same thread
+         * \param thread_switch Whether the instruction before inst came from a different thread
+         * \param inst_count 1-based position of inst in the trace
+         * \returns false if inst is past the last instruction that should be checked
+         */
+        bool check(const stf::STFInst& inst,
+                   const InstSummary& inst_prev,
+                   const bool thread_switch,
+                   const uint64_t inst_count) {
+            ++counts_.inst_count;
 
-        for(const auto& info: stf_reader.getTraceInfo()) {
-            if (info->getGenerator() != stf::STF_GEN::STF_GEN_RESERVED) {      // Check for a valid header.
-                try {
-                    std::cout << "Trace generator: " << info->getGenerator() << std::endl;
-                }
-                catch(const stf::STFException& e) {
-                    ecount.countError(ErrorCode::HEADER);
-                    ecount.reportError(ErrorCode::HEADER) << e.what() << std::endl;
-                }
-                std::cout << "Trace generator version: " << info->getVersionString() << std::endl;
-                std::cout << "Comment: " << info->getComment() << std::endl;
-                std::cout << "Features: ";
-                stf::print_utils::printHex(trace_features->getFeatures());
-                if(info->getGenerator() == stf::STF_GEN::STF_GEN_SPIKE) {
-                    ignore_rv64_error = true;
-                }
-                std::cout << std::endl;
-            }
-            else {
-                ecount.countError(ErrorCode::HEADER);
-                ecount.reportError(ErrorCode::HEADER) << "Invalid trace info record found" << std::endl;
-            }
-        }
-
-        // Iterate through all of the records, checking for known issues.
-        for (const auto& inst: stf_reader) {
-            inst_count++;
             if (!inst.valid()) {
-                ecount.countError(ErrorCode::INVALID_INST);
-                auto& msg = ecount.reportError(ErrorCode::INVALID_INST);
+                ecount_.countError(ErrorCode::INVALID_INST);
+                auto& msg = ecount_.reportError(ErrorCode::INVALID_INST);
                 msg << inst.index() << " invalid instruction ";
                 stf::format_utils::formatHex(msg, inst.opcode());
                 msg << " PC ";
@@ -204,40 +158,29 @@ int main (int argc, char **argv) {
                 msg << std::endl;
             }
 
-            hw_tid = inst.hwtid();
-            pid = inst.pid();
-            tid = inst.tid();
-            thread_id = std::make_tuple(hw_tid, pid, tid);
-            thread_switch = (tid != tid_prev || pid != pid_prev || hw_tid != hw_tid_prev);
-            hw_tid_prev = hw_tid;
-            pid_prev = pid;
-            tid_prev = tid;
-            const auto& inst_prev = thread_pc_prev[thread_id];
-            decoder.decode(inst_prev.opcode());
+            decoder_.decode(inst_prev.opcode);
 
             //check if trace has physical address translations
-            if (config.check_phys_addr && !trace_features->hasFeature(stf::TRACE_FEATURES::STF_CONTAIN_PHYSICAL_ADDRESS)) {
-                ecount.countError(ErrorCode::PHYS_ADDR);
-                auto& msg = ecount.reportError(ErrorCode::PHYS_ADDR);
+            if (config_.check_phys_addr && !has_phys_addr_feature_) {
+                ecount_.countError(ErrorCode::PHYS_ADDR);
+                auto& msg = ecount_.reportError(ErrorCode::PHYS_ADDR);
                 stf::format_utils::formatDecLeft(msg, inst.index(), MAX_COUNT_LENGTH);
                 msg << "STF_CONTAIN_PHYSICAL_ADDRESS not set, but is required as part of the default tracing configuration" << std::endl;
             }
 
-            const auto& prev_events = inst_prev.getEvents();
-
             // Check for decoder failures on non-faulting instructions
-            if(STF_EXPECT_FALSE(decoder.decodeFailed() && prev_events.empty())) {
-                ecount.countError(ErrorCode::DECODER_FAILURE);
-                auto& msg = ecount.reportError(ErrorCode::DECODER_FAILURE);
+            if(STF_EXPECT_FALSE(decoder_.decodeFailed() && !inst_prev.has_events)) {
+                ecount_.countError(ErrorCode::DECODER_FAILURE);
+                auto& msg = ecount_.reportError(ErrorCode::DECODER_FAILURE);
                 stf::format_utils::formatDecLeft(msg, inst.index(), MAX_COUNT_LENGTH);
                 msg << " Failed to decode instruction." << std::endl;
             }
 
             //check if inst is_load or is_store and doesn't have memory accesses when it should
             if (STF_EXPECT_FALSE(
-                    decoder.isLoad() && // it decodes as a load
-                    (!inst_prev.isLoad() || inst_prev.getMemoryReads().empty()) && // but it isn't doing any loads
-                    prev_events.empty())) { // and there are no events stopping it from doing a load
+                    decoder_.isLoad() && // it decodes as a load
+                    !inst_prev.has_mem_reads && // but it isn't doing any loads
+                    !inst_prev.has_events)) { // and there are no events stopping it from doing a load
                 bool found = false;
                 // Commenting this out for now since RISC-V doesn't have software prefetches
                 /*
@@ -250,21 +193,21 @@ int main (int argc, char **argv) {
                 }
                 */
                 // Check for special cases where all vector loads are masked
-                found = isVectorMemAccessMasked(inst_prev);
+                found = inst_prev.vector_mem_access_masked;
 
                 if(STF_EXPECT_FALSE(!found)) {
-                    ecount.countError(ErrorCode::MISS_MEM);
-                    ecount.countError(ErrorCode::MISS_MEM_LOAD);
-                    auto& msg = ecount.reportError(ErrorCode::MISS_MEM_LOAD);
+                    ecount_.countError(ErrorCode::MISS_MEM);
+                    ecount_.countError(ErrorCode::MISS_MEM_LOAD);
+                    auto& msg = ecount_.reportError(ErrorCode::MISS_MEM_LOAD);
                     stf::format_utils::formatDecLeft(msg, inst.index(), MAX_COUNT_LENGTH);
                     msg << " Load instruction missing memory access record in stf." << std::endl;
                 }
             }
             if (STF_EXPECT_FALSE(
-                    decoder.isStore() && // it decodes as a store
-                    (!inst_prev.isStore() || inst_prev.getMemoryWrites().empty()) && // but it isn't doing any stores
-                    prev_events.empty() && // and there are no events stopping it from doing a store
-                    !decoder.isAtomic())) { // and this isn't an atomic inst (store-conditional)
+                    decoder_.isStore() && // it decodes as a store
+                    !inst_prev.has_mem_writes && // but it isn't doing any stores
+                    !inst_prev.has_events && // and there are no events stopping it from doing a store
+                    !decoder_.isAtomic())) { // and this isn't an atomic inst (store-conditional)
                 bool found = false;
                 // Commenting this out for now since RISC-V doesn't have software prefetches
                 /*
@@ -277,25 +220,25 @@ int main (int argc, char **argv) {
                 }
                 */
                 // Check for special cases where all vector stores are masked
-                found = isVectorMemAccessMasked(inst_prev);
+                found = inst_prev.vector_mem_access_masked;
 
                 if (!found) {
-                    ecount.countError(ErrorCode::MISS_MEM);
-                    ecount.countError(ErrorCode::MISS_MEM_STR);
-                    auto& msg = ecount.reportError(ErrorCode::MISS_MEM_STR);
+                    ecount_.countError(ErrorCode::MISS_MEM);
+                    ecount_.countError(ErrorCode::MISS_MEM_STR);
+                    auto& msg = ecount_.reportError(ErrorCode::MISS_MEM_STR);
                     stf::format_utils::formatDecLeft(msg, inst.index(), MAX_COUNT_LENGTH);
                     msg << " Store instruction missing memory access record in stf." << std::endl;
                 }
             }
 
-            if (STF_EXPECT_FALSE(config.end_inst && (inst.index() > config.end_inst))) {
-                break;
+            if (STF_EXPECT_FALSE(config_.end_inst && (inst.index() > config_.end_inst))) {
+                return false;
             }
 
             if(STF_EXPECT_FALSE((inst.pc() & 1) != 0)) {
                 if(inst.isOpcode16()) {
-                    ecount.countError(ErrorCode::INVALID_PC_16);
-                    auto& msg = ecount.reportError(ErrorCode::INVALID_PC_16);
+                    ecount_.countError(ErrorCode::INVALID_PC_16);
+                    auto& msg = ecount_.reportError(ErrorCode::INVALID_PC_16);
                     msg << "Invalid pc value found in mode at instruction #";
                     stf::format_utils::formatDec(msg, inst.index());
                     msg << " pc value: ";
@@ -303,8 +246,8 @@ int main (int argc, char **argv) {
                     msg << std::endl;
                 }
                 else {
-                    ecount.countError(ErrorCode::INVALID_PC_32);
-                    auto& msg = ecount.reportError(ErrorCode::INVALID_PC_32);
+                    ecount_.countError(ErrorCode::INVALID_PC_32);
+                    auto& msg = ecount_.reportError(ErrorCode::INVALID_PC_32);
                     msg << "Invalid pc value found in mode at instruction #";
                     stf::format_utils::formatDec(msg, inst.index());
                     msg << " pc value: ";
@@ -313,28 +256,24 @@ int main (int argc, char **argv) {
                 }
             }
 
-            if(STF_EXPECT_FALSE(inst_count > 1 && inst.pc() != (inst_prev.pc() + inst_prev.opcodeSize()))) {
+            if(STF_EXPECT_FALSE(inst_count > 1 && inst.pc() != (inst_prev.pc + inst_prev.opcode_size))) {
                 bool valid_jump = false;
-                if(STF_EXPECT_FALSE(inst_prev.isTakenBranch() && inst_prev.branchTarget() == inst.pc())) {
+                if(STF_EXPECT_FALSE(inst_prev.taken_branch && inst_prev.branch_target == inst.pc())) {
                     valid_jump = true;
                 }
                 else {
-                    valid_jump = !prev_events.empty() && !std::any_of(prev_events.begin(),
-                                                                      prev_events.end(),
-                                                                      [&](const auto& event) {
-                                                                          return event.targetValid() && (event.getTarget() != inst.pc());
-                                                                      });
+                    valid_jump = inst_prev.has_events && !inst_prev.hasEventTargetMismatch(inst.pc());
                 }
 
                 if(STF_EXPECT_FALSE(!valid_jump)) {
-                    ecount.countError(ErrorCode::PC_DISCONTINUITY);
-                    auto& msg = ecount.reportError(ErrorCode::PC_DISCONTINUITY);
+                    ecount_.countError(ErrorCode::PC_DISCONTINUITY);
+                    auto& msg = ecount_.reportError(ErrorCode::PC_DISCONTINUITY);
                     msg << "PC discontinuity found between instruction #";
-                    stf::format_utils::formatDec(msg, inst_prev.index());
+                    stf::format_utils::formatDec(msg, inst_prev.index);
                     msg << " and ";
                     stf::format_utils::formatDec(msg, inst.index());
                     msg << " first pc value: ";
-                    stf::format_utils::formatVA(msg, inst_prev.pc());
+                    stf::format_utils::formatVA(msg, inst_prev.pc);
                     msg << " second pc value: ";
                     stf::format_utils::formatVA(msg, inst.pc());
                     msg << std::endl;
@@ -346,9 +285,9 @@ int main (int argc, char **argv) {
             for(const auto& mem_access: mem_accesses) {
                 // Check if accesses address zero
                 if (STF_EXPECT_FALSE(mem_access.getAddress() == 0)) {
-                    ecount.countError(ErrorCode::MEM_POINT_TO_ZERO);
-                    if (config.print_memory_zero_warnings) {
-                        auto& msg = ecount.reportError(ErrorCode::MEM_POINT_TO_ZERO);
+                    ecount_.countError(ErrorCode::MEM_POINT_TO_ZERO);
+                    if (config_.print_memory_zero_warnings) {
+                        auto& msg = ecount_.reportError(ErrorCode::MEM_POINT_TO_ZERO);
                         msg << "Instruction memory record points to vaddr 0 at instruction #";
                         stf::format_utils::formatDec(msg, inst.index());
                         msg << " pc value: ";
@@ -359,15 +298,15 @@ int main (int argc, char **argv) {
 
                 // Commenting this check out for now because the attribute field isn't really used for anything yet
                 //if (STF_EXPECT_FALSE(mem_access.getAttr() == 0)) {
-                //    ecount.countError(ErrorCode::MEM_ATTR);
-                //    auto& msg = ecount.reportError(ErrorCode::MEM_ATTR);
+                //    ecount_.countError(ErrorCode::MEM_ATTR);
+                //    auto& msg = ecount_.reportError(ErrorCode::MEM_ATTR);
                 //    msg << "The Instruction accesses memory. But there is no memory access attribute record at instruction index " << inst.index() << std::endl;
                 //}
 
                 // Check to see if paddr is valid.
 
                 if (mem_access.addressTranslationEnabled()) {
-                    pa_count++;
+                    ++counts_.pa_count;
                     const uint64_t phys_addr = mem_access.getPhysAddress();
 
                     if(phys_addr == 0) {
@@ -388,14 +327,14 @@ int main (int argc, char **argv) {
                             }
                         }
                         if(!is_ls_fault) {
-                            ecount.countError(ErrorCode::PA_EQ_0);
-                            auto& msg = ecount.reportError(ErrorCode::PA_EQ_0);
+                            ecount_.countError(ErrorCode::PA_EQ_0);
+                            auto& msg = ecount_.reportError(ErrorCode::PA_EQ_0);
                             msg << "PA == 0 at instruction index " << std::dec << inst.index() << std::endl;
                         }
                     }
                     else if ((phys_addr & 0xfff) != (mem_access.getAddress() & 0xfff)) {
-                        ecount.countError(ErrorCode::PA_NE_VA);
-                        auto& msg = ecount.reportError(ErrorCode::PA_NE_VA);
+                        ecount_.countError(ErrorCode::PA_NE_VA);
+                        auto& msg = ecount_.reportError(ErrorCode::PA_NE_VA);
                         msg << "PA & 0xfff != VA & 0xfff at instruction index " << std::dec << inst.index() << std::endl;
                     }
                 }
@@ -420,41 +359,41 @@ int main (int argc, char **argv) {
                         }
                     }
                     if(!is_inst_fault) {
-                        ecount.countError(ErrorCode::INVALID_PHYS);
-                        auto& msg = ecount.reportError(ErrorCode::INVALID_PHYS);
+                        ecount_.countError(ErrorCode::INVALID_PHYS);
+                        auto& msg = ecount_.reportError(ErrorCode::INVALID_PHYS);
                         msg << "Invalid phys PC value at index " << std::dec << inst.index() << std::endl;
                     }
                 }
                 else {
-                    phys_pc_count++;
+                    ++counts_.phys_pc_count;
                 }
             }
 
             // Check for embedded PTEs
-            embed_pte_count += inst.getEmbeddedPTEs().size();
+            counts_.embed_pte_count += inst.getEmbeddedPTEs().size();
 
             // check if unconditional branch contains PC_TARGET
             // If last instruction is an unconditional branch, it will not have PC TARGET.
             if (STF_EXPECT_TRUE(!thread_switch)) {
-                if (STF_EXPECT_FALSE(decoder.isBranch() && !decoder.isConditional())) {
-                    if (STF_EXPECT_FALSE(prev_events.empty() && (!inst_prev.isTakenBranch()))) {
-                        ecount.countError(ErrorCode::UNCOND_BR);
-                        auto& msg = ecount.reportError(ErrorCode::UNCOND_BR);
-                        stf::format_utils::formatDecLeft(msg, inst_prev.index(), MAX_COUNT_LENGTH);
+                if (STF_EXPECT_FALSE(decoder_.isBranch() && !decoder_.isConditional())) {
+                    if (STF_EXPECT_FALSE(!inst_prev.has_events && (!inst_prev.taken_branch))) {
+                        ecount_.countError(ErrorCode::UNCOND_BR);
+                        auto& msg = ecount_.reportError(ErrorCode::UNCOND_BR);
+                        stf::format_utils::formatDecLeft(msg, inst_prev.index, MAX_COUNT_LENGTH);
                         msg << " 0x";
-                        stf::format_utils::formatVA(msg, inst_prev.pc());
+                        stf::format_utils::formatVA(msg, inst_prev.pc);
                         msg << " Unconditional Branch instr does not have PC Target(no event)." << std::endl;
                     }
                 }
 
                 // if switch to user mode; check if previous instruction is sret or mret
                 // Ignore this for the first instruction in the trace
-                if (STF_EXPECT_FALSE(inst_count > 2 && inst_prev.isChangeToUserMode() && !decoder.isExceptionReturn())) {
-                    ecount.countError(ErrorCode::SWITCH_USR);
-                    auto& msg = ecount.reportError(ErrorCode::SWITCH_USR);
-                    stf::format_utils::formatDecLeft(msg, inst_prev.index(), MAX_COUNT_LENGTH);
+                if (STF_EXPECT_FALSE(inst_count > 2 && inst_prev.change_to_user_mode && !decoder_.isExceptionReturn())) {
+                    ecount_.countError(ErrorCode::SWITCH_USR);
+                    auto& msg = ecount_.reportError(ErrorCode::SWITCH_USR);
+                    stf::format_utils::formatDecLeft(msg, inst_prev.index, MAX_COUNT_LENGTH);
                     msg << " 0x";
-                    stf::format_utils::formatVA(msg, inst_prev.pc());
+                    stf::format_utils::formatVA(msg, inst_prev.pc);
                     msg << " Switch to user mode ";
                     stf::format_utils::formatDec(msg, inst.index(), MAX_COUNT_LENGTH);
                     msg << " 0x";
@@ -463,7 +402,352 @@ int main (int argc, char **argv) {
                 }
             }
 
-            thread_pc_prev[thread_id] = inst;
+            return true;
+        }
+};
+
+/**
+ * \class ParallelChecker
+ * Checks a trace on multiple threads.
+ *
+ * The trace is split into chunk-aligned segments, and each segment is checked by a worker with its own
+ * reader, decoder and ErrorRecorder. Most checks compare an instruction to the previous instruction from
+ * the same thread, so a worker can't check the first instruction it sees from each thread. Those
+ * instructions are saved and checked by a stitching pass, using the last instruction from each thread in
+ * the earlier segments. The stitching pass then replays every error in trace order, so the messages, error
+ * counts and exit code are identical to a serial check.
+ *
+ * Segments are stitched as soon as every earlier segment has been stitched, and are freed once their errors
+ * have been replayed, so only a few segments per thread are held in memory at once.
+ */
+class ParallelChecker {
+    private:
+        static constexpr uint64_t SEGMENT_SIZE_ = 64 * stf::STFWriter::DEFAULT_CHUNK_SIZE;
+        static constexpr size_t MAX_PENDING_SEGMENTS_PER_THREAD_ = 2;
+
+        /**
+         * \struct DeferredInst_
+         * Instruction whose check has to wait for the stitching pass
+         */
+        struct DeferredInst_ {
+            uint64_t position; // 0-based index of the instruction in the trace
+            stf::STFInst inst;
+            bool first_in_segment; // If true, the previous instruction is in an earlier segment
+        };
+
+        /**
+         * \struct Segment_
+         * Holds everything a worker found in a single segment
+         */
+        struct Segment_ {
+            ErrorRecorder errors;
+            InstCheckCounts counts;
+            std::vector<DeferredInst_> deferred;
+            ThreadMap last_insts; // Summary of the last instruction from each thread
+            ThreadMapKey last_thread;
+
+            explicit Segment_(const std::unordered_set<ErrorCode>& ignored_errors) :
+                errors(ignored_errors)
+            {
+            }
+        };
+
+        using SegmentQueue_ = trace_tools::OrderedCommitQueue<std::unique_ptr<Segment_>>;
+
+        const STFCheckConfig& config_;
+        const bool has_phys_addr_feature_;
+        const stf::INST_IEM iem_;
+        const uint64_t end_position_;
+
+        /**
+         * Checks a single segment
+         * \returns false if no more segments should be checked
+         */
+        bool checkSegment_(const size_t segment_idx, Segment_& segment) const {
+            const uint64_t start = segment_idx * SEGMENT_SIZE_;
+            const uint64_t end = std::min(start + SEGMENT_SIZE_, end_position_);
+
+            stf::STFInstReader stf_reader(config_.trace_filename, false, config_.check_phys_addr);
+            InstChecker<ErrorRecorder> checker(config_, has_phys_addr_feature_, iem_, segment.errors);
+
+            auto it = stf_reader.begin(start);
+            const auto end_it = stf_reader.end();
+            uint64_t position = start;
+
+            for(; it != end_it && position < end; ++it, ++position) {
+                const auto& inst = *it;
+                const ThreadMapKey thread_id(inst.hwtid(), inst.pid(), inst.tid());
+
+                if(const auto prev_it = segment.last_insts.find(thread_id); prev_it == segment.last_insts.end()) {
+                    segment.deferred.emplace_back(DeferredInst_{position, inst, position == start});
+                    segment.last_insts.emplace(thread_id, inst);
+                }
+                else {
+                    segment.errors.setPosition(position);
+                    if(STF_EXPECT_FALSE(!checker.check(inst, prev_it->second, thread_id != segment.last_thread, position + 1))) {
+                        break;
+                    }
+                    prev_it->second = InstSummary(inst);
+                }
+
+                segment.last_thread = thread_id;
+            }
+
+            segment.counts = checker.getCounts();
+
+            // Once an error has been found, every later segment would be discarded by the exit on the first error
+            const bool stop_on_error = !config_.continue_on_error && !segment.errors.getReports().empty();
+
+            return position == end && end != end_position_ && it != end_it && !stop_on_error;
+        }
+
+        /**
+         * Replays the errors from a segment and its deferred instructions in trace order
+         */
+        static void replayErrors_(ErrorTracker& ecount,
+                                  const std::vector<ErrorRecorder::Report>& segment_reports,
+                                  const std::vector<ErrorRecorder::Report>& deferred_reports) {
+            auto segment_it = segment_reports.begin();
+            auto deferred_it = deferred_reports.begin();
+
+            while(segment_it != segment_reports.end() || deferred_it != deferred_reports.end()) {
+                if(deferred_it == deferred_reports.end() ||
+                   (segment_it != segment_reports.end() && segment_it->position < deferred_it->position)) {
+                    ecount.reportError(*segment_it);
+                    ++segment_it;
+                }
+                else {
+                    ecount.reportError(*deferred_it);
+                    ++deferred_it;
+                }
+            }
+        }
+
+    public:
+        /**
+         * Constructs a ParallelChecker
+         * \param config stf_check configuration
+         * \param has_phys_addr_feature Whether the trace has the STF_CONTAIN_PHYSICAL_ADDRESS feature
+         * \param iem Initial instruction encoding mode of the trace
+         */
+        ParallelChecker(const STFCheckConfig& config, const bool has_phys_addr_feature, const stf::INST_IEM iem) :
+            config_(config),
+            has_phys_addr_feature_(has_phys_addr_feature),
+            iem_(iem),
+            end_position_(config.end_inst ? config.end_inst + 1 : std::numeric_limits<uint64_t>::max())
+        {
+        }
+
+        /**
+         * Checks the trace
+         * \param ecount ErrorTracker that receives the errors
+         * \returns Counts accumulated over the whole trace
+         */
+        InstCheckCounts run(ErrorTracker& ecount) const {
+            InstCheckCounts counts;
+            ErrorRecorder deferred_errors(config_.ignored_errors);
+            InstChecker<ErrorRecorder> checker(config_, has_phys_addr_feature_, iem_, deferred_errors);
+            ThreadMap thread_pc_prev;
+            ThreadMapKey prev_thread;
+
+            // When stopping on the first error, the segment that contains it is replayed on the calling thread
+            // after the workers have stopped, since replaying it exits the program
+            std::unique_ptr<Segment_> failed_segment;
+            std::atomic<bool> failed(false);
+
+            SegmentQueue_ segment_queue(
+                MAX_PENDING_SEGMENTS_PER_THREAD_ * trace_tools::getNumWorkerThreads(config_.num_threads),
+                [&](std::unique_ptr<Segment_>&& segment) {
+                    // Every segment after the first error is discarded
+                    if(failed_segment) {
+                        return;
+                    }
+
+                    for(const auto& deferred: segment->deferred) {
+                        const auto& inst = deferred.inst;
+                        const ThreadMapKey thread_id(inst.hwtid(), inst.pid(), inst.tid());
+
+                        // The first instruction in the trace is checked against itself
+                        if(deferred.position == 0) {
+                            thread_pc_prev[thread_id] = InstSummary(inst);
+                            prev_thread = thread_id;
+                        }
+
+                        deferred_errors.setPosition(deferred.position);
+                        checker.check(inst,
+                                      thread_pc_prev[thread_id],
+                                      !deferred.first_in_segment || thread_id != prev_thread,
+                                      deferred.position + 1);
+                    }
+
+                    for(auto& thread_inst: segment->last_insts) {
+                        thread_pc_prev.insert_or_assign(thread_inst.first, thread_inst.second);
+                    }
+                    prev_thread = segment->last_thread;
+
+                    counts += segment->counts;
+
+                    if(!config_.continue_on_error &&
+                       (!segment->errors.getReports().empty() || !deferred_errors.getReports().empty())) {
+                        failed_segment = std::move(segment);
+                        failed = true;
+                        return;
+                    }
+
+                    ecount.countErrors(segment->errors);
+                    replayErrors_(ecount, segment->errors.getReports(), deferred_errors.getReports());
+                    deferred_errors.clearReports();
+                    segment.reset();
+                }
+            );
+
+            trace_tools::parallelForUntil(
+                config_.num_threads,
+                [this, &segment_queue, &failed](const size_t segment_idx, const size_t) {
+                    try {
+                        segment_queue.waitForSlot(segment_idx);
+
+                        if(failed) {
+                            segment_queue.commit(segment_idx, nullptr);
+                            return false;
+                        }
+
+                        auto segment = std::make_unique<Segment_>(config_.ignored_errors);
+                        const bool more_segments = checkSegment_(segment_idx, *segment);
+                        segment_queue.commit(segment_idx, std::move(segment));
+
+                        return more_segments && !failed;
+                    }
+                    catch(const SegmentQueue_::AbortedException&) {
+                        // Another worker failed, and its exception is the one that gets reported
+                        return false;
+                    }
+                    catch(...) {
+                        // Wake up any workers that are waiting on this segment
+                        segment_queue.abort();
+                        throw;
+                    }
+                }
+            );
+
+            if(failed_segment) {
+                ecount.countErrors(failed_segment->errors);
+                replayErrors_(ecount, failed_segment->errors.getReports(), deferred_errors.getReports());
+                deferred_errors.clearReports();
+            }
+
+            counts += checker.getCounts();
+            ecount.countErrors(deferred_errors);
+
+            return counts;
+        }
+};
+
+int main (int argc, char **argv) {
+    try {
+        uint64_t inst_count = 0;
+        uint64_t hdr_pte_count = 0;         // Number of pte entries found in trace header.
+        uint64_t embed_pte_count = 0;       // Number of embedded pte entries found in trace.
+        uint64_t pa_count = 0;              // Number of mem PA records found in trace.
+        uint64_t phys_pc_count = 0;         // Number of inst_phys_pc values in trace.
+
+        const STFCheckConfig config = parse_command_line (argc, argv);
+        ErrorTracker ecount(config.ignored_errors);
+        ecount.setContinueOnError(config.continue_on_error);
+
+        // Keep track of thread_info;
+        uint32_t hw_tid = 0;
+        uint32_t pid = 0;
+        uint32_t tid = 0;
+        uint32_t hw_tid_prev = std::numeric_limits<uint32_t>::max();
+        uint32_t pid_prev = std::numeric_limits<uint32_t>::max();
+        uint32_t tid_prev = std::numeric_limits<uint32_t>::max();
+        bool thread_switch = false;
+        ThreadMap thread_pc_prev;
+        ThreadMapKey thread_id;
+
+        // Open stf trace reader
+        stf::STFInstReader stf_reader(config.trace_filename, config.skip_non_user, config.check_phys_addr);
+        /* FIXME Because we have not kept up with STF versioning, this is currently broken and must be loosened.
+        if (!stf_reader.checkVersion()) {
+            exit(1);
+        }
+        */
+
+        // Get initial trace thread info
+        if(const auto it = stf_reader.begin(); it != stf_reader.end()) {
+            const auto& inst = *it;
+            hw_tid_prev = inst.hwtid();
+            pid_prev = inst.pid();
+            tid_prev = inst.tid();
+            thread_id = std::make_tuple(hw_tid_prev, pid_prev, tid_prev);
+            thread_pc_prev[thread_id] = InstSummary(inst);
+        }
+
+        const auto& trace_features = stf_reader.getTraceFeatures();
+        const bool has_rv64_inst = stf_reader.getInitialIEM() == stf::INST_IEM::STF_INST_IEM_RV64;
+        bool ignore_rv64_error = false;
+
+        for(const auto& info: stf_reader.getTraceInfo()) {
+            if (info->getGenerator() != stf::STF_GEN::STF_GEN_RESERVED) {      // Check for a valid header.
+                try {
+                    std::cout << "Trace generator: " << info->getGenerator() << std::endl;
+                }
+                catch(const stf::STFException& e) {
+                    ecount.countError(ErrorCode::HEADER);
+                    ecount.reportError(ErrorCode::HEADER) << e.what() << std::endl;
+                }
+                std::cout << "Trace generator version: " << info->getVersionString() << std::endl;
+                std::cout << "Comment: " << info->getComment() << std::endl;
+                std::cout << "Features: ";
+                stf::print_utils::printHex(trace_features->getFeatures());
+                if(info->getGenerator() == stf::STF_GEN::STF_GEN_SPIKE) {
+                    ignore_rv64_error = true;
+                }
+                std::cout << std::endl;
+            }
+            else {
+                ecount.countError(ErrorCode::HEADER);
+                ecount.reportError(ErrorCode::HEADER) << "Invalid trace info record found" << std::endl;
+            }
+        }
+
+        const bool has_phys_addr_feature = trace_features->hasFeature(stf::TRACE_FEATURES::STF_CONTAIN_PHYSICAL_ADDRESS);
+
+        if(config.num_threads != 1) {
+            const auto counts = ParallelChecker(config, has_phys_addr_feature, stf_reader.getInitialIEM()).run(ecount);
+            inst_count = counts.inst_count;
+            embed_pte_count = counts.embed_pte_count;
+            pa_count = counts.pa_count;
+            phys_pc_count = counts.phys_pc_count;
+        }
+        else {
+            InstChecker<ErrorTracker> checker(config, has_phys_addr_feature, stf_reader.getInitialIEM(), ecount);
+
+            // Iterate through all of the records, checking for known issues.
+            for (const auto& inst: stf_reader) {
+                inst_count++;
+
+                hw_tid = inst.hwtid();
+                pid = inst.pid();
+                tid = inst.tid();
+                thread_id = std::make_tuple(hw_tid, pid, tid);
+                thread_switch = (tid != tid_prev || pid != pid_prev || hw_tid != hw_tid_prev);
+                hw_tid_prev = hw_tid;
+                pid_prev = pid;
+                tid_prev = tid;
+
+                if(!checker.check(inst, thread_pc_prev[thread_id], thread_switch, inst_count)) {
+                    break;
+                }
+
+                thread_pc_prev[thread_id] = InstSummary(inst);
+            }
+
+            const auto& counts = checker.getCounts();
+            embed_pte_count = counts.embed_pte_count;
+            pa_count = counts.pa_count;
+            phys_pc_count = counts.phys_pc_count;
         }
 
         // Check to see if the STF_CONTAINS_PHYSICAL_ADDRESS flag is set properly.
@@ -1,10 +1,14 @@
 #pragma once
 
+#include <array>
 #include <cinttypes>
 #include <iostream>
 #include <map>
+#include <sstream>
+#include <string>
 #include <unordered_map>
 #include <unordered_set>
+#include <vector>
 
 #include <boost/container_hash/hash.hpp>
 
@@ -161,6 +165,119 @@ inline ErrorCode parseErrorCode(const std::string_view err_code_str) {
 
 #undef PARSER_ENTRY
 
+/**
+ * \class ErrorRecorder
+ * Collects error counts and reports so that they can be replayed into an ErrorTracker later.
+ * Used when the trace is checked on multiple threads, since the reports have to be printed in trace order.
+ */
+class ErrorRecorder {
+    public:
+        /**
+         * \struct Report
+         * A single reported error
+         */
+        struct Report {
+            uint64_t position; /**< 0-based index of the instruction that caused the error */
+            ErrorCode code; /**< Error type */
+            std::string message; /**< Error message, including the trailing newline */
+        };
+
+    private:
+        /**
+         * \class RecorderStreamBuf
+         * Subclass of std::stringbuf that moves its contents into the most recent report when it is flushed
+         */
+        class RecorderStreamBuf final : public std::stringbuf {
+            private:
+                std::vector<Report>& reports_;
+
+            public:
+                explicit RecorderStreamBuf(std::vector<Report>& reports) :
+                    reports_(reports)
+                {
+                }
+
+                int sync() final {
+                    if(STF_EXPECT_TRUE(!reports_.empty())) {
+                        reports_.back().message += str();
+                    }
+                    str("");
+                    return 0;
+                }
+        };
+
+        std::array<uint64_t, stf::enums::to_int(ErrorCode::RESERVED_NUM_ERRORS) - 1> errors_ = {0}; /**< Holds error counts */
+        const std::unordered_set<ErrorCode>& ignored_errors_; /**< Holds error codes that should be ignored */
+        std::vector<Report> reports_; /**< Reports in the order they were made */
+        RecorderStreamBuf buf_; /**< Collects the message for the most recent report */
+        std::ostream os_; /**< Stream returned by reportError */
+        std::ostream ignored_os_; /**< Stream returned by reportError for ignored errors. It has no streambuf, so everything sent to it is discarded. */
+        uint64_t position_ = 0; /**< Position attached to new reports */
+
+    public:
+        explicit ErrorRecorder(const std::unordered_set<ErrorCode>& ignored_errors) :
+            ignored_errors_(ignored_errors),
+            buf_(reports_),
+            os_(&buf_),
+            ignored_os_(nullptr)
+        {
+        }
+
+        ErrorRecorder(const ErrorRecorder&) = delete;
+        ErrorRecorder& operator=(const ErrorRecorder&) = delete;
+
+        /**
+         * Sets the instruction position attached to subsequent reports
+         * \param position 0-based index of the instruction being checked
+         */
+        void setPosition(const uint64_t position) {
+            position_ = position;
+        }
+
+        /**
+         * Increment the count for the specified error type
+         * \param code Error type
+         */
+        void countError(const ErrorCode code) {
+            ++errors_[stf::enums::to_int(code) - 1];
+        }
+
+        /**
+         * Get the count for the specified error type
+         * \param code Error type
+         */
+        uint64_t getErrorCount(const ErrorCode code) const {
+            return errors_[stf::enums::to_int(code) - 1];
+        }
+
+        /**
+         * Record the specified error. The message must be terminated with std::endl.
+         * \param code Error type
+         */
+        std::ostream& reportError(const ErrorCode code) {
+            if(STF_EXPECT_FALSE(ignored_errors_.count(code))) {
+                return ignored_os_;
+            }
+
+            reports_.emplace_back(Report{position_, code, std::string()});
+            return os_;
+        }
+
+        /**
+         * Get the recorded reports
+         */
+        const std::vector<Report>& getReports() const {
+            return reports_;
+        }
+
+        /**
+         * Discard the recorded reports
+         */
+        void clearReports() {
+            reports_.clear();
+        }
+};
+
 /**
  * \class ErrorTracker
  * Counts and classifies errors found in an STF
@@ -410,10 +527,30 @@ class ErrorTracker {
         /**
          * Increment the count for the specified error type
          * \param code Error type
+         * \param count Amount to add to the count
          */
-        void countError(const ErrorCode code) {
+        void countError(const ErrorCode code, const uint64_t count = 1) {
             validateCode_(code);
-            ++errors_[stf::enums::to_int(code) - 1];
+            errors_[stf::enums::to_int(code) - 1] += count;
+        }
+
+        /**
+         * Add the error counts collected by an ErrorRecorder
+         * \param recorder ErrorRecorder to add
+         */
+        void countErrors(const ErrorRecorder& recorder) {
+            for(auto i = stf::enums::to_int(ErrorCode::RESERVED_NO_ERROR) + 1; i < stf::enums::to_int(ErrorCode::RESERVED_NUM_ERRORS); ++i) {
+                const auto code = static_cast<ErrorCode>(i);
+                countError(code, recorder.getErrorCount(code));
+            }
+        }
+
+        /**
+         * Report an error that was collected by an ErrorRecorder
+         * \param report Report to replay
+         */
+        void reportError(const ErrorRecorder::Report& report) {
+            reportError(report.code) << report.message << std::flush;
         }
 
         /**
@@ -510,6 +647,7 @@ struct STFCheckConfig {
     bool continue_on_error = false; /**< Whether we should continue on an error */
     bool always_print_error_counts = false; /**< Whether we should always print error counts at the end */
     uint64_t end_inst = 0; /**< If > 0, stop checking after this many instructions */
+    size_t num_threads = 1; /**< Number of threads used to check the trace. 0 uses all available hardware threads. */
     std::unordered_set<ErrorCode> ignored_errors; /*< Contains error codes that should be ignored */
 };
 
@@ -520,8 +658,142 @@ struct STFCheckConfig {
  */
 using ThreadMapKey = std::tuple<uint32_t, uint32_t, uint32_t>;
 
+/**
+ * Returns true if every memory access of a vector instruction is masked off
+ * \param inst Instruction to check
+ */
+inline bool isVectorMemAccessMasked(const stf::STFInst& inst) {
+    if(inst.isVector()) {
+        const auto vl = inst.getSourceOperand(stf::Registers::STF_REG::STF_REG_CSR_VL);
+        const auto v0 = inst.getSourceOperand(stf::Registers::STF_REG::STF_REG_V0);
+
+        if(!vl.second) {
+            return false;
+        }
+        else {
+            auto vlen = vl.first->getScalarValue();
+
+            // If VL == 0, all accesses are masked
+            if(vlen == 0) {
+                return true;
+            }
+            // If V0 is specified, bits [VL-1:0] define the mask
+            // If all of the mask bits are 0, then all load/store accesses are masked
+            else if(v0.second) {
+                // Calculate how many vector elements are needed to hold the mask
+                const auto num_mask_elements = stf::InstRegRecord::calcVectorLen(vlen);
+                stf_assert(num_mask_elements != 0, "There should be at least 1 mask element if vlen != 0");
+
+                const auto& v0_data = v0.first->getVectorValue();
+                using ElementType = std::remove_reference_t<decltype(v0_data)>::value_type;
+
+                // This loop handles the first n-1 mask elements - each one is a full vector element,
+                // so we can do a simple equality check with 0
+                for(size_t i = 0; i < num_mask_elements - 1; ++i) {
+                    if(STF_EXPECT_FALSE(v0_data[i] != 0)) {
+                        return false;
+                    }
+                    // Subtract the number of bits in this element from vlen so we can calculate
+                    // the mask in the final step
+                    vlen -= stf::byte_utils::bitSize<ElementType>();
+                }
+
+                // Check the final mask element - this one may not take up a full vector element,
+                // so we check with a mask instead
+                const auto final_element_mask = stf::byte_utils::bitMask<ElementType>(vlen);
+                return (v0_data[num_mask_elements - 1] & final_element_mask) == 0;
+            }
+        }
+    }
+
+    return false;
+}
+
+/**
+ * \struct InstSummary
+ * Holds the parts of an instruction that are checked against the next instruction from the same thread.
+ * It is a small flat structure, so it can be saved for every instruction without allocating.
+ */
+struct InstSummary {
+    /**
+     * \enum EventTargets
+     * Describes the valid targets of the events attached to an instruction
+     */
+    enum class EventTargets : uint8_t {
+        NONE,       // No event has a valid target
+        SINGLE,     // Every valid target is event_target
+        MULTIPLE    // There are at least 2 different valid targets
+    };
+
+    uint64_t index = 0; /**< Instruction index */
+    uint64_t pc = 0; /**< Instruction PC */
+    uint64_t branch_target = 0; /**< Branch target */
+    uint64_t event_target = 0; /**< Event target if event_targets is SINGLE */
+    uint32_t opcode = 0; /**< Instruction opcode */
+    uint32_t opcode_size = 0; /**< Opcode size in bytes */
+    bool taken_branch = false; /**< Whether the instruction is a taken branch */
+    bool change_to_user_mode = false; /**< Whether the instruction switches to user mode */
+    bool has_events = false; /**< Whether the instruction has any events */
+    bool has_mem_reads = false; /**< Whether the instruction is a load with memory read records */
+    bool has_mem_writes = false; /**< Whether the instruction is a store with memory write records */
+    bool vector_mem_access_masked = false; /**< Whether every memory access of a vector instruction is masked off */
+    EventTargets event_targets = EventTargets::NONE; /**< Describes the valid event targets */
+
+    InstSummary() = default;
+
+    /**
+     * Constructs an InstSummary
+     * \param inst Instruction to summarize
+     */
+    explicit InstSummary(const stf::STFInst& inst) :
+        index(inst.index()),
+        pc(inst.pc()),
+        branch_target(inst.branchTarget()),
+        opcode(inst.opcode()),
+        opcode_size(static_cast<uint32_t>(inst.opcodeSize())),
+        taken_branch(inst.isTakenBranch()),
+        change_to_user_mode(inst.isChangeToUserMode()),
+        has_events(!inst.getEvents().empty()),
+        has_mem_reads(inst.isLoad() && !inst.getMemoryReads().empty()),
+        has_mem_writes(inst.isStore() && !inst.getMemoryWrites().empty()),
+        vector_mem_access_masked(isVectorMemAccessMasked(inst))
+    {
+        for(const auto& event: inst.getEvents()) {
+            if(!event.targetValid()) {
+                continue;
+            }
+
+            if(event_targets == EventTargets::NONE) {
+                event_targets = EventTargets::SINGLE;
+                event_target = event.getTarget();
+            }
+            else if(event.getTarget() != event_target) {
+                event_targets = EventTargets::MULTIPLE;
+                break;
+            }
+        }
+    }
+
+    /**
+     * Returns true if any event has a valid target that doesn't match the specified PC
+     * \param next_pc PC to compare against
+     */
+    bool hasEventTargetMismatch(const uint64_t next_pc) const {
+        switch(event_targets) {
+            case EventTargets::NONE:
+                return false;
+            case EventTargets::SINGLE:
+                return event_target != next_pc;
+            case EventTargets::MULTIPLE:
+                return true;
+        }
+
+        return true;
+    }
+};
+
 /**
  * \typedef ThreadMap
- * Maps Hardware Thread ID, PID, and TID to an STFInst
+ * Maps Hardware Thread ID, PID, and TID to a summary of the last instruction from that thread
  */
-using ThreadMap = std::unordered_map<ThreadMapKey, stf::STFInst, boost::hash<ThreadMapKey>>;
+using ThreadMap = std::unordered_map<ThreadMapKey, InstSummary, boost::hash<ThreadMapKey>>;
@@ -30,7 +30,8 @@ static void parse_command_line(int argc,
                                bool& cumulative_csv,
                                uint64_t& csv_interval,
                                uint64_t& start_inst,
-                               uint64_t& end_inst) {
+                               uint64_t& end_inst,
+                               size_t& num_threads) {
     trace_tools::CommandLineParser parser("stf_count");
     parser.addFlag('v', "multi-line output");
     parser.addFlag('u', "only count user-mode instructions. When this is enabled, -i/-s/-e parameters will be in terms of user-mode instructions.");
@@ -40,12 +41,14 @@ static void parse_command_line(int argc,
     parser.addFlag('i', "interval", "dump CSV on this instruction interval");
     parser.addFlag('s', "N", "start counting at Nth instruction");
     parser.addFlag('e', "M", "stop counting at Mth instruction");
+    parser.addFlag('j', "N", "count trace segments in parallel using N threads. 0 uses all available hardware threads.");
     parser.addPositionalArgument("trace", "trace in STF format");
 
     parser.setMutuallyExclusive('s', 'v');
     parser.setMutuallyExclusive('s', 'c');
     parser.setMutuallyExclusive('c', 'v');
     parser.setDependentArgument('C', 'c');
+    parser.setMutuallyExclusive('j', 'u');
 
     parser.parseArguments(argc, argv);
 
@@ -57,6 +60,7 @@ static void parse_command_line(int argc,
     parser.getArgumentValue('i', csv_interval);
     parser.getArgumentValue('s', start_inst);
     parser.getArgumentValue('e', end_inst);
+    parser.getArgumentValue('j', num_threads);
 
     if(!csv_interval) {
         cumulative_csv = true; // If we aren't doing interval dumps, the CSV should always be cumulative
@@ -75,6 +79,7 @@ int main (int argc, char **argv) {
     uint64_t csv_interval = 0;
     uint64_t start_inst = 0;
     uint64_t end_inst = std::numeric_limits<uint64_t>::max();
+    size_t num_threads = 1;
 
     try {
         parse_command_line(argc,
@@ -87,13 +92,21 @@ int main (int argc, char **argv) {
                            cumulative_csv,
                            csv_interval,
                            start_inst,
-                           end_inst);
+                           end_inst,
+                           num_threads);
     }
     catch(const trace_tools::CommandLineParser::EarlyExitException& e) {
         std::cerr << e.what() << std::endl;
         return e.getCode();
     }
 
+    if(num_threads != 1) {
+        STFCountReporter reporter(verbose, short_output, csv_output, cumulative_csv, csv_interval);
+        STFParallelCount parallel_count(trace_filename, reporter, start_inst, end_inst, num_threads);
+        parallel_count.count();
+        return 0;
+    }
+
     stf::STFInstReader stf_inst_reader(trace_filename, user_mode_only);
 
     STFCountFilter stf_count_filter(stf_inst_reader,
@@ -1,16 +1,76 @@
 #pragma once
 
 #include <cstdint>
+#include <string>
+#include <vector>
 #include "stf_inst_reader.hpp"
 #include "stf_filter.hpp"
+#include "stf_parallel_inst_scanner.hpp"
+#include "thread_pool.hpp"
 #include "tools_util.hpp"
 #include "formatters.hpp"
 
 /**
- * \class STFCountFilter
- * Filter class used for counting STF records
+ * \struct STFCounts
+ * Holds the counts accumulated over a range of instructions
  */
-class STFCountFilter : public stf::STFFilter<STFCountFilter> {
+struct STFCounts {
+    uint64_t record_count = 0;             /**< Count all records */
+    uint64_t inst_count = 0;               /**< Count instruction anchor records */
+    uint64_t inst_record_count = 0;        /**< Count instruction records */
+    uint64_t mem_access_count = 0;         /**< Count memory anchor records */
+    uint64_t mem_record_count = 0;         /**< Count memory records */
+    uint64_t comment_count = 0;            /**< Count escape records */
+    uint64_t page_table_walk_count = 0;    /**< Count page table walk records */
+    uint64_t uop_count = 0;                /**< Count all micro-op records */
+    uint64_t event_count = 0;              /**< Count Event records */
+    uint64_t non_user_count = 0;           /**< Count kernel instructions */
+    uint64_t fault_count = 0;              /**< Count faults */
+
+    inline uint64_t getUserCount() const {
+        return inst_count - non_user_count;
+    }
+
+    /**
+     * Counts the records that make up an instruction
+     * \param inst Instruction to count
+     */
+    inline void countRecords(const stf::STFInst& inst) {
+        const auto& orig_records = inst.getOrigRecords();
+        record_count += orig_records.size();
+        inst_record_count += orig_records.count(stf::descriptors::internal::Descriptor::STF_INST_OPCODE16) +
+                             orig_records.count(stf::descriptors::internal::Descriptor::STF_INST_OPCODE32);
+        uop_count += orig_records.count(stf::descriptors::internal::Descriptor::STF_INST_MICROOP);
+        const size_t num_mem_accesses = orig_records.count(stf::descriptors::internal::Descriptor::STF_INST_MEM_ACCESS);
+        const size_t num_mem_content = orig_records.count(stf::descriptors::internal::Descriptor::STF_INST_MEM_CONTENT);
+        mem_access_count += num_mem_accesses;
+        mem_record_count += num_mem_accesses + num_mem_content;
+        comment_count += orig_records.count(stf::descriptors::internal::Descriptor::STF_COMMENT);
+        page_table_walk_count += orig_records.count(stf::descriptors::internal::Descriptor::STF_PAGE_TABLE_WALK);
+        event_count += orig_records.count(stf::descriptors::internal::Descriptor::STF_EVENT);
+    }
+
+    inline STFCounts& operator+=(const STFCounts& rhs) {
+        record_count += rhs.record_count;
+        inst_count += rhs.inst_count;
+        inst_record_count += rhs.inst_record_count;
+        mem_access_count += rhs.mem_access_count;
+        mem_record_count += rhs.mem_record_count;
+        comment_count += rhs.comment_count;
+        page_table_walk_count += rhs.page_table_walk_count;
+        uop_count += rhs.uop_count;
+        event_count += rhs.event_count;
+        non_user_count += rhs.non_user_count;
+        fault_count += rhs.fault_count;
+        return *this;
+    }
+};
+
+/**
+ * \class STFCountReporter
+ * Accumulates STFCounts and prints them in the stf_count output formats
+ */
+class STFCountReporter {
     private:
         const bool verbose_ = false;                     /**< If false, outputs all counts on a single line */
         const bool short_mode_ = false;                  /**< If true, only outputs instruction count */
@@ -19,25 +79,9 @@ class STFCountFilter : public stf::STFFilter<STFCountFilter> {
         const uint64_t csv_interval_ = 0;                /**< CSV dump interval. If 0, CSV will only be dumped at the end */
 
         mutable bool dumped_csv_header_ = false;         /**< Set to true once CSV header has been dumped */
-        mutable uint64_t record_count_ = 0;              /**< Count all records */
-        mutable uint64_t inst_count_ = 0;                /**< Count instruction anchor records */
-        mutable uint64_t inst_record_count_ = 0;         /**< Count instruction records */
-        mutable uint64_t mem_access_count_ = 0;          /**< Count memory anchor records */
-        mutable uint64_t mem_record_count_ = 0;          /**< Count memory records */
-        mutable uint64_t comment_count_ = 0;             /**< Count escape records */
-        mutable uint64_t page_table_walk_count_ = 0;     /**< Count page table walk records */
-        mutable uint64_t uop_count_ = 0;                 /**< Count all micro-op records */
-        mutable uint64_t event_count_ = 0;               /**< Count Event records */
-        mutable uint64_t non_user_count_ = 0;            /**< Count kernel instructions */
-        mutable uint64_t fault_count_ = 0;               /**< Count faults */
+        mutable STFCounts counts_;                       /**< Counts accumulated since the last CSV dump */
         mutable uint64_t next_csv_dump_ = 0;             /**< Last time CSV was dumped */
 
-        friend class stf::STFFilter<STFCountFilter>;
-
-        inline uint64_t getUserCount_() const {
-            return inst_count_ - non_user_count_;
-        }
-
         inline void dumpCSVHeader_() const {
             if(STF_EXPECT_FALSE(!dumped_csv_header_)) {
                 std::cout << "total_record_count,"
@@ -59,49 +103,39 @@ class STFCountFilter : public stf::STFFilter<STFCountFilter> {
         inline void dumpCSV_() const {
             dumpCSVHeader_();
 
-            std::cout << record_count_ << ','
-                      << inst_count_ << ','
-                      << inst_record_count_ << ','
-                      << mem_access_count_ << ','
-                      << mem_record_count_ << ','
-                      << uop_count_ << ','
-                      << comment_count_ << ','
-                      << event_count_ << ','
-                      << getUserCount_() << ','
-                      << non_user_count_ << ','
-                      << fault_count_ << ','
-                      << page_table_walk_count_ << std::endl;
+            std::cout << counts_.record_count << ','
+                      << counts_.inst_count << ','
+                      << counts_.inst_record_count << ','
+                      << counts_.mem_access_count << ','
+                      << counts_.mem_record_count << ','
+                      << counts_.uop_count << ','
+                      << counts_.comment_count << ','
+                      << counts_.event_count << ','
+                      << counts_.getUserCount() << ','
+                      << counts_.non_user_count << ','
+                      << counts_.fault_count << ','
+                      << counts_.page_table_walk_count << std::endl;
 
             if(!cumulative_csv_) {
-                record_count_ = 0;
-                inst_count_ = 0;
-                inst_record_count_ = 0;
-                mem_access_count_ = 0;
-                mem_record_count_ = 0;
-                uop_count_ = 0;
-                comment_count_ = 0;
-                event_count_ = 0;
-                non_user_count_ = 0;
-                fault_count_ = 0;
-                page_table_walk_count_ = 0;
+                counts_ = STFCounts();
                 next_csv_dump_ = 0;
             }
         }
 
     public:
         /**
-         * Constructs an STFCountFilter
-         * \param inst_reader Instruction reader object
+         * Constructs an STFCountReporter
          * \param verbose If false, all output will be on a single line
+         * \param short_mode If true, only the instruction count is output
+         * \param csv_output If true, output is in CSV format
+         * \param cumulative_csv If true, CSV rows are cumulative
+         * \param csv_interval CSV dump interval
          */
-        explicit STFCountFilter(stf::STFInstReader& inst_reader,
-                                const bool verbose,
-                                const bool short_mode,
-                                const bool user_mode_only,
-                                const bool csv_output,
-                                const bool cumulative_csv,
-                                const uint64_t csv_interval) :
-            stf::STFFilter<STFCountFilter>(inst_reader, user_mode_only),
+        STFCountReporter(const bool verbose,
+                         const bool short_mode,
+                         const bool csv_output,
+                         const bool cumulative_csv,
+                         const uint64_t csv_interval) :
             verbose_(verbose),
             short_mode_(short_mode),
             csv_output_(csv_output),
@@ -111,70 +145,369 @@ class STFCountFilter : public stf::STFFilter<STFCountFilter> {
         {
         }
 
-    protected:
-        inline const std::vector<stf::STFInst>& filter(const stf::STFInst& inst) {
-            if(STF_EXPECT_TRUE(!is_fault_)) {
-                inst_count_++;
+        /**
+         * Returns true if the reporter only counts instructions
+         */
+        inline bool isShortMode() const {
+            return short_mode_;
+        }
+
+        /**
+         * Returns the number of non-fault instructions in each CSV row, or 0 if no interval rows are dumped
+         */
+        inline uint64_t getRowInterval() const {
+            return (csv_output_ && !short_mode_) ? csv_interval_ : 0;
+        }
+
+        /**
+         * Counts a single instruction
+         * \param inst Instruction to count
+         * \param is_fault If true, the instruction is a fault
+         * \param in_user_code If true, the instruction is user code
+         */
+        inline void countInst(const stf::STFInst& inst, const bool is_fault, const bool in_user_code) {
+            if(STF_EXPECT_TRUE(!is_fault)) {
+                counts_.inst_count++;
             }
 
             if(!short_mode_) {
-                if(STF_EXPECT_FALSE(!is_fault_ && !in_user_code_)) {
-                    non_user_count_++;
+                if(STF_EXPECT_FALSE(!is_fault && !in_user_code)) {
+                    counts_.non_user_count++;
                 }
 
-                fault_count_ += is_fault_;
-
-                const auto& orig_records = inst.getOrigRecords();
-                record_count_ += orig_records.size();
-                inst_record_count_ += orig_records.count(stf::descriptors::internal::Descriptor::STF_INST_OPCODE16) +
-                                      orig_records.count(stf::descriptors::internal::Descriptor::STF_INST_OPCODE32);
-                uop_count_ += orig_records.count(stf::descriptors::internal::Descriptor::STF_INST_MICROOP);
-                const size_t num_mem_accesses = orig_records.count(stf::descriptors::internal::Descriptor::STF_INST_MEM_ACCESS);
-                const size_t num_mem_content = orig_records.count(stf::descriptors::internal::Descriptor::STF_INST_MEM_CONTENT);
-                mem_access_count_ += num_mem_accesses;
-                mem_record_count_ += num_mem_accesses + num_mem_content;
-                comment_count_ += orig_records.count(stf::descriptors::internal::Descriptor::STF_COMMENT);
-                page_table_walk_count_ += orig_records.count(stf::descriptors::internal::Descriptor::STF_PAGE_TABLE_WALK);
-                event_count_ += orig_records.count(stf::descriptors::internal::Descriptor::STF_EVENT);
-
-                if(STF_EXPECT_FALSE(csv_output_ && (inst_count_ == next_csv_dump_))) {
+                counts_.fault_count += is_fault;
+
+                counts_.countRecords(inst);
+
+                if(STF_EXPECT_FALSE(csv_output_ && (counts_.inst_count == next_csv_dump_))) {
                     dumpCSV_();
                     next_csv_dump_ += csv_interval_;
                 }
             }
+        }
 
-            return EMPTY_INST_LIST_;
+        /**
+         * Returns true if every fault before the first non-fault instruction dumps its own CSV row
+         */
+        inline bool dumpsLeadingFaults() const {
+            return csv_output_ && !short_mode_ && !csv_interval_;
+        }
+
+        /**
+         * Adds counts that were accumulated elsewhere. The counts must not cross a CSV row boundary.
+         * \param counts Counts to add
+         */
+        inline void addCounts(const STFCounts& counts) {
+            counts_ += counts;
+
+            if(STF_EXPECT_FALSE(csv_output_ && !short_mode_ && (counts_.inst_count == next_csv_dump_))) {
+                dumpCSV_();
+                next_csv_dump_ += csv_interval_;
+            }
         }
 
         void finished() const {
             if(short_mode_) {
-                std::cout << inst_count_ << std::endl;
+                std::cout << counts_.inst_count << std::endl;
             }
-            else if(csv_output_ && (inst_count_ != next_csv_dump_)) {
+            else if(csv_output_ && (counts_.inst_count != next_csv_dump_)) {
                 // only dump CSV if we haven't already dumped this row
                 dumpCSV_();
             }
             else {
                 const char sep_char = verbose_ ? '\n' : ' ';
                 CommaFormatter comma(std::cout);
-                comma << "total_record_count " << record_count_ << sep_char;
+                comma << "total_record_count " << counts_.record_count << sep_char;
 
-                if (inst_count_ > 0) {
-                    comma << "inst_count " << inst_count_ << sep_char
-                          << "inst_record_count " << inst_record_count_ << sep_char;
+                if (counts_.inst_count > 0) {
+                    comma << "inst_count " << counts_.inst_count << sep_char
+                          << "inst_record_count " << counts_.inst_record_count << sep_char;
                 } else {
-                    comma << "mem access_count " << mem_access_count_ << sep_char
-                          << "mem_record_count " << mem_record_count_ << sep_char;
+                    comma << "mem access_count " << counts_.mem_access_count << sep_char
+                          << "mem_record_count " << counts_.mem_record_count << sep_char;
                 }
 
-                comma << "uop_count " << uop_count_ << sep_char
-                      << "comment_count " << comment_count_ << sep_char
-                      << "event_count " << event_count_ << sep_char
-                      << "user_count " << getUserCount_() << sep_char
-                      << "non_user_count " << non_user_count_ << sep_char
-                      << "fault_count " << fault_count_ << sep_char
-                      << "PTE_count " << page_table_walk_count_ << sep_char
+                comma << "uop_count " << counts_.uop_count << sep_char
+                      << "comment_count " << counts_.comment_count << sep_char
+                      << "event_count " << counts_.event_count << sep_char
+                      << "user_count " << counts_.getUserCount() << sep_char
+                      << "non_user_count " << counts_.non_user_count << sep_char
+                      << "fault_count " << counts_.fault_count << sep_char
+                      << "PTE_count " << counts_.page_table_walk_count << sep_char
                       << std::endl;
             }
         }
 };
+
+/**
+ * \class STFCountFilter
+ * Filter class used for counting STF records
+ */
+class STFCountFilter : public stf::STFFilter<STFCountFilter> {
+    private:
+        STFCountReporter reporter_;                      /**< Accumulates and prints the counts */
+
+        friend class stf::STFFilter<STFCountFilter>;
+
+    public:
+        /**
+         * Constructs an STFCountFilter
+         * \param inst_reader Instruction reader object
+         * \param verbose If false, outputs all counts on a single line
+         */
+        explicit STFCountFilter(stf::STFInstReader& inst_reader,
+                                const bool verbose,
+                                const bool short_mode,
+                                const bool user_mode_only,
+                                const bool csv_output,
+                                const bool cumulative_csv,
+                                const uint64_t csv_interval) :
+            stf::STFFilter<STFCountFilter>(inst_reader, user_mode_only),
+            reporter_(verbose, short_mode, csv_output, cumulative_csv, csv_interval)
+        {
+        }
+
+    protected:
+        inline const std::vector<stf::STFInst>& filter(const stf::STFInst& inst) {
+            reporter_.countInst(inst, is_fault_, in_user_code_);
+            return EMPTY_INST_LIST_;
+        }
+
+        void finished() const {
+            reporter_.finished();
+        }
+};
+
+/**
+ * \class STFParallelCount
+ *
+ * Counts a trace with STFParallelInstScanner and feeds the merged counts to
+ * an STFCountReporter, producing the same output as STFCountFilter.
+ *
+ * Two pieces of state cross segment boundaries:
+ * - Whether the current instruction is user code. Each segment counts the
+ *   non-fault instructions it sees before its first mode change separately,
+ *   and they are assigned once the mode at the start of the segment is known.
+ * - The number of non-fault instructions before the segment, which decides
+ *   where the CSV interval rows start. Each segment assumes that none of the
+ *   instructions before it were faults. If that guess puts the row boundaries
+ *   in the wrong place, the segment is rescanned with the correct offset.
+ *
+ * Each CSV row is handed to the reporter separately, so it makes exactly the
+ * same dump decisions that it would have made while counting serially.
+ */
+class STFParallelCount {
+    private:
+        /**
+         * \struct SegmentCounts
+         * Counts accumulated over a single segment
+         */
+        struct SegmentCounts {
+            bool started = false;                       /**< Set once the first counted instruction is seen */
+            bool has_offset = false;                    /**< If true, non_fault_offset was set before the segment was scanned */
+            uint64_t non_fault_offset = 0;              /**< Counted non-fault instructions assumed to precede this segment */
+            uint64_t first_row = 0;                     /**< CSV row containing the first counted instruction */
+            uint64_t num_non_fault = 0;                 /**< Counted non-fault instructions in this segment */
+            bool mode_known = false;                    /**< Set once a mode change is seen in this segment */
+            bool in_user_code = false;                  /**< Current mode, if mode_known is true */
+            std::vector<STFCounts> rows;                /**< Counts for each CSV row touched by this segment */
+            std::vector<uint64_t> unknown_mode_insts;   /**< Non-fault instructions in each row seen before mode_known was set */
+            std::vector<STFCounts> leading_faults;      /**< Faults seen before any counted non-fault instruction, if they get their own rows */
+        };
+
+        using Scanner = stf::STFParallelInstScanner<SegmentCounts>;
+        using Segment = Scanner::Segment;
+
+        const Scanner scanner_;
+        STFCountReporter& reporter_;
+        const uint64_t start_inst_;
+        const uint64_t end_inst_;
+        const size_t num_threads_;
+
+        inline void countInst_(SegmentCounts& result, const stf::STFInst& inst, const uint64_t inst_offset) const {
+            const uint64_t row_interval = reporter_.getRowInterval();
+            const bool is_fault = inst.isFault();
+
+            if(STF_EXPECT_FALSE(!result.started)) {
+                result.started = true;
+                if(!result.has_offset) {
+                    // Guess that none of the counted instructions before this one were faults
+                    result.non_fault_offset = inst_offset;
+                    result.has_offset = true;
+                }
+                result.first_row = row_interval ? result.non_fault_offset / row_interval : 0;
+            }
+
+            const uint64_t non_fault_before = result.non_fault_offset + result.num_non_fault;
+
+            if(STF_EXPECT_FALSE(is_fault && !non_fault_before && reporter_.dumpsLeadingFaults())) {
+                auto& counts = result.leading_faults.emplace_back();
+                counts.fault_count = 1;
+                counts.countRecords(inst);
+                return;
+            }
+
+            const uint64_t row = (row_interval ? non_fault_before / row_interval : 0) - result.first_row;
+
+            if(STF_EXPECT_FALSE(row >= result.rows.size())) {
+                result.rows.resize(row + 1);
+                result.unknown_mode_insts.resize(row + 1, 0);
+            }
+
+            auto& counts = result.rows[row];
+
+            if(STF_EXPECT_TRUE(!is_fault)) {
+                ++counts.inst_count;
+                ++result.num_non_fault;
+            }
+
+            if(!reporter_.isShortMode()) {
+                if(STF_EXPECT_TRUE(!is_fault)) {
+                    if(STF_EXPECT_FALSE(!result.mode_known)) {
+                        ++result.unknown_mode_insts[row];
+                    }
+                    else if(!result.in_user_code) {
+                        ++counts.non_user_count;
+                    }
+                }
+
+                counts.fault_count += is_fault;
+                counts.countRecords(inst);
+            }
+        }
+
+        inline void scanInst_(Segment& segment, const stf::STFInst& inst) const {
+            auto& result = segment.result;
+            const uint64_t inst_idx = segment.start_inst + segment.num_insts;
+
+            if(STF_EXPECT_TRUE(inst_idx >= start_inst_)) {
+                countInst_(result, inst, inst_idx - start_inst_);
+            }
+
+            if(STF_EXPECT_FALSE(inst.isChangeFromUserMode())) {
+                result.mode_known = true;
+                result.in_user_code = false;
+            }
+            else if(STF_EXPECT_FALSE(inst.isChangeToUserMode())) {
+                result.mode_known = true;
+                result.in_user_code = true;
+            }
+        }
+
+    public:
+        /**
+         * Constructs an STFParallelCount
+         * \param trace_filename Trace to count
+         * \param reporter Reporter that receives the merged counts
+         * \param start_inst Number of instructions to skip
+         * \param end_inst Instruction to stop counting at
+         * \param num_threads Number of worker threads
+         */
+        STFParallelCount(const std::string& trace_filename,
+                         STFCountReporter& reporter,
+                         const uint64_t start_inst,
+                         const uint64_t end_inst,
+                         const size_t num_threads) :
+            scanner_(trace_filename, num_threads),
+            reporter_(reporter),
+            start_inst_(start_inst),
+            end_inst_(end_inst),
+            num_threads_(num_threads)
+        {
+        }
+
+        /**
+         * Counts the trace and prints the results
+         */
+        void count() {
+            const auto scan_func = [this](Segment& segment, const stf::STFInst& inst) {
+                scanInst_(segment, inst);
+            };
+
+            // The mode at start_inst depends on the instructions before it, so start scanning from the beginning
+            auto segments = scanner_.scan(0, end_inst_, scan_func);
+
+            const uint64_t row_interval = reporter_.getRowInterval();
+
+            // Find the segments whose row boundaries were guessed incorrectly
+            std::vector<size_t> rescan_segments;
+            uint64_t non_fault_offset = 0;
+            for(size_t i = 0; i < segments.size(); ++i) {
+                auto& result = segments[i].result;
+                if(!result.started) {
+                    continue;
+                }
+
+                const uint64_t num_non_fault = result.num_non_fault;
+
+                const bool bad_guess = row_interval ?
+                                       (result.non_fault_offset % row_interval != non_fault_offset % row_interval) :
+                                       (reporter_.dumpsLeadingFaults() && result.non_fault_offset && !non_fault_offset);
+
+                if(STF_EXPECT_FALSE(bad_guess)) {
+                    Segment rescan_segment(segments[i].start_inst);
+                    rescan_segment.result.non_fault_offset = non_fault_offset;
+                    rescan_segment.result.has_offset = true;
+                    segments[i] = std::move(rescan_segment);
+                    rescan_segments.emplace_back(i);
+                }
+                else if(row_interval) {
+                    // The guess was off by a whole number of rows, so just shift the rows
+                    result.first_row -= (result.non_fault_offset - non_fault_offset) / row_interval;
+                    result.non_fault_offset = non_fault_offset;
+                }
+
+                non_fault_offset += num_non_fault;
+            }
+
+            trace_tools::parallelFor(rescan_segments.size(),
+                                     num_threads_,
+                                     [this, &segments, &rescan_segments, &scan_func](const size_t idx, const size_t) {
+                                         auto& segment = segments[rescan_segments[idx]];
+                                         scanner_.scanSegment(segment,
+                                                              std::min(scanner_.getSegmentSize(), end_inst_ - segment.start_inst),
+                                                              scan_func);
+                                     });
+
+            // Leading faults can only appear before the first counted non-fault instruction,
+            // so they all come before any of the rows
+            for(const auto& segment: segments) {
+                for(const auto& counts: segment.result.leading_faults) {
+                    reporter_.addCounts(counts);
+                }
+            }
+
+            // Merge the segments in trace order
+            std::vector<STFCounts> rows;
+            bool in_user_code = false;
+            for(const auto& segment: segments) {
+                const auto& result = segment.result;
+
+                if(result.started) {
+                    for(size_t i = 0; i < result.rows.size(); ++i) {
+                        const size_t row_idx = result.first_row + i;
+                        if(row_idx >= rows.size()) {
+                            rows.resize(row_idx + 1);
+                        }
+
+                        auto& row = rows[row_idx];
+                        row += result.rows[i];
+
+                        if(!in_user_code) {
+                            row.non_user_count += result.unknown_mode_insts[i];
+                        }
+                    }
+                }
+
+                if(result.mode_known) {
+                    in_user_code = result.in_user_code;
+                }
+            }
+
+            for(const auto& row: rows) {
+                reporter_.addCounts(row);
+            }
+
+            reporter_.finished();
+        }
+};
@@ -1,5 +1,8 @@
+#include <algorithm>
 #include <iostream>
 #include <map>
+#include <string>
+#include <vector>
 
 #include <rapidjson/document.h>
 #include <rapidjson/ostreamwrapper.h>
@@ -10,91 +13,134 @@
 #include "print_utils.hpp"
 #include "stf_reader.hpp"
 #include "stf_record_types.hpp"
+#include "thread_pool.hpp"
 #include "tools_util.hpp"
 
+using ProcessInstructionCounts = std::map<uint64_t, std::map<size_t, uint64_t>>;
+
 static void parseCommandLine (int argc,
                               char **argv,
                               std::map<size_t, std::string>& traces,
                               bool& print_all,
                               bool& verbose,
-                              bool& format_json) {
+                              bool& format_json,
+                              size_t& num_threads) {
     trace_tools::CommandLineParser parser("stf_count_multi_process");
     parser.addFlag('a', "Print counts for instructions before the first user process");
     parser.addFlag('v', "Print which traces contain each process");
     parser.addFlag('j', "Output in JSON format");
+    parser.addFlag('p', "N", "Count up to N traces in parallel. 0 uses all available hardware threads. Defaults to 1.");
     parser.addPositionalArgument("trace", "trace in STF format", true);
     parser.parseArguments(argc, argv);
 
     print_all = parser.hasArgument('a');
     verbose = parser.hasArgument('v');
     format_json = parser.hasArgument('j');
+    parser.getArgumentValue('p', num_threads);
     const auto& trace_list = parser.getMultipleValuePositionalArgument(0);
     for(size_t i = 0; i < trace_list.size(); ++i) {
         traces.emplace(i, trace_list[i]);
     }
 }
 
+// Counts the instructions executed by each process in a single trace
+// Returns the total number of instructions in the trace
+static uint64_t countTrace(const size_t trace_id,
+                           const std::string& trace,
+                           ProcessInstructionCounts& process_instruction_counts) {
+    stf::STFReader reader(trace);
+
+    process_instruction_counts[0][trace_id] = 0;
+
+    uint64_t num_insts = 0;
+
+    try {
+        stf::STFRecord::UniqueHandle rec;
+#ifdef COUNT_CONTEXT_SWITCHES
+        uint64_t num_context_switches = 0;
+#endif
+        uint64_t cur_satp = 0;
+
+        while(reader >> rec) {
+            if(STF_EXPECT_FALSE(rec->getId() == stf::descriptors::internal::Descriptor::STF_INST_REG)) {
+                const auto& reg_rec = rec->as<stf::InstRegRecord>();
+                if(STF_EXPECT_FALSE((reg_rec.getOperandType() == stf::Registers::STF_REG_OPERAND_TYPE::REG_DEST) &&
+                                    (reg_rec.getReg() == stf::Registers::STF_REG::STF_REG_CSR_SATP))) {
+                    const uint64_t new_satp_value = reg_rec.getScalarData();
+                    // Ignore the initial zeroing out of the satp register
+                    process_instruction_counts[new_satp_value].try_emplace(trace_id, 0);
+                    cur_satp = new_satp_value;
+                }
+            }
+#ifdef COUNT_CONTEXT_SWITCHES
+            else if(STF_EXPECT_FALSE(rec->getId() == stf::descriptors::internal::Descriptor::STF_EVENT)) {
+                const auto& event_rec = rec->as<stf::EventRecord>();
+                if(event_rec.isModeChange()) {
+                    const auto new_mode = static_cast<stf::EXECUTION_MODE>(event_rec.getData().front());
+                    if(new_mode == stf::EXECUTION_MODE::USER_MODE) {
+                        ++num_context_switches;
+                    }
+                }
+            }
+#endif
+            else if(STF_EXPECT_FALSE(rec->isInstructionRecord())) {
+                ++process_instruction_counts[cur_satp][trace_id];
+                ++num_insts;
+            }
+        }
+    }
+    catch(const stf::EOFException&) {
+    }
+
+    return num_insts;
+}
+
 int main(int argc, char* argv[]) {
     std::map<size_t, std::string> traces;
     bool print_all = false;
     bool verbose = false;
     bool format_json = false;
+    size_t num_threads = 1;
 
     try {
-        parseCommandLine(argc, argv, traces, print_all, verbose, format_json);
+        parseCommandLine(argc, argv, traces, print_all, verbose, format_json, num_threads);
     }
     catch(const trace_tools::CommandLineParser::EarlyExitException& e) {
         std::cerr << e.what() << std::endl;
         return e.getCode();
     }
 
-    std::map<uint64_t, std::map<size_t, uint64_t>> process_instruction_counts;
+    ProcessInstructionCounts process_instruction_counts;
     uint64_t num_insts = 0;
 
-    for(const auto& trace_pair: traces) {
-        const auto trace_id = trace_pair.first;
-        const auto& trace = trace_pair.second;
-
-        stf::STFReader reader(trace);
-
-        process_instruction_counts[0][trace_id] = 0;
-
-        try {
-            stf::STFRecord::UniqueHandle rec;
-#ifdef COUNT_CONTEXT_SWITCHES
-            uint64_t num_context_switches = 0;
-#endif
-            uint64_t cur_satp = 0;
-
-            while(reader >> rec) {
-                if(STF_EXPECT_FALSE(rec->getId() == stf::descriptors::internal::Descriptor::STF_INST_REG)) {
-                    const auto& reg_rec = rec->as<stf::InstRegRecord>();
-                    if(STF_EXPECT_FALSE((reg_rec.getOperandType() == stf::Registers::STF_REG_OPERAND_TYPE::REG_DEST) &&
-                                        (reg_rec.getReg() == stf::Registers::STF_REG::STF_REG_CSR_SATP))) {
-                        const uint64_t new_satp_value = reg_rec.getScalarData();
-                        // Ignore the initial zeroing out of the satp register
-                        process_instruction_counts[new_satp_value].try_emplace(trace_id, 0);
-                        cur_satp = new_satp_value;
-                    }
-                }
-#ifdef COUNT_CONTEXT_SWITCHES
-                else if(STF_EXPECT_FALSE(rec->getId() == stf::descriptors::internal::Descriptor::STF_EVENT)) {
-                    const auto& event_rec = rec->as<stf::EventRecord>();
-                    if(event_rec.isModeChange()) {
-                        const auto new_mode = static_cast<stf::EXECUTION_MODE>(event_rec.getData().front());
-                        if(new_mode == stf::EXECUTION_MODE::USER_MODE) {
-                            ++num_context_switches;
-                        }
-                    }
-                }
-#endif
-                else if(STF_EXPECT_FALSE(rec->isInstructionRecord())) {
-                    ++process_instruction_counts[cur_satp][trace_id];
-                    ++num_insts;
-                }
-            }
+    if(num_threads == 1) {
+        for(const auto& trace_pair: traces) {
+            num_insts += countTrace(trace_pair.first, trace_pair.second, process_instruction_counts);
         }
-        catch(const stf::EOFException&) {
+    }
+    else {
+        // Each worker counts into its own shard. Every trace ID is only ever touched by a single
+        // worker, so merging the shards afterwards yields exactly the same maps as the serial path.
+        const std::vector<std::pair<size_t, std::string>> trace_list(traces.begin(), traces.end());
+        const size_t num_workers = std::min(trace_tools::getNumWorkerThreads(num_threads), trace_list.size());
+        std::vector<ProcessInstructionCounts> shards(num_workers);
+        std::vector<uint64_t> shard_num_insts(num_workers, 0);
+
+        trace_tools::parallelFor(trace_list.size(),
+                                 num_workers,
+                                 [&trace_list, &shards, &shard_num_insts](const size_t trace_idx, const size_t worker_idx) {
+                                     const auto& trace_pair = trace_list[trace_idx];
+                                     shard_num_insts[worker_idx] += countTrace(trace_pair.first,
+                                                                               trace_pair.second,
+                                                                               shards[worker_idx]);
+                                 });
+
+        for(size_t i = 0; i < num_workers; ++i) {
+            num_insts += shard_num_insts[i];
+            for(const auto& p: shards[i]) {
+                auto& process_counts = process_instruction_counts[p.first];
+                process_counts.insert(p.second.begin(), p.second.end());
+            }
         }
     }
 
@@ -81,7 +81,8 @@ std::ostream& operator<<(std::ostream& os, const STFDiffInst& inst) {
 }
 
 auto getBeginIterator(const uint64_t start, const bool diff_markpointed_region, const bool diff_tracepointed_region, stf::STFInstReader& reader) {
-    auto it = std::next(reader.begin(), static_cast<ssize_t>(start) - 1);
+    // start is 1-based. begin() seeks through the chunk index instead of stepping over every skipped instruction.
+    auto it = reader.begin(start - 1);
 
     if(diff_markpointed_region || diff_tracepointed_region) {
         stf::STFDecoder decoder(reader.getInitialIEM());
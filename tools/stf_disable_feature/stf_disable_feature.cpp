@@ -10,6 +10,7 @@
 #include "file_utils.hpp"
 #include "stf_record_types.hpp"
 #include "stf_reader.hpp"
+#include "stf_record_copier.hpp"
 #include "stf_writer.hpp"
 #include "tools_util.hpp"
 
@@ -50,11 +51,13 @@ static void parseCommandLine(int argc,
                              std::string& infile,
                              std::string& outfile,
                              std::vector<stf::TRACE_FEATURES>& features,
-                             bool& overwrite) {
+                             bool& overwrite,
+                             bool& pipelined) {
     overwrite = false;
 
     trace_tools::CommandLineParser parser("stf_disable_feature");
     parser.addFlag('f', "Overwrite existing file");
+    parser.addFlag('p', "Read and decompress the input on a separate thread");
     parser.addPositionalArgument("infile", "Original STF file");
     parser.addPositionalArgument("outfile", "Output STF file");
     parser.addPositionalArgument("features", "Feature(s) to disable", true);
@@ -62,6 +65,7 @@ static void parseCommandLine(int argc,
     parser.parseArguments(argc, argv);
 
     overwrite = parser.hasArgument('f');
+    pipelined = parser.hasArgument('p');
 
     parser.getPositionalArgument(0, infile);
     parser.getPositionalArgument(1, outfile);
@@ -78,9 +82,10 @@ int main(int argc, char* argv[]) {
     std::string infile;
     std::string outfile;
     std::vector<stf::TRACE_FEATURES> features;
+    bool pipelined = false;
 
     try {
-        parseCommandLine(argc, argv, infile, outfile, features, overwrite);
+        parseCommandLine(argc, argv, infile, outfile, features, overwrite, pipelined);
     }
     catch(const trace_tools::CommandLineParser::EarlyExitException& e) {
         std::cerr << e.what() << std::endl;
@@ -106,15 +111,7 @@ int main(int argc, char* argv[]) {
     }
     writer.finalizeHeader();
 
-    try {
-        stf::STFRecord::UniqueHandle r;
-        while(reader) {
-            reader >> r;
-            writer << *r;
-        }
-    }
-    catch(const stf::EOFException&) {
-    }
+    trace_tools::STFRecordCopier::copy(reader, writer, pipelined);
 
     reader.close();
     writer.close();
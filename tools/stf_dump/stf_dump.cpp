@@ -11,15 +11,22 @@
 #include <cstdint>
 #include <iostream>
 #include <limits>
+#include <memory>
 #include <optional>
+#include <sstream>
 #include <string>
 #include <vector>
+#include "buffered_output.hpp"
 #include "command_line_parser.hpp"
 #include "disassembler.hpp"
+#include "format_utils.hpp"
 #include "print_utils.hpp"
 #include "stf_dump.hpp"
 #include "stf_inst_reader.hpp"
 #include "stf_page_table.hpp"
+#include "stf_parallel_inst_scanner.hpp"
+#include "stf_writer.hpp"
+#include "thread_pool.hpp"
 #include "tools_util.hpp"
 #include "stf_region_iterators.hpp"
 
@@ -38,10 +45,20 @@ static STFDumpConfig parseCommandLine (int argc, char **argv) {
     parser.addFlag('e', "M", "end dumping at M-th instruction");
     parser.addFlag('y', "*_symTab.yaml", "YAML symbol table file to show annotation");
     parser.addFlag('H', "omit the header information");
+    parser.addFlag('F', "buffer output in large blocks with faster number formatting. Output is unchanged, but is not flushed after every line.");
+    parser.addFlag('j', "N", "dump trace segments in parallel using N threads. 0 uses all available hardware threads. "
+                             "Output matches the serial dump. Requires a disassembler that does not carry state between "
+                             "instructions (STF_DISASM=MAVIS) and can't be combined with -u, -p or -T.");
     trace_tools::addTracepointCommandLineArgs(parser, "-s", "-e");
 
     parser.addPositionalArgument("trace", "trace in STF format");
 
+    // Each of these depends on state that is built up from the beginning of the trace. Physical addresses come
+    // from the page table inside STFInstReader, which can only be filled by reading the trace from the start.
+    parser.setMutuallyExclusive('j', 'u');
+    parser.setMutuallyExclusive('j', 'p');
+    parser.setMutuallyExclusive('j', 'T');
+
     parser.parseArguments(argc, argv);
 
     config.concise_mode = parser.hasArgument('c');
@@ -56,6 +73,8 @@ static STFDumpConfig parseCommandLine (int argc, char **argv) {
     parser.getArgumentValue('y', config.symbol_filename);
     config.show_annotation = !config.symbol_filename.empty();
     config.omit_header = parser.hasArgument('H');
+    config.buffered_output = parser.hasArgument('F');
+    parser.getArgumentValue('j', config.num_threads);
 
     trace_tools::getTracepointCommandLineArgs(parser,
                                               config.use_tracepoint_roi,
@@ -75,20 +94,22 @@ static STFDumpConfig parseCommandLine (int argc, char **argv) {
 
 /**
  * Prints an opcode along with its disassembly
+ * \param os The ostream to write the assembly to
+ * \param dis Disassembler
  * \param opcode instruction opcode
  * \param pc instruction PC
- * \param os The ostream to write the assembly to
  */
-static inline void printOpcodeWithDisassembly(const stf::Disassembler& dis,
+static inline void printOpcodeWithDisassembly(std::ostream& os,
+                                              const stf::Disassembler& dis,
                                               const uint32_t opcode,
                                               const uint64_t pc) {
     static constexpr int OPCODE_PADDING = stf::format_utils::OPCODE_FIELD_WIDTH - stf::format_utils::OPCODE_WIDTH - 1;
 
-    dis.printOpcode(std::cout, opcode);
+    dis.printOpcode(os, opcode);
 
-    stf::print_utils::printSpaces(OPCODE_PADDING); // pad out the rest of the opcode field with spaces
+    stf::format_utils::formatSpaces(os, OPCODE_PADDING); // pad out the rest of the opcode field with spaces
 
-    dis.printDisassembly(std::cout, pc, opcode);
+    dis.printDisassembly(os, pc, opcode);
     // if (show_annotation)
     // {
     //     // Retrieve symbol information from symbol table hash map
@@ -96,162 +117,202 @@ static inline void printOpcodeWithDisassembly(const stf::Disassembler& dis,
     //     if (match_symbol_opcode)
     //     {
     //         if(symInfo.opcode != inst.opcode())
-    //             std::cout << " | " << " [ " << symInfo.libName << ", " << symInfo.symName << ", OPCODE_MISMATCH: " << std::hex  << symInfo.opcode << " ] ";
+    //             os << " | " << " [ " << symInfo.libName << ", " << symInfo.symName << ", OPCODE_MISMATCH: " << std::hex  << symInfo.opcode << " ] ";
     //         else
-    //             std::cout << " | " << " [ " << symInfo.libName << ", " << symInfo.symName << ", OPCODE_CROSSCHECKED"  << " ] ";
+    //             os << " | " << " [ " << symInfo.libName << ", " << symInfo.symName << ", OPCODE_CROSSCHECKED"  << " ] ";
     //     }
     //     else
-    //         std::cout << " | " << " [ " << symInfo.libName << ", " << symInfo.symName << " ] ";
+    //         os << " | " << " [ " << symInfo.libName << ", " << symInfo.symName << " ] ";
     // }
-    std::cout << std::endl;
+    os << std::endl;
 }
 
-template<typename IteratorType, typename StartStopType = std::nullopt_t>
-void processTrace_(const STFDumpConfig& config, const StartStopType start_point = std::nullopt, const StartStopType stop_point = std::nullopt) {
-    // Open stf trace reader
-    stf::STFInstReader stf_reader(config.trace_filename, config.user_mode_only, stf::format_utils::showPhys());
-    stf_reader.checkVersion();
+/**
+ * \struct ThreadIDs
+ * Hardware thread, process and thread IDs of the most recently printed instruction
+ */
+struct ThreadIDs {
+    uint32_t hw_tid = std::numeric_limits<uint32_t>::max(); /**< Hardware thread ID */
+    uint32_t pid = std::numeric_limits<uint32_t>::max(); /**< Process ID */
+    uint32_t tid = std::numeric_limits<uint32_t>::max(); /**< Thread ID */
+};
 
-    // Create disassembler
-    stf::Disassembler dis(findElfFromTrace(config.trace_filename), stf_reader.getISA(), stf_reader.getInitialIEM(), config.use_aliases);
+/**
+ * Prints the trace header
+ * \param config Dump configuration
+ * \param stf_reader Reader for the trace
+ */
+static void printHeader_(const STFDumpConfig& config, const stf::STFInstReader& stf_reader) {
+    // Print Version info
+    stf::print_utils::printLabel("VERSION");
+    std::cout << stf_reader.major() << '.' << stf_reader.minor() << std::endl;
+
+    // Print trace info
+    for(const auto& i: stf_reader.getTraceInfo()) {
+        std::cout << *i;
+    }
 
-    if(!config.omit_header) {
-        // Print Version info
-        stf::print_utils::printLabel("VERSION");
-        std::cout << stf_reader.major() << '.' << stf_reader.minor() << std::endl;
+    // Print Instruction set info
+    stf::print_utils::printLabel("ISA");
+    std::cout << stf_reader.getISA() << std::endl;
 
-        // Print trace info
-        for(const auto& i: stf_reader.getTraceInfo()) {
-            std::cout << *i;
-        }
+    stf::print_utils::printLabel("INST_IEM");
+    std::cout << stf_reader.getInitialIEM() << std::endl;
 
-        // Print Instruction set info
-        stf::print_utils::printLabel("ISA");
-        std::cout << stf_reader.getISA() << std::endl;
+    if(config.start_inst || config.end_inst) {
+        std::cout << "Start Inst:" << config.start_inst;
 
-        stf::print_utils::printLabel("INST_IEM");
-        std::cout << stf_reader.getInitialIEM() << std::endl;
+        if(config.end_inst) {
+            std::cout << "  End Inst:" << config.end_inst << std::endl;
+        }
+        else {
+            std::cout << std::endl;
+        }
+    }
+}
 
-        if(config.start_inst || config.end_inst) {
-            std::cout << "Start Inst:" << config.start_inst;
+/**
+ * Prints an error message if an instruction is invalid
+ * \param inst Instruction to check
+ */
+static inline void checkValid_(const stf::STFInst& inst) {
+    if (STF_EXPECT_FALSE(!inst.valid())) {
+        std::cerr << "ERROR: " << inst.index() << " invalid instruction " << std::hex << inst.opcode() << " PC " << inst.pc() << std::endl;
+    }
+}
 
-            if(config.end_inst) {
-                std::cout << "  End Inst:" << config.end_inst << std::endl;
-            }
-            else {
-                std::cout << std::endl;
-            }
-        }
+/**
+ * Prints a single instruction
+ * \param os The ostream to write to
+ * \param config Dump configuration
+ * \param dis Disassembler
+ * \param inst Instruction to print
+ * \param prev_ids IDs of the previously printed instruction. Updated with the IDs of inst.
+ */
+static void printInst_(std::ostream& os,
+                       const STFDumpConfig& config,
+                       const stf::Disassembler& dis,
+                       const stf::STFInst& inst,
+                       ThreadIDs& prev_ids) {
+    const uint32_t hw_tid = inst.hwtid();
+    const uint32_t pid = inst.pid();
+    const uint32_t tid = inst.tid();
+    if (STF_EXPECT_FALSE(!config.concise_mode && (tid != prev_ids.tid || pid != prev_ids.pid || hw_tid != prev_ids.hw_tid))) {
+        stf::format_utils::formatLabel(os, "PID");
+        stf::format_utils::formatTID(os, hw_tid);
+        os << ':';
+        stf::format_utils::formatTID(os, pid);
+        os << ':';
+        stf::format_utils::formatTID(os, tid);
+        os << std::endl;
     }
+    prev_ids.hw_tid = hw_tid;
+    prev_ids.pid = pid;
+    prev_ids.tid = tid;
 
-    uint32_t hw_tid_prev = std::numeric_limits<uint32_t>::max();
-    uint32_t pid_prev = std::numeric_limits<uint32_t>::max();
-    uint32_t tid_prev = std::numeric_limits<uint32_t>::max();
+    // Opcode width string (INST32/INST16) and index should each take up half of the label column
+    stf::format_utils::formatLeft(os, inst.getOpcodeWidthStr(), stf::format_utils::LABEL_WIDTH / 2);
 
-    const auto start_inst = config.start_inst ? config.start_inst - 1 : 0;
+    stf::format_utils::formatDecLeft(os, inst.index(), stf::format_utils::LABEL_WIDTH / 2);
 
-    for (auto it = stf::getStartIterator<IteratorType>(stf_reader, start_inst, start_point, stop_point); it != stf_reader.end(); ++it) {
-        const auto& inst = *it;
+    stf::format_utils::formatVA(os, inst.pc());
 
-        if (STF_EXPECT_FALSE(!inst.valid())) {
-            std::cerr << "ERROR: " << inst.index() << " invalid instruction " << std::hex << inst.opcode() << " PC " << inst.pc() << std::endl;
-        }
+    if (stf::format_utils::showPhys()) {
+        // Make sure we zero-fill as needed, so that the address remains "virt:phys" and not "virt:  phys"
+        os << ':';
+        stf::format_utils::formatPA(os, inst.physPc());
+    }
+    stf::format_utils::formatSpaces(os, 1);
 
-        const uint32_t hw_tid = inst.hwtid();
-        const uint32_t pid = inst.pid();
-        const uint32_t tid = inst.tid();
-        if (STF_EXPECT_FALSE(!config.concise_mode && (tid != tid_prev || pid != pid_prev || hw_tid != hw_tid_prev))) {
-            stf::print_utils::printLabel("PID");
-            stf::print_utils::printTID(hw_tid);
-            std::cout << ':';
-            stf::print_utils::printTID(pid);
-            std::cout << ':';
-            stf::print_utils::printTID(tid);
-            std::cout << std::endl;
+    if (STF_EXPECT_FALSE(inst.isTakenBranch())) {
+        os << "PC ";
+        stf::format_utils::formatVA(os, inst.branchTarget());
+        if (stf::format_utils::showPhys()) {
+            os << ':';
+            stf::format_utils::formatPA(os, inst.physBranchTarget());
+        }
+        stf::format_utils::formatSpaces(os, 1);
+    }
+    else if(STF_EXPECT_FALSE(config.concise_mode && (inst.isFault() || inst.isInterrupt()))) {
+        const std::string_view fault_msg = inst.isFault() ? "FAULT" : "INTERRUPT";
+        stf::format_utils::formatLeft(os, fault_msg, stf::format_utils::VA_WIDTH + 4);
+        if (stf::format_utils::showPhys()) {
+            stf::format_utils::formatSpaces(os, stf::format_utils::PA_WIDTH + 1);
+        }
+    }
+    else {
+        stf::format_utils::formatSpaces(os, stf::format_utils::VA_WIDTH + 4);
+        if (stf::format_utils::showPhys()) {
+            stf::format_utils::formatSpaces(os, stf::format_utils::PA_WIDTH + 1);
         }
-        hw_tid_prev = hw_tid;
-        pid_prev = pid;
-        tid_prev = tid;
+    }
 
-        // Opcode width string (INST32/INST16) and index should each take up half of the label column
-        stf::print_utils::printLeft(inst.getOpcodeWidthStr(), stf::format_utils::LABEL_WIDTH / 2);
+    stf::format_utils::formatSpaces(os, 9); // Additional padding so that opcode lines up with operand values
+    printOpcodeWithDisassembly(os, dis, inst.opcode(), inst.pc());
 
-        stf::print_utils::printDecLeft(inst.index(), stf::format_utils::LABEL_WIDTH / 2);
+    if(!config.concise_mode) {
+        for(const auto& m: inst.getMemoryAccesses()) {
+            os << m << std::endl;
+        }
 
-        stf::print_utils::printVA(inst.pc());
+        if (config.show_pte) {
+            for(const auto& pte: inst.getEmbeddedPTEs()) {
+                os << pte->template as<stf::PageTableWalkRecord>();
+            }
+        }
 
-        if (stf::format_utils::showPhys()) {
-            // Make sure we zero-fill as needed, so that the address remains "virt:phys" and not "virt:  phys"
-            std::cout << ':';
-            stf::print_utils::printPA(inst.physPc());
+        for(const auto& reg: inst.getRegisterStates()) {
+            os << reg << std::endl;
         }
-        stf::print_utils::printSpaces(1);
-
-        if (STF_EXPECT_FALSE(inst.isTakenBranch())) {
-            std::cout << "PC ";
-            stf::print_utils::printVA(inst.branchTarget());
-            if (stf::format_utils::showPhys()) {
-                std::cout << ':';
-                stf::print_utils::printPA(inst.physBranchTarget());
-            }
-            stf::print_utils::printSpaces(1);
+
+        for(const auto& reg: inst.getOperands()) {
+            os << reg << std::endl;
         }
-        else if(STF_EXPECT_FALSE(config.concise_mode && (inst.isFault() || inst.isInterrupt()))) {
-            const std::string_view fault_msg = inst.isFault() ? "FAULT" : "INTERRUPT";
-            stf::print_utils::printLeft(fault_msg, stf::format_utils::VA_WIDTH + 4);
-            if (stf::format_utils::showPhys()) {
-                stf::print_utils::printSpaces(stf::format_utils::PA_WIDTH + 1);
-            }
+
+        for(const auto& evt: inst.getEvents()) {
+            os << evt << std::endl;
         }
-        else {
-            stf::print_utils::printSpaces(stf::format_utils::VA_WIDTH + 4);
-            if (stf::format_utils::showPhys()) {
-                stf::print_utils::printSpaces(stf::format_utils::PA_WIDTH + 1);
-            }
+
+        for(const auto& cmt: inst.getComments()) {
+            os << cmt->template as<stf::CommentRecord>() << std::endl;
         }
 
-        stf::print_utils::printSpaces(9); // Additional padding so that opcode lines up with operand values
-        printOpcodeWithDisassembly(dis, inst.opcode(), inst.pc());
+        for(const auto& uop: inst.getMicroOps()) {
+            const auto& microop = uop->template as<stf::InstMicroOpRecord>();
+            stf::format_utils::formatOperandLabel(os, microop.getSize() == 2 ? "UOp16 " : "UOp32 ");
+            stf::format_utils::formatSpaces(os, stf::format_utils::REGISTER_NAME_WIDTH + stf::format_utils::DATA_WIDTH);
+            printOpcodeWithDisassembly(os, dis, microop.getMicroOp(), inst.pc());
+        }
 
-        if(!config.concise_mode) {
-            for(const auto& m: inst.getMemoryAccesses()) {
-                std::cout << m << std::endl;
-            }
+        for(const auto& reg: inst.getReadyRegs()) {
+            stf::format_utils::formatOperandLabel(os, "ReadyReg ");
+            os << std::dec << reg->template as<stf::InstReadyRegRecord>().getReg() << std::endl;
+        }
+    }
+}
 
-            if (config.show_pte) {
-                for(const auto& pte: inst.getEmbeddedPTEs()) {
-                    std::cout << pte->template as<stf::PageTableWalkRecord>();
-                }
-            }
+template<typename IteratorType, typename StartStopType = std::nullopt_t>
+void processTrace_(const STFDumpConfig& config, const StartStopType start_point = std::nullopt, const StartStopType stop_point = std::nullopt) {
+    // Open stf trace reader
+    stf::STFInstReader stf_reader(config.trace_filename, config.user_mode_only, stf::format_utils::showPhys());
+    stf_reader.checkVersion();
 
-            for(const auto& reg: inst.getRegisterStates()) {
-                std::cout << reg << std::endl;
-            }
+    // Create disassembler
+    stf::Disassembler dis(findElfFromTrace(config.trace_filename), stf_reader.getISA(), stf_reader.getInitialIEM(), config.use_aliases);
 
-            for(const auto& reg: inst.getOperands()) {
-                std::cout << reg << std::endl;
-            }
+    if(!config.omit_header) {
+        printHeader_(config, stf_reader);
+    }
 
-            for(const auto& evt: inst.getEvents()) {
-                std::cout << evt << std::endl;
-            }
+    ThreadIDs prev_ids;
 
-            for(const auto& cmt: inst.getComments()) {
-                std::cout << cmt->template as<stf::CommentRecord>() << std::endl;
-            }
+    const auto start_inst = config.start_inst ? config.start_inst - 1 : 0;
 
-            for(const auto& uop: inst.getMicroOps()) {
-                const auto& microop = uop->template as<stf::InstMicroOpRecord>();
-                stf::print_utils::printOperandLabel(microop.getSize() == 2 ? "UOp16 " : "UOp32 ");
-                stf::print_utils::printSpaces(stf::format_utils::REGISTER_NAME_WIDTH + stf::format_utils::DATA_WIDTH);
-                printOpcodeWithDisassembly(dis, microop.getMicroOp(), inst.pc());
-            }
+    for (auto it = stf::getStartIterator<IteratorType>(stf_reader, start_inst, start_point, stop_point); it != stf_reader.end(); ++it) {
+        const auto& inst = *it;
 
-            for(const auto& reg: inst.getReadyRegs()) {
-                stf::print_utils::printOperandLabel("ReadyReg ");
-                std::cout << std::dec << reg->template as<stf::InstReadyRegRecord>().getReg() << std::endl;
-            }
-        }
+        checkValid_(inst);
+        printInst_(std::cout, config, dis, inst, prev_ids);
 
         if (STF_EXPECT_FALSE(config.end_inst && (inst.index() >= config.end_inst))) {
             break;
@@ -259,13 +320,162 @@ void processTrace_(const STFDumpConfig& config, const StartStopType start_point
     }
 }
 
+/**
+ * \class STFParallelDump
+ *
+ * Dumps a trace on multiple threads. The trace is split into chunk-sized segments, and each segment is
+ * formatted into a string by a worker with its own Disassembler. Segments are written to stdout in trace
+ * order as soon as every earlier segment has been written.
+ *
+ * The only state that crosses a segment boundary is the IDs of the previous instruction, which decide whether
+ * a PID header is printed. Each worker reads the instruction before its segment to get them, so the output is
+ * identical to the serial dump. Disassemblers that carry state between instructions are rejected, since their
+ * output would depend on every instruction before the segment. Embedded PTE records are read along with the
+ * instruction they belong to, so they are not affected by the segment boundaries.
+ */
+class STFParallelDump {
+    private:
+        static constexpr uint64_t SEGMENT_SIZE = stf::STFWriter::DEFAULT_CHUNK_SIZE;
+        static constexpr size_t MAX_PENDING_SEGMENTS_PER_THREAD = 2;
+
+        /**
+         * \struct SegmentOutput
+         * Formatted output of a single segment
+         */
+        struct SegmentOutput {
+            std::ostringstream os; /**< Formatted instructions */
+            ThreadIDs prev_ids; /**< IDs of the previously formatted instruction */
+            uint64_t print_start = 0; /**< 0-based index of the first instruction that is printed */
+            const stf::Disassembler* dis = nullptr; /**< Disassembler used by this segment */
+
+            SegmentOutput() {
+                os.imbue(std::locale(os.getloc(), new trace_tools::FastNumPut));
+            }
+        };
+
+        using Scanner = stf::STFParallelInstScanner<SegmentOutput>;
+        using Segment = Scanner::Segment;
+        using OutputQueue = trace_tools::OrderedCommitQueue<std::string>;
+
+        const STFDumpConfig& config_;
+        const size_t num_threads_;
+        const Scanner scanner_;
+        std::vector<std::unique_ptr<stf::Disassembler>> disassemblers_;
+
+    public:
+        /**
+         * Constructs an STFParallelDump
+         * \param config Dump configuration
+         * \param stf_reader Reader used to get the trace ISA and IEM
+         */
+        STFParallelDump(const STFDumpConfig& config, const stf::STFInstReader& stf_reader) :
+            config_(config),
+            num_threads_(trace_tools::getNumWorkerThreads(config.num_threads)),
+            scanner_(config.trace_filename, num_threads_, SEGMENT_SIZE)
+        {
+            // Disassemblers are created up front since backend initialization is not thread-safe
+            const auto elf = findElfFromTrace(config.trace_filename);
+            for(size_t i = 0; i < num_threads_; ++i) {
+                disassemblers_.emplace_back(std::make_unique<stf::Disassembler>(elf,
+                                                                                stf_reader.getISA(),
+                                                                                stf_reader.getInitialIEM(),
+                                                                                config.use_aliases));
+            }
+
+            stf_assert(!disassemblers_.front()->isStateful(),
+                       "-j can't be used with a disassembler that carries state between instructions, since its "
+                       "output would differ from the serial dump. Set STF_DISASM=MAVIS or drop -j.");
+        }
+
+        /**
+         * Dumps the instructions selected by the configuration
+         */
+        void dump() {
+            const uint64_t start_inst = config_.start_inst ? config_.start_inst - 1 : 0;
+            const uint64_t end_inst = config_.end_inst ? config_.end_inst : std::numeric_limits<uint64_t>::max();
+            const uint64_t num_insts = end_inst - start_inst;
+            const size_t max_segments = static_cast<size_t>(num_insts / SEGMENT_SIZE + (num_insts % SEGMENT_SIZE != 0));
+
+            OutputQueue output_queue(
+                MAX_PENDING_SEGMENTS_PER_THREAD * num_threads_,
+                [](std::string&& str) {
+                    std::cout.write(str.data(), static_cast<std::streamsize>(str.size()));
+                }
+            );
+
+            trace_tools::parallelForUntil(
+                num_threads_,
+                [this, start_inst, end_inst, &output_queue](const size_t segment_idx, const size_t worker_idx) {
+                    try {
+                        output_queue.waitForSlot(segment_idx);
+
+                        const uint64_t segment_start = start_inst + segment_idx * SEGMENT_SIZE;
+                        const uint64_t segment_end = segment_start + std::min(SEGMENT_SIZE, end_inst - segment_start);
+                        // Every segment but the first also reads the instruction before it to get its IDs
+                        const uint64_t read_start = segment_start == start_inst ? segment_start : segment_start - 1;
+
+                        Segment segment(read_start);
+                        segment.result.print_start = segment_start;
+                        segment.result.dis = disassemblers_[worker_idx].get();
+
+                        const bool more_insts = scanner_.scanSegment(
+                            segment,
+                            segment_end - read_start,
+                            [this](Segment& seg, const stf::STFInst& inst) {
+                                auto& result = seg.result;
+                                if(seg.start_inst + seg.num_insts < result.print_start) {
+                                    result.prev_ids.hw_tid = inst.hwtid();
+                                    result.prev_ids.pid = inst.pid();
+                                    result.prev_ids.tid = inst.tid();
+                                }
+                                else {
+                                    checkValid_(inst);
+                                    printInst_(result.os, config_, *result.dis, inst, result.prev_ids);
+                                }
+                            }
+                        );
+
+                        output_queue.commit(segment_idx, segment.result.os.str());
+
+                        return more_insts;
+                    }
+                    catch(const OutputQueue::AbortedException&) {
+                        // Another worker failed, and its exception is the one that gets reported
+                        return false;
+                    }
+                    catch(...) {
+                        // Wake up any workers that are waiting on this segment
+                        output_queue.abort();
+                        throw;
+                    }
+                },
+                max_segments
+            );
+        }
+};
+
 int main (int argc, char **argv)
 {
     // Get arguments
     try {
         const STFDumpConfig config = parseCommandLine (argc, argv);
 
-        if(config.use_tracepoint_roi) {
+        std::optional<trace_tools::BufferedStdout> buffered_stdout;
+        if(config.buffered_output) {
+            buffered_stdout.emplace();
+        }
+
+        if(config.num_threads != 1) {
+            stf::STFInstReader stf_reader(config.trace_filename);
+            stf_reader.checkVersion();
+
+            if(!config.omit_header) {
+                printHeader_(config, stf_reader);
+            }
+
+            STFParallelDump(config, stf_reader).dump();
+        }
+        else if(config.use_tracepoint_roi) {
             if(config.use_pc_roi) {
                 processTrace_<stf::STFPCIterator>(config, config.roi_start_pc, config.roi_stop_pc);
             }
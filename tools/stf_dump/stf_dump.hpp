@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
 #include <string>
 
@@ -19,6 +20,8 @@ struct STFDumpConfig {
     bool use_aliases = false; /**< Use aliases when disassembling */
     bool show_pte = false; /**< Show PTE records */
     bool omit_header = false; /**< If true, do not dump the header information */
+    bool buffered_output = false; /**< If true, use the buffered output formatter */
+    size_t num_threads = 1; /**< Number of threads used to dump the trace */
     bool use_tracepoint_roi = false; /**< If true, only dump instructions between tracepoints */
     uint32_t roi_start_opcode = 0; /**< Overrides ROI tracepoint start opcode if nonzero */
     uint32_t roi_stop_opcode = 0; /**< Overrides ROI tracepoint stop opcode if nonzero */
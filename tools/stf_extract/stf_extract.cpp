@@ -7,6 +7,7 @@
  * Usage:
  * -b 1000:  head only the first 1000 records.
  * -s 1000:  skip the first 1000, output the rest.
+ * -j 8:     scan the skipped instructions and write split traces on 8 threads.
  *
  */
 
@@ -33,15 +34,20 @@ static STFExtractConfig parse_command_line (int argc, char **argv)
     parser.addFlag('l', "filter out kernel code while extracting");
     parser.addFlag('d', "for slicing (-s/-k/-t) output PTE records on demand");
     parser.addFlag('u', "only count user-mode instructions for -s/-k/-t parameters. Non-user instructions will still be included in the extracted trace unless -l is specified.");
+    parser.addFlag('j', "N", "use N threads. 0 uses all available hardware threads. The instructions skipped by -s are scanned in parallel for their register state, PTEs and comments, then the first extracted instruction is found with the trace chunk index. With -t, split traces are also written in parallel. Output is the same as with one thread.");
     parser.addPositionalArgument("trace", "trace in STF format");
     parser.appendHelpText("common usages:");
     //parser.appendHelpText("    -b <n> -e <m> -o <output> <input> -- write instructions [<n>, <m>) from <input> to <output>");
     parser.appendHelpText("    -s <n> -k <m> -o <output> <input> -- skip the first <n> instructions and write the next <m> to <output>");
     parser.appendHelpText("    -s <n> -o <output> <input> -- skip the first <n> instructions and write the rest to <output>");
     parser.appendHelpText("    -s <n> -t <m> <output> <input> -- skip the first <n> instructions and write every <m> instructions to <output.xxxxx.zstf>");
+    parser.appendHelpText("    -j 0 -s <n> -k <m> -o <output> <input> -- skip the first <n> instructions using every hardware thread and write the next <m> to <output>");
     parser.appendHelpText("    -t <m> -o <output> <input> -- write every <m> instructions to <output.xxxxx.zstf>");
 
     parser.setMutuallyExclusive('k', 't');
+    // The chunk index counts every instruction, so it can't be used when only some instructions are counted
+    parser.setMutuallyExclusive('j', 'u');
+    parser.setMutuallyExclusive('j', 'l');
 
     parser.parseArguments(argc, argv);
 
@@ -57,6 +63,7 @@ static STFExtractConfig parse_command_line (int argc, char **argv)
     config.dump_ptes_on_demand = parser.hasArgument('d');
 
     config.user_mode_counts = parser.hasArgument('u');
+    parser.getArgumentValue('j', config.num_threads);
 
     parser.getPositionalArgument(0, config.trace_filename);
 
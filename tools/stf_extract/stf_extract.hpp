@@ -1,18 +1,25 @@
 #pragma once
 
 #include <cstdint>
+#include <iostream>
+#include <limits>
 #include <memory>
+#include <optional>
 #include <string>
 #include <string_view>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
 #include "stf_enums.hpp"
 #include "stf_pc_tracker.hpp"
 #include "stf_pte.hpp"
 #include "stf_inst_reader.hpp"
+#include "stf_parallel_inst_scanner.hpp"
 #include "stf_record_types.hpp"
 #include "stf_reg_state.hpp"
 #include "stf_writer.hpp"
+#include "thread_pool.hpp"
 
 /**
  * \struct STFExtractConfig
@@ -28,6 +35,7 @@ struct STFExtractConfig {
     bool filter_kernel_code = false; /**< If true, filter out kernel code */
     bool dump_ptes_on_demand = false; /**< If true, dump PTEs in line with instructions that need the translation */
     bool user_mode_counts = false; /**< If true, only count user-mode instructions when slicing, but still output non-user instructions */
+    size_t num_threads = 1; /**< Number of threads used to scan skipped instructions and write split traces. 0 uses all available hardware threads. */
 };
 
 /**
@@ -36,6 +44,52 @@ struct STFExtractConfig {
  */
 class STFExtractor {
     private:
+        /**
+         * \struct SegmentState_
+         * Holds the state accumulated over a range of instructions that a later split trace needs in its header:
+         * comments, the last value written to each register, PTEs and the PC following the range
+         */
+        struct SegmentState_ {
+            std::vector<std::string> comments; /**< Comment records */
+            std::unordered_map<stf::Registers::STF_REG, stf::InstRegRecord> regs; /**< Last register state/dest operand record for each register */
+            std::vector<std::pair<uint32_t, stf::STFRecord::UniqueHandle>> ptes; /**< PTE records and the PIDs that own them, in trace order */
+            std::optional<stf::PCTracker> pc_tracker; /**< Tracks the PC following the range */
+
+            /**
+             * Updates the state with an instruction. Mirrors STFExtractor::processInst_.
+             * \param inst Instruction
+             * \param inst_count Instruction count that processInst_ would have assigned to inst
+             * \param inst_offset Offset instruction PCs by this address
+             */
+            void update(const stf::STFInst& inst, const uint64_t inst_count, const uint64_t inst_offset) {
+                for(const auto& c: inst.getComments()) {
+                    comments.emplace_back(c->as<stf::CommentRecord>().getData());
+                }
+
+                for(const auto& s: inst.getRegisterStates()) {
+                    regs.insert_or_assign(s.getReg(), s.getRecord());
+                }
+
+                for(const auto& s: inst.getDestOperands()) {
+                    regs.insert_or_assign(s.getReg(), s.getRecord());
+                }
+
+                for(const auto& p: inst.getEmbeddedPTEs()) {
+                    auto& pte = ptes.emplace_back(inst.pid(), p->clone());
+                    const_cast<stf::PageTableWalkRecord&>(pte.second->as<stf::PageTableWalkRecord>()).setIndex(inst_count);
+                }
+
+                if(!pc_tracker) {
+                    pc_tracker.emplace(inst.pc(), inst_offset);
+                }
+                pc_tracker->track(inst);
+            }
+        };
+
+        using SegmentScanner_ = stf::STFParallelInstScanner<SegmentState_>;
+        using Segment_ = SegmentScanner_::Segment;
+
+        const STFExtractConfig config_; /**< Configuration used to construct per-thread extractors */
         stf::STFInstReader stf_reader_; /**< STF reader to use */
         stf::STFInstReader::iterator inst_it_;
         stf::STFWriter stf_writer_; /**< STF writer to use */
@@ -47,6 +101,8 @@ class STFExtractor {
         const bool dump_ptes_on_demand_; /**< If true, dump PTEs in line with instructions that need the translation */
         const bool user_mode_counts_; /**< If true, only count user-mode instructions when slicing, but still output non-user instructions */
         const bool filter_kernel_code_; /**< If true, filter out all non-user code */
+        const uint64_t inst_offset_; /**< Offset instruction PCs by this address */
+        const size_t num_threads_; /**< Number of threads used to scan skipped instructions and write split traces */
 
         bool in_user_code_ = false; /**< If true, we are currently in user-mode code */
         std::vector<std::string> comments_; /**< Tracks comment records */
@@ -105,6 +161,131 @@ class STFExtractor {
             return skipped;
         }
 
+        /**
+         * \brief Scans the first skipcount instructions in parallel for the state that processInst_ would have
+         * accumulated over them (see SegmentState_)
+         * \returns Scanned segments in trace order
+         */
+        std::vector<Segment_> scanSkip_(const uint64_t skipcount) const {
+            // PTE indices in the skipped region count from the start of the trace
+            return SegmentScanner_(config_.trace_filename, num_threads_).scan(
+                0,
+                skipcount,
+                [this](Segment_& segment, const stf::STFInst& inst) {
+                    segment.result.update(inst, segment.start_inst + segment.num_insts + 1, inst_offset_);
+                }
+            );
+        }
+
+        /**
+         * \brief Gets the number of instructions covered by a list of scanned segments
+         */
+        static inline uint64_t getNumScannedInsts_(const std::vector<Segment_>& segments) {
+            return segments.empty() ? 0 : segments.back().start_inst + segments.back().num_insts;
+        }
+
+        /**
+         * \brief Skip the first skipcount instructions on multiple threads. The skipped instructions are scanned
+         * in parallel to rebuild the same state as extractSkip_, then the reader seeks past them using the trace
+         * chunk index.
+         * Return number of instructions skipped
+         */
+        uint64_t seekSkip_(const uint64_t skipcount) {
+            if(skipcount == 0) {
+                return 0;
+            }
+
+            const auto skip_segments = scanSkip_(skipcount);
+            const uint64_t skipped = getNumScannedInsts_(skip_segments);
+
+            for(const auto& segment: skip_segments) {
+                applySegmentState_(segment.result);
+            }
+
+            if(skipped == skipcount) {
+                inst_it_ = stf_reader_.begin(skipcount);
+            }
+
+            return skipped;
+        }
+
+        /**
+         * \brief Applies the state accumulated over a range of earlier instructions
+         * as if those instructions had been processed by processInst_
+         */
+        void applySegmentState_(const SegmentState_& state) {
+            comments_.insert(comments_.end(), state.comments.begin(), state.comments.end());
+
+            for(const auto& r: state.regs) {
+                regstate_.regStateUpdate(r.second);
+            }
+
+            for(const auto& p: state.ptes) {
+                page_table_.UpdatePTE(p.first, &p.second->as<stf::PageTableWalkRecord>());
+            }
+
+            if(state.pc_tracker) {
+                pc_tracker_ = *state.pc_tracker;
+            }
+        }
+
+        /**
+         * \brief Splits the trace into split_count instruction traces on multiple threads
+         *
+         * The trace is scanned in parallel once to collect the state each split trace needs in its
+         * header (see SegmentState_). Every split trace is then extracted by its own STFExtractor, which
+         * seeks directly to the start of the split and starts from the combined state of everything
+         * before it, so the output is identical to the serial path.
+         */
+        void runParallelSplit_(const uint64_t skip_count, const uint64_t split_count, const std::string& output_filename) {
+            const auto skip_segments = scanSkip_(skip_count);
+            const uint64_t skipped = getNumScannedInsts_(skip_segments);
+            stf_assert(skipped == skip_count,
+                       "Specified skip count (" << skip_count << ") was greater than the trace length (" << skipped << ").");
+
+            // PTE indices in each split count from the start of the split
+            const auto split_segments = SegmentScanner_(config_.trace_filename, num_threads_, split_count).scan(
+                skip_count,
+                [this](Segment_& segment, const stf::STFInst& inst) {
+                    segment.result.update(inst, segment.num_insts + 1, inst_offset_);
+                }
+            );
+
+            // Like the serial path, keep writing files until one comes up short, even if it ends up empty
+            const size_t num_files = split_segments.size() +
+                                     (split_segments.empty() || split_segments.back().num_insts == split_count);
+            std::vector<uint64_t> inst_counts(num_files);
+
+            trace_tools::parallelFor(
+                num_files,
+                num_threads_,
+                [this, skip_count, split_count, &output_filename, &skip_segments, &split_segments, &inst_counts](const size_t file_idx, const size_t) {
+                    STFExtractor extractor(config_);
+
+                    for(const auto& segment: skip_segments) {
+                        extractor.applySegmentState_(segment.result);
+                    }
+
+                    for(size_t i = 0; i < file_idx; ++i) {
+                        extractor.applySegmentState_(split_segments[i].result);
+                    }
+
+                    extractor.inst_it_ = extractor.stf_reader_.begin(skip_count + file_idx * split_count);
+
+                    const std::string cur_output_file = output_filename + '.' + std::to_string(file_idx) + ".zstf";
+                    extractor.stf_writer_.open(cur_output_file);
+                    stf_assert(extractor.stf_writer_, "Error: Failed to open output " << cur_output_file);
+                    inst_counts[file_idx] = extractor.extractInstr_(split_count, skip_count || file_idx);
+                    extractor.stf_writer_.close();
+                }
+            );
+
+            for(size_t i = 0; i < num_files; ++i) {
+                std::cerr << skip_count << " Creating split trace file " << output_filename << '.' << i << ".zstf" << std::endl;
+                std::cerr << "Output " << inst_counts[i] << " instructions" << std::endl;
+            }
+        }
+
         /**
          * \brief extract instcount instructions; and update TLB page table;
          */
@@ -153,8 +334,6 @@ class STFExtractor {
                 stf_writer_.finalizeHeader();
             }
 
-            std::vector<stf::STFRecord::UniqueHandle> inst_records;
-
             // Process trace records
             while ((inst_it_ != stf_reader_.end()) && (count < max_instcount)) {
                 processInst_(*inst_it_, count, true);
@@ -187,7 +366,6 @@ class STFExtractor {
                 ++inst_it_;
             }
 
-            std::cerr << "Output " << count << " instructions" << std::endl;
             return count;
         }
 
@@ -201,7 +379,12 @@ class STFExtractor {
          * \param output_filename Output filename to write
          */
         void run(uint64_t head_count, const uint64_t skip_count, const uint64_t split_count, const std::string& output_filename) {
-            uint64_t overall_instcnt = extractSkip_(skip_count);
+            if (split_count > 0 && num_threads_ != 1) {
+                runParallelSplit_(skip_count, split_count, output_filename);
+                return;
+            }
+
+            uint64_t overall_instcnt = num_threads_ != 1 ? seekSkip_(skip_count) : extractSkip_(skip_count);
 
             stf_assert(overall_instcnt == skip_count,
                        "Specified skip count (" << skip_count << ") was greater than the trace length (" << overall_instcnt << ").");
@@ -220,6 +403,7 @@ class STFExtractor {
                     stf_assert(stf_writer_, "Error: Failed to open output " << cur_output_file);
 
                     inst_written = extractInstr_(split_count, modify_header);
+                    std::cerr << "Output " << inst_written << " instructions" << std::endl;
                     modify_header = true;
                     stf_writer_.close();
 
@@ -235,7 +419,8 @@ class STFExtractor {
 
                 stf_writer_.open(output_filename);
                 stf_assert(stf_writer_, "Error: Failed to open output " << output_filename);
-                extractInstr_(head_count, overall_instcnt);
+                const uint64_t inst_written = extractInstr_(head_count, overall_instcnt);
+                std::cerr << "Output " << inst_written << " instructions" << std::endl;
                 stf_writer_.close();
             }
         }
@@ -245,6 +430,7 @@ class STFExtractor {
          * \param config Config to use
          */
         explicit STFExtractor(const STFExtractConfig& config) :
+            config_(config),
             stf_reader_(config.trace_filename, config.filter_kernel_code),
             inst_it_(stf_reader_.begin()),
             page_table_(nullptr, nullptr, true),
@@ -253,6 +439,8 @@ class STFExtractor {
             dump_ptes_on_demand_(config.dump_ptes_on_demand || stf_reader_.getTraceFeatures()->hasFeature(stf::TRACE_FEATURES::STF_CONTAIN_PTE)),
             user_mode_counts_(config.user_mode_counts),
             filter_kernel_code_(config.filter_kernel_code),
+            inst_offset_(config.inst_offset),
+            num_threads_(config.num_threads),
             in_user_code_(config.filter_kernel_code)
         {
         }
@@ -11,13 +11,17 @@ void processCommandLine(int argc,
                         bool& skip_non_user,
                         uint64_t& end_insts,
                         bool& profile,
-                        uint64_t& warmup_insts) {
+                        uint64_t& warmup_insts,
+                        bool& use_symbol_cache,
+                        size_t& num_threads) {
     trace_tools::CommandLineParser parser("stf_function_histogram");
     parser.addFlag('E', "elf", "ELF file to analyze (defaults to trace.elf)");
     parser.addFlag('u', "skip non user-mode instructions");
     parser.addFlag('e', "end_insts", "stop after specified number of instructions");
     parser.addFlag('p', "profile functions in program");
     parser.addFlag('s', "warmup_insts", "Skip the the specified warmup instructions");
+    parser.addFlag('N', "don't use the on-disk symbol table cache (location can be set with STF_SYMBOL_CACHE_DIR)");
+    parser.addFlag('j', "N", "load DWARF symbols in parallel using N threads. 0 uses all available hardware threads.");
 
     parser.addPositionalArgument("trace", "trace in STF format");
     parser.parseArguments(argc, argv);
@@ -40,6 +44,8 @@ void processCommandLine(int argc,
     }
 
     profile = parser.hasArgument('p');
+    use_symbol_cache = !parser.hasArgument('N');
+    parser.getArgumentValue('j', num_threads);
 }
 
 int main(int argc, char** argv) {
@@ -49,15 +55,17 @@ int main(int argc, char** argv) {
     uint64_t end_insts;
     bool profile;
     uint64_t warmup_insts;
+    bool use_symbol_cache;
+    size_t num_threads = 1;
     try {
-        processCommandLine(argc, argv, trace, elf, skip_non_user, end_insts, profile, warmup_insts);
+        processCommandLine(argc, argv, trace, elf, skip_non_user, end_insts, profile, warmup_insts, use_symbol_cache, num_threads);
     }
     catch(const trace_tools::CommandLineParser::EarlyExitException& e) {
         std::cerr << e.what() << std::endl;
         return e.getCode();
     }
 
-    SymbolHistogram hist(elf);
+    SymbolHistogram hist(elf, use_symbol_cache, num_threads);
 
     {
         // Find out where the trace starts
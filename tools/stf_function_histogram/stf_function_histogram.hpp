@@ -13,8 +13,10 @@ class SymbolHistogram {
         uint64_t total_ins_count_ = 0;
 
     public:
-        explicit SymbolHistogram(const std::string& elf) :
-            symbol_table_(elf)
+        explicit SymbolHistogram(const std::string& elf,
+                                 const bool use_symbol_cache = true,
+                                 const size_t num_threads = 1) :
+            symbol_table_(elf, use_symbol_cache, num_threads)
         {
             stf_assert(!symbol_table_.empty(), elf << " does not contain any symbol information!");
         }
@@ -40,14 +40,16 @@ class STFMergeExtractor {
     public:
         /**
          * \brief Helper function to parse the Escape record for thread id information;
-         *  return 1 if the record is opcode record, otherwise return 0;
+         *  returns the record that should be forwarded to the output trace.
+         *  PTE records are moved into the record map, so rec is empty afterward and the
+         *  returned reference points at the retained, reindexed record.
          *
          * \param rec the STF record
          * \param page_table the live TLB page table without size limitation;
          */
-        void processRecord(stf::STFRecord::UniqueHandle& rec,
-                           stf::STF_PTE& page_table,
-                           const uint64_t inst_count) {
+        const stf::STFRecord& processRecord(stf::STFRecord::UniqueHandle& rec,
+                                            stf::STF_PTE& page_table,
+                                            const uint64_t inst_count) {
             // keep track of initial values of PC and INST_IEM
             switch (rec->getId()) {
                 case stf::descriptors::internal::Descriptor::STF_PROCESS_ID_EXT:
@@ -65,8 +67,8 @@ class STFMergeExtractor {
                         const auto& pte_rec = result->as<stf::PageTableWalkRecord>();
                         const_cast<stf::PageTableWalkRecord&>(pte_rec).setIndex(inst_count + 1);
                         page_table.UpdatePTE(inst_pid_, &pte_rec);
+                        return pte_rec;
                     }
-                    break;
 
                 case stf::descriptors::internal::Descriptor::STF_RESERVED:
                 case stf::descriptors::internal::Descriptor::STF_IDENTIFIER:
@@ -98,6 +100,8 @@ class STFMergeExtractor {
                 case stf::descriptors::internal::Descriptor::STF_TRANSACTION_DEPENDENCY:
                     break;
             }
+
+            return *rec;
         }
 
         /**
@@ -159,8 +163,7 @@ class STFMergeExtractor {
             try {
                 while ((count < instcount) && (stf_reader >> rec)) {
                     count = stf_reader.numInstsRead() - init_count;
-                    processRecord(rec, page_table, count);
-                    stf_writer << *rec;
+                    stf_writer << processRecord(rec, page_table, count);
                 }
             }
             catch(const stf::EOFException&) {
@@ -9,6 +9,7 @@
 #include "file_utils.hpp"
 #include "stf_record_types.hpp"
 #include "stf_reader.hpp"
+#include "stf_record_copier.hpp"
 #include "stf_writer.hpp"
 #include "tools_util.hpp"
 
@@ -18,7 +19,8 @@ static void parseCommandLine(int argc,
                              std::string& outfile,
                              bool& overwrite,
                              int& compression_level,
-                             size_t& chunk_size) {
+                             size_t& chunk_size,
+                             bool& pipelined) {
     overwrite = false;
     compression_level = -1; // -1 == default compression level
     chunk_size = stf::STFWriter::DEFAULT_CHUNK_SIZE;
@@ -27,6 +29,7 @@ static void parseCommandLine(int argc,
     parser.addFlag('f', "Overwrite existing file");
     parser.addFlag('c', "#", "Compression level (ZSTD: 1-22, default 3)");
     parser.addFlag('C', "#", "Chunk size (default " + std::to_string(stf::STFWriter::DEFAULT_CHUNK_SIZE) + ")");
+    parser.addFlag('p', "Read and decompress the input on a separate thread. The output is still compressed on a single thread.");
     parser.addPositionalArgument("infile", "STF to recompress");
     parser.addPositionalArgument("outfile", "Output STF file");
     parser.parseArguments(argc, argv);
@@ -34,6 +37,7 @@ static void parseCommandLine(int argc,
     overwrite = parser.hasArgument('f');
     parser.getArgumentValue('c', compression_level);
     parser.getArgumentValue('C', chunk_size);
+    pipelined = parser.hasArgument('p');
 
     parser.getPositionalArgument(0, infile);
     parser.getPositionalArgument(1, outfile);
@@ -45,9 +49,10 @@ int main(int argc, char* argv[]) {
     std::string outfile;
     int compression_level = -1;
     size_t chunk_size;
+    bool pipelined = false;
 
     try {
-        parseCommandLine(argc, argv, infile, outfile, overwrite, compression_level, chunk_size);
+        parseCommandLine(argc, argv, infile, outfile, overwrite, compression_level, chunk_size, pipelined);
     }
     catch(const trace_tools::CommandLineParser::EarlyExitException& e) {
         std::cerr << e.what() << std::endl;
@@ -70,15 +75,7 @@ int main(int argc, char* argv[]) {
     reader.copyHeader(writer);
     writer.finalizeHeader();
 
-    try {
-        stf::STFRecord::UniqueHandle r;
-        while(reader) {
-            reader >> r;
-            writer << *r;
-        }
-    }
-    catch(const stf::EOFException&) {
-    }
+    trace_tools::STFRecordCopier::copy(reader, writer, pipelined);
 
     reader.close();
     writer.close();
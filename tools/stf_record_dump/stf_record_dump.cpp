@@ -1,9 +1,11 @@
 #include <iostream>
+#include <optional>
 
 #include "print_utils.hpp"
 #include "stf_reader.hpp"
 #include "stf_record_types.hpp"
 
+#include "buffered_output.hpp"
 #include "command_line_parser.hpp"
 #include "stf_record_dump.hpp"
 #include "tools_util.hpp"
@@ -22,6 +24,7 @@ static STFRecordDumpConfig parseCommandLine(int argc, char **argv) {
     parser.addFlag('S', "N", "start dumping at N-th record");
     parser.addFlag('E', "M", "end dumping at M-th record");
     parser.addFlag('y', "*_symTab.yaml", "YAML symbol table file to show annotation");
+    parser.addFlag('F', "buffer output in large blocks with faster number formatting. Output is unchanged, but is not flushed after every line.");
     parser.addPositionalArgument("trace", "trace in STF format");
     parser.parseArguments(argc, argv);
 
@@ -31,6 +34,7 @@ static STFRecordDumpConfig parseCommandLine(int argc, char **argv) {
     parser.getArgumentValue('S', config.start_record);
     parser.getArgumentValue('E', config.end_record);
     config.show_annotation = parser.getArgumentValue('y', config.symbol_filename);
+    config.buffered_output = parser.hasArgument('F');
 
     parser.getPositionalArgument(0, config.trace_filename);
 
@@ -52,6 +56,11 @@ int main (int argc, char **argv)
         // Get arguments
         const STFRecordDumpConfig config = parseCommandLine(argc, argv);
 
+        std::optional<trace_tools::BufferedStdout> buffered_stdout;
+        if(config.buffered_output) {
+            buffered_stdout.emplace();
+        }
+
         // Open stf trace reader
         stf::STFReader stf_reader(config.trace_filename);
         stf_reader.checkVersion();
@@ -16,4 +16,5 @@ struct STFRecordDumpConfig {
     uint64_t start_record = 0; /**< Start instruction */
     uint64_t end_record = 0; /**< End instruction */
     bool use_aliases = false; /**< Use aliases when disassembling */
+    bool buffered_output = false; /**< If true, use the buffered output formatter */
 };
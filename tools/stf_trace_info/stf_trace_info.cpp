@@ -16,6 +16,7 @@
 #include "command_line_parser.hpp"
 #include "format_utils.hpp"
 #include "stf_reader.hpp"
+#include "stf_record_copier.hpp"
 #include "stf_writer.hpp"
 #include "stf_record_types.hpp"
 #include "tools_util.hpp"
@@ -30,7 +31,8 @@ static void parseCommandLine(int argc,
                                std::string& output_filename,
                                stf::TraceInfoRecord& trace_info,
                                stf::TraceInfoFeatureRecord& trace_features,
-                               bool& show_detail) {
+                               bool& show_detail,
+                               bool& pipelined) {
     // Parse options
     trace_tools::CommandLineParser parser("stf_trace_info");
     parser.addFlag('o', "output", " Generate output trace filename with specified trace info. If not specified, show existing trace info.");
@@ -39,6 +41,7 @@ static void parseCommandLine(int argc,
     parser.addFlag('c', "comment", "Specify trace info comment for output");
     parser.addMultiFlag('f', "feature", "Specify 32bit hex value for trace info feature for output");
     parser.addFlag('d', "Show the detailed info, such as trace version, comments etc.");
+    parser.addFlag('p', "Read and decompress the input on a separate thread when writing an output trace");
     parser.addPositionalArgument("trace", "trace in STF format");
 
     parser.appendHelpText("Trace Feature Codes:");
@@ -82,6 +85,7 @@ static void parseCommandLine(int argc,
     }
 
     show_detail = parser.hasArgument('d');
+    pipelined = parser.hasArgument('p');
     parser.getPositionalArgument(0, trace_filename);
 
     const auto generator = trace_info.getGenerator();
@@ -148,9 +152,10 @@ int main (int argc, char **argv) {
     stf::TraceInfoRecord trace_info;
     stf::TraceInfoFeatureRecord trace_features;
     bool show_detail = false;
+    bool pipelined = false;
 
     try {
-        parseCommandLine (argc, argv, trace_filename, output_filename, trace_info, trace_features, show_detail);
+        parseCommandLine (argc, argv, trace_filename, output_filename, trace_info, trace_features, show_detail, pipelined);
     }
     catch(const trace_tools::CommandLineParser::EarlyExitException& e) {
         std::cerr << e.what() << std::endl;
@@ -179,8 +184,6 @@ int main (int argc, char **argv) {
         std::cerr << reader.major() << '.' << reader.minor() << std::endl;
     }
 
-    stf::STFRecord::UniqueHandle rec;
-    std::unique_ptr<stf::STFRecord> output_rec;
     // current trace
     if(writer) {
         reader.copyHeader(writer);
@@ -198,13 +201,7 @@ int main (int argc, char **argv) {
     }
 
     if(writer) {
-        try {
-            while (reader >> rec) {
-                writer << *rec;
-            }
-        }
-        catch(const stf::EOFException& e) {
-        }
+        trace_tools::STFRecordCopier::copy(reader, writer, pipelined);
     }
 
     reader.close();